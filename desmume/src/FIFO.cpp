@@ -19,6 +19,7 @@
 
 #include "FIFO.h"
 #include <string.h>
+#include <algorithm>
 #include "armcpu.h"
 #include "debug.h"
 #include "mem.h"
@@ -29,10 +30,45 @@
 // ========================================================= IPC FIFO
 IPC_FIFO ipc_fifo[2];
 
+static IPC_Statistics ipcStats, ipcLastFrameStats;
+
+void IPC_EndFrame()
+{
+	ipcLastFrameStats = ipcStats;
+	memset(&ipcStats, 0, sizeof(ipcStats));
+}
+
+const IPC_Statistics& IPC_GetFrameStatistics()
+{
+	return ipcLastFrameStats;
+}
+
+static FORCEINLINE void IPC_makeIrq(u8 proc, u32 num)
+{
+	ipcStats.irqs[proc]++;
+	NDS_makeIrq(proc, num);
+}
+
+//the empty/full bits of a fifocnt register follow the fill levels of the fifo it sends with and the one it receives from
+static u16 IPC_FIFOcntStatus(u16 cnt, u8 sendSize, u8 recvSize)
+{
+	cnt &= ~(IPCFIFOCNT_SENDEMPTY | IPCFIFOCNT_SENDFULL | IPCFIFOCNT_RECVEMPTY | IPCFIFOCNT_RECVFULL);
+
+	if (sendSize == 0) cnt |= IPCFIFOCNT_SENDEMPTY;
+	else if (sendSize > 15) cnt |= IPCFIFOCNT_SENDFULL;
+
+	if (recvSize == 0) cnt |= IPCFIFOCNT_RECVEMPTY;
+	else if (recvSize > 15) cnt |= IPCFIFOCNT_RECVFULL;
+
+	return cnt;
+}
+
 void IPC_FIFOinit(u8 proc)
 {
 	memset(&ipc_fifo[proc], 0, sizeof(IPC_FIFO));
 	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, 0x00000101);
+	memset(&ipcStats, 0, sizeof(ipcStats));
+	memset(&ipcLastFrameStats, 0, sizeof(ipcLastFrameStats));
 }
 
 void IPC_FIFOsend(u8 proc, u32 val)
@@ -40,37 +76,36 @@ void IPC_FIFOsend(u8 proc, u32 val)
 	u16 cnt_l = T1ReadWord(MMU.MMU_MEM[proc][0x40], 0x184);
 	if (!(cnt_l & IPCFIFOCNT_FIFOENABLE)) return;			// FIFO disabled
 	u8	proc_remote = proc ^ 1;
+	IPC_FIFO &fifo = ipc_fifo[proc];
 
-	if (ipc_fifo[proc].size > 15)
+	if (IPC_FIFOsize(fifo) > 15)
 	{
 		cnt_l |= IPCFIFOCNT_FIFOERROR;
 		T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
+		ipcStats.fifoErrors[proc]++;
 		return;
 	}
 
 	u16 cnt_r = T1ReadWord(MMU.MMU_MEM[proc_remote][0x40], 0x184);
 
 	//LOG("IPC%s send FIFO 0x%08X size %03i (l 0x%X, tail %02i) (r 0x%X, tail %02i)\n", 
-	//	proc?"7":"9", val, ipc_fifo[proc].size, cnt_l, ipc_fifo[proc].tail, cnt_r, ipc_fifo[proc^1].tail);
-	
-	cnt_l &= 0xBFFC;		// clear send empty bit & full
-	cnt_r &= 0xBCFF;		// set recv empty bit & full
-	ipc_fifo[proc].buf[ipc_fifo[proc].tail] = val;
-	ipc_fifo[proc].tail++;
-	ipc_fifo[proc].size++;
-	if (ipc_fifo[proc].tail > 15) ipc_fifo[proc].tail = 0;
-	
-	if (ipc_fifo[proc].size > 15)
-	{
-		cnt_l |= IPCFIFOCNT_SENDFULL;		// set send full bit
-		cnt_r |= IPCFIFOCNT_RECVFULL;		// set recv full bit
-	}
+	//	proc?"7":"9", val, IPC_FIFOsize(fifo), cnt_l, fifo.tail & 15, cnt_r, ipc_fifo[proc^1].tail & 15);
+
+	fifo.buf[fifo.tail & 15] = val;
+	fifo.stamp[fifo.tail & 15] = nds_timer;
+	fifo.tail++;
+	ipcStats.fifoSent[proc]++;
+
+	const u8 sendSize = IPC_FIFOsize(fifo);
+	const u8 recvSize = IPC_FIFOsize(ipc_fifo[proc_remote]);
+	cnt_l = IPC_FIFOcntStatus(cnt_l & ~IPCFIFOCNT_FIFOERROR, sendSize, recvSize);
+	cnt_r = IPC_FIFOcntStatus(cnt_r & ~IPCFIFOCNT_FIFOERROR, recvSize, sendSize);
 
 	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
 	T1WriteWord(MMU.MMU_MEM[proc_remote][0x40], 0x184, cnt_r);
 
 	if(cnt_r&IPCFIFOCNT_RECVIRQEN)
-		NDS_makeIrq(proc_remote, IRQ_BIT_IPCFIFO_RECVNONEMPTY);
+		IPC_makeIrq(proc_remote, IRQ_BIT_IPCFIFO_RECVNONEMPTY);
 
 	NDS_Reschedule();
 }
@@ -80,41 +115,42 @@ u32 IPC_FIFOrecv(u8 proc)
 	u16 cnt_l = T1ReadWord(MMU.MMU_MEM[proc][0x40], 0x184);
 	if (!(cnt_l & IPCFIFOCNT_FIFOENABLE)) return (0);									// FIFO disabled
 	u8	proc_remote = proc ^ 1;
+	IPC_FIFO &fifo = ipc_fifo[proc_remote];
 
-	u32 val = 0;
-
-	if ( ipc_fifo[proc_remote].size == 0 )		// remote FIFO error
+	if ( IPC_FIFOsize(fifo) == 0 )		// remote FIFO error
 	{
 		cnt_l |= IPCFIFOCNT_FIFOERROR;
 		T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
+		ipcStats.fifoErrors[proc]++;
 		return (0);
 	}
 
 	u16 cnt_r = T1ReadWord(MMU.MMU_MEM[proc_remote][0x40], 0x184);
 
-	cnt_l &= 0xBCFF;		// clear send full bit & empty
-	cnt_r &= 0xBFFC;		// set recv full bit & empty
-
-	val = ipc_fifo[proc_remote].buf[ipc_fifo[proc_remote].head];
-	ipc_fifo[proc_remote].head++;
-	ipc_fifo[proc_remote].size--;
-	if (ipc_fifo[proc_remote].head > 15) ipc_fifo[proc_remote].head = 0;
+	const u32 val = fifo.buf[fifo.head & 15];
+	const u64 stamp = fifo.stamp[fifo.head & 15];
+	fifo.head++;
+	ipcStats.fifoReceived[proc_remote]++;
+	if (nds_timer > stamp)
+		ipcStats.fifoLatency[proc_remote] += (u32)(nds_timer - stamp);
 	
 	//LOG("IPC%s recv FIFO 0x%08X size %03i (l 0x%X, tail %02i) (r 0x%X, tail %02i)\n", 
-	//	proc?"7":"9", val, ipc_fifo[proc].size, cnt_l, ipc_fifo[proc].tail, cnt_r, ipc_fifo[proc^1].tail);
+	//	proc?"7":"9", val, IPC_FIFOsize(fifo), cnt_l, ipc_fifo[proc].tail & 15, cnt_r, fifo.tail & 15);
 
-	if ( ipc_fifo[proc_remote].size == 0 )		// FIFO empty
-	{
-		cnt_l |= IPCFIFOCNT_RECVEMPTY;
-		cnt_r |= IPCFIFOCNT_SENDEMPTY;
-
-		if(cnt_r&IPCFIFOCNT_SENDIRQEN)
-			NDS_makeIrq(proc_remote, IRQ_BIT_IPCFIFO_SENDEMPTY);
-	}
+	const u8 sendSize = IPC_FIFOsize(ipc_fifo[proc]);
+	const u8 recvSize = IPC_FIFOsize(fifo);
+	cnt_l = IPC_FIFOcntStatus(cnt_l & ~IPCFIFOCNT_FIFOERROR, sendSize, recvSize);
+	cnt_r = IPC_FIFOcntStatus(cnt_r & ~IPCFIFOCNT_FIFOERROR, recvSize, sendSize);
 
 	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
 	T1WriteWord(MMU.MMU_MEM[proc_remote][0x40], 0x184, cnt_r);
 
+	if ( recvSize == 0 )		// FIFO empty
+	{
+		if(cnt_r&IPCFIFOCNT_SENDIRQEN)
+			IPC_makeIrq(proc_remote, IRQ_BIT_IPCFIFO_SENDEMPTY);
+	}
+
 	NDS_Reschedule();
 
 	return (val);
@@ -133,14 +169,13 @@ void IPC_FIFOcnt(u8 proc, u16 val)
 
 	if (val & IPCFIFOCNT_SENDCLEAR)
 	{
-		ipc_fifo[proc].head = 0; ipc_fifo[proc].tail = 0; ipc_fifo[proc].size = 0;
-
-		cnt_l |= IPCFIFOCNT_SENDEMPTY;
-		cnt_r |= IPCFIFOCNT_RECVEMPTY;
-		
-		cnt_l &= ~IPCFIFOCNT_SENDFULL;
-		cnt_r &= ~IPCFIFOCNT_RECVFULL;
+		//the sender drops what the receiver hasn't taken yet. this is the one place head is moved by the
+		//producer, which is fine since a fifocnt write is a sync point like any other register access
+		ipc_fifo[proc].head = ipc_fifo[proc].tail;
 
+		const u8 recvSize = IPC_FIFOsize(ipc_fifo[proc^1]);
+		cnt_l = IPC_FIFOcntStatus(cnt_l, 0, recvSize);
+		cnt_r = IPC_FIFOcntStatus(cnt_r, recvSize, 0);
 	}
 	cnt_l &= ~IPCFIFOCNT_WRITEABLE;
 	cnt_l |= val & IPCFIFOCNT_WRITEABLE;
@@ -148,11 +183,11 @@ void IPC_FIFOcnt(u8 proc, u16 val)
 	//IPCFIFOCNT_SENDIRQEN may have been set (and/or the fifo may have been cleared) so we may need to trigger this irq
 	//(this approach is used by libnds fifo system on occasion in fifoInternalSend, and began happening frequently for value32 with r4326)
 	if(cnt_l&IPCFIFOCNT_SENDIRQEN) if(cnt_l & IPCFIFOCNT_SENDEMPTY)
-		NDS_makeIrq(proc, IRQ_BIT_IPCFIFO_SENDEMPTY);
+		IPC_makeIrq(proc, IRQ_BIT_IPCFIFO_SENDEMPTY);
 
 	//IPCFIFOCNT_RECVIRQEN may have been set so we may need to trigger this irq
 	if(cnt_l&IPCFIFOCNT_RECVIRQEN) if(!(cnt_l & IPCFIFOCNT_RECVEMPTY))
-		NDS_makeIrq(proc, IRQ_BIT_IPCFIFO_RECVNONEMPTY);
+		IPC_makeIrq(proc, IRQ_BIT_IPCFIFO_RECVNONEMPTY);
 
 	T1WriteWord(MMU.MMU_MEM[proc][0x40], 0x184, cnt_l);
 	T1WriteWord(MMU.MMU_MEM[proc^1][0x40], 0x184, cnt_r);
@@ -160,6 +195,66 @@ void IPC_FIFOcnt(u8 proc, u16 val)
 	NDS_Reschedule();
 }
 
+void IPC_Sync(u8 proc, u32 val)
+{
+	//INFO("IPC%s sync 0x%04X (0x%02X|%02X)\n", proc?"7":"9", val, val >> 8, val & 0xFF);
+	u32 sync_l = T1ReadLong(MMU.MMU_MEM[proc][0x40], 0x180) & 0xFFFF;
+	u32 sync_r = T1ReadLong(MMU.MMU_MEM[proc^1][0x40], 0x180) & 0xFFFF;
+
+	ipcStats.syncWrites[proc]++;
+
+	sync_l = ( sync_l & 0x000F ) | ( val & 0x0F00 );
+	sync_r = ( sync_r & 0x6F00 ) | ( (val >> 8) & 0x000F );
+
+	sync_l |= val & 0x6000;
+
+	if(nds.ensataEmulation && proc==1 && nds.ensataIpcSyncCounter<9) {
+		u32 iteration = (val&0x0F00)>>8;
+
+		if(iteration==8-nds.ensataIpcSyncCounter)
+			nds.ensataIpcSyncCounter++;
+		else printf("ERROR: ENSATA IPC SYNC HACK FAILED; BAD THINGS MAY HAPPEN\n");
+
+		//for some reason, the arm9 doesn't handshake when ensata is detected.
+		//so we complete the protocol here, which is to mirror the values 8..0 back to 
+		//the arm7 as they are written by the arm7
+		sync_r &= 0xF0FF;
+		sync_r |= (iteration<<8);
+		sync_l &= 0xFFF0;
+		sync_l |= iteration;
+	}
+
+	T1WriteLong(MMU.MMU_MEM[proc][0x40], 0x180, sync_l);
+	T1WriteLong(MMU.MMU_MEM[proc^1][0x40], 0x180, sync_r);
+
+	if ((sync_l & IPCSYNC_IRQ_SEND) && (sync_r & IPCSYNC_IRQ_RECV))
+		IPC_makeIrq(proc^1, IRQ_BIT_IPCSYNC);
+
+	NDS_Reschedule();
+}
+
+//savestates keep head and tail wrapped to a slot and the fill level separately
+void IPC_FIFOsyncSave()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		IPC_FIFO &fifo = ipc_fifo[i];
+		fifo.size = IPC_FIFOsize(fifo);
+		fifo.head &= 15;
+		fifo.tail &= 15;
+	}
+}
+
+void IPC_FIFOsyncLoad()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		IPC_FIFO &fifo = ipc_fifo[i];
+		fifo.head &= 15;
+		fifo.tail = fifo.head + std::min<u8>(fifo.size, 16);
+	}
+}
+
 // ========================================================= GFX FIFO
 GFX_PIPE	gxPIPE;
 GFX_FIFO	gxFIFO;
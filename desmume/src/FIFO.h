@@ -24,20 +24,49 @@
 #include "types.h"
 
 //=================================================== IPC FIFO
+//ipc_fifo[proc] carries the words sent by proc, as a single producer/single consumer ring:
+//the sender only ever advances tail and the receiver only ever advances head. both are free running
+//(the slot is the index & 15), so the fill level is tail-head and neither side has to touch the other's state.
+//each word is stamped with the time it was sent.
+//size is only meaningful at the sync points (IPC_FIFOsyncSave/IPC_FIFOsyncLoad), where the savestate
+//format with its wrapped head/tail and separate size is produced and taken back
 typedef struct
 {
 	u32		buf[16];
+	u64		stamp[16];
 	
 	u8		head;
 	u8		tail;
 	u8		size;
 } IPC_FIFO;
 
+FORCEINLINE u8 IPC_FIFOsize(const IPC_FIFO &fifo) { return (u8)(fifo.tail - fifo.head); }
+
 extern IPC_FIFO ipc_fifo[2];
 extern void IPC_FIFOinit(u8 proc);
 extern void IPC_FIFOsend(u8 proc, u32 val);
 extern u32 IPC_FIFOrecv(u8 proc);
 extern void IPC_FIFOcnt(u8 proc, u16 val);
+extern void IPC_Sync(u8 proc, u32 val);
+extern void IPC_FIFOsyncSave();
+extern void IPC_FIFOsyncLoad();
+
+//counters for one emulated frame's worth of traffic between the cpus.
+//the fifo counters are indexed by the sending cpu, the rest by the cpu named in the comment
+struct IPC_Statistics
+{
+	u32 fifoSent[2];
+	u32 fifoReceived[2];
+	u32 fifoLatency[2]; //cycles the received words spent in the fifo
+	u32 fifoErrors[2]; //sends to a full fifo and receives from an empty one, by the cpu doing them
+	u32 syncWrites[2]; //by the writing cpu
+	u32 irqs[2]; //ipc irqs raised, by the cpu receiving them
+};
+
+//rolls the counters over, called at the end of each frame
+extern void IPC_EndFrame();
+//returns the counters for the last completed frame
+extern const IPC_Statistics& IPC_GetFrameStatistics();
 
 //=================================================== GFX FIFO
 
@@ -22,6 +22,8 @@
 #include <string.h>
 #include <assert.h>
 #include <sstream>
+#include <vector>
+#include <algorithm>
 
 #include "common.h"
 #include "debug.h"
@@ -30,6 +32,7 @@
 #include "wifi.h"
 #include "registers.h"
 #include "render3D.h"
+#include "texcache.h"
 #include "gfx3d.h"
 #include "rtc.h"
 #include "mc.h"
@@ -280,6 +283,22 @@ u8 vram_arm9_map[VRAM_ARM9_PAGES];
 //this chooses which banks are mapped in the 128K banks starting at 0x06000000 in ARM7
 u8 vram_arm7_map[2];
 
+u32 vram_page_generation[VRAM_GENERATION_PAGES];
+
+void MMU_VRAMnoteWriteAll()
+{
+	for(int i=0;i<VRAM_GENERATION_PAGES;i++)
+		vram_page_generation[i]++;
+}
+
+u32 main_mem_page_generation[MAIN_MEM_GENERATION_PAGES];
+
+void MMU_MAINnoteWriteAll()
+{
+	for(int i=0;i<MAIN_MEM_GENERATION_PAGES;i++)
+		main_mem_page_generation[i]++;
+}
+
 //----->
 //consider these later, for better recordkeeping, instead of using the u8* in MMU
 
@@ -325,6 +344,20 @@ static const TVramBankInfo vram_bank_info[VRAM_BANKS] = {
 //NOTE - this whole approach is probably fundamentally wrong.
 //according to dasShiny research, its possible to map multiple banks to the same addresses. something more sophisticated would be needed.
 //however, it hasnt proven necessary yet for any known test case.
+template<int PROCNUM> 
+static FORCEINLINE u32 MMU_LCDmap(u32 addr, bool& unmapped, bool& restricted);
+
+//the memory handlers come through here, to apply a pending vram remap before they look through the mapping
+//(or, for the arm7, read VRAMSTAT). debug reads never get here while a remap is pending (see MMU_VRAMdebugRead),
+//so this only ever runs for the emulated cpus and dma, on the emulation thread
+template<int PROCNUM>
+static FORCEINLINE u32 MMU_LCDmapAccess(u32 addr, bool& unmapped, bool& restricted)
+{
+	if(MMU_vramRemapPending && ((addr>>24) == 6 || (PROCNUM==ARMCPU_ARM7 && (addr&0x0FFFFFFC) == REG_VRAMSTAT)))
+		MMU_VRAMmapApply();
+	return MMU_LCDmap<PROCNUM>(addr, unmapped, restricted);
+}
+
 template<int PROCNUM> 
 static FORCEINLINE u32 MMU_LCDmap(u32 addr, bool& unmapped, bool& restricted)
 {
@@ -484,23 +517,206 @@ std::string VramConfiguration::describe() {
 	return ret.str();
 }
 
+//the page maps (and VRAMSTAT) that the VRAMCNT registers work out to.
+//MMU_VRAMmapApply installs them; debug reads look through them while a remap is pending, without applying it
+struct VramPageMaps
+{
+	u8 arm9[VRAM_ARM9_PAGES];
+	u8 lcdc[VRAM_LCDC_PAGES];
+	u8 arm7[2];
+	u8 vramstat;
+};
+
 //maps the specified bank to LCDC
-static inline void MMU_vram_lcdc(const int bank)
+static inline void MMU_vram_lcdc(VramPageMaps& maps, const int bank)
 {
 	for(int i=0;i<vram_bank_info[bank].num_pages;i++)
 	{
 		int page = vram_bank_info[bank].page_addr+i;
-		vram_lcdc_map[page] = page;
+		maps.lcdc[page] = page;
 	}
 }
 
 //maps the specified bank to ARM9 at the provided page offset
-static inline void MMU_vram_arm9(const int bank, const int offset)
+static inline void MMU_vram_arm9(VramPageMaps& maps, const int bank, const int offset)
 {
 	for(int i=0;i<vram_bank_info[bank].num_pages;i++)
 	{
 		int page = vram_bank_info[bank].page_addr+i;
-		vram_arm9_map[i+offset] = page;
+		maps.arm9[i+offset] = page;
+	}
+}
+
+//the page mapping part of a bank's setting. MMU_VRAMmapRefreshBank does the rest of it (and the logging)
+static void MMU_VRAMmapBankPages(VramPageMaps& maps, const int bank)
+{
+	int block = bank;
+	if(bank >= VRAM_BANK_H) block++;
+
+	const u8 VRAMBankCnt = T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x240 + block);
+	if(!(VRAMBankCnt & 0x80)) return;
+
+	const int ofs = (VRAMBankCnt>>3) & 3;
+	switch(bank) {
+		case VRAM_BANK_A:
+		case VRAM_BANK_B:
+			switch(VRAMBankCnt & 3)
+			{
+			case 0: MMU_vram_lcdc(maps,bank); break;
+			case 1: MMU_vram_arm9(maps,bank,VRAM_PAGE_ABG+ofs*8); break;
+			case 2: if(ofs < 2) MMU_vram_arm9(maps,bank,VRAM_PAGE_AOBJ+ofs*8); break;
+			}
+			break;
+
+		case VRAM_BANK_C:
+		case VRAM_BANK_D:
+			switch(VRAMBankCnt & 7)
+			{
+			case 0: MMU_vram_lcdc(maps,bank); break;
+			case 1: MMU_vram_arm9(maps,bank,VRAM_PAGE_ABG+ofs*8); break;
+			case 2: //arm7
+				maps.vramstat |= (bank == VRAM_BANK_C) ? 1 : 2;
+				if(ofs < 2) maps.arm7[ofs] = vram_bank_info[bank].page_addr;
+				break;
+			case 4: MMU_vram_arm9(maps,bank,(bank == VRAM_BANK_C) ? VRAM_PAGE_BBG : VRAM_PAGE_BOBJ); break;
+			}
+			break;
+
+		case VRAM_BANK_E:
+			switch(VRAMBankCnt & 7)
+			{
+			case 0: MMU_vram_lcdc(maps,bank); break;
+			case 1: MMU_vram_arm9(maps,bank,VRAM_PAGE_ABG); break;
+			case 2: MMU_vram_arm9(maps,bank,VRAM_PAGE_AOBJ); break;
+			}
+			break;
+
+		case VRAM_BANK_F:
+		case VRAM_BANK_G: {
+			const int pageofslut[] = {0,1,4,5};
+			const int pageofs = pageofslut[ofs];
+			switch(VRAMBankCnt & 7)
+			{
+			case 0: MMU_vram_lcdc(maps,bank); break;
+			case 1:
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_ABG+pageofs);
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_ABG+pageofs+2); //unexpected mirroring (required by spyro eternal night)
+				break;
+			case 2:
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_AOBJ+pageofs);
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_AOBJ+pageofs+2); //unexpected mirroring - I have no proof, but it is inferred from the ABG above
+				break;
+			}
+			break;
+		}
+
+		case VRAM_BANK_H:
+			switch(VRAMBankCnt & 3)
+			{
+			case 0: MMU_vram_lcdc(maps,bank); break;
+			case 1:
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_BBG);
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_BBG + 4); //unexpected mirroring
+				break;
+			}
+			break;
+
+		case VRAM_BANK_I:
+			switch(VRAMBankCnt & 3)
+			{
+			case 0: MMU_vram_lcdc(maps,bank); break;
+			case 1:
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_BBG+2);
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_BBG+3); //unexpected mirroring
+				break;
+			case 2:
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_BOBJ);
+				MMU_vram_arm9(maps,bank,VRAM_PAGE_BOBJ+1); //FF3 end scene (lens flare sprite) needs this as it renders a sprite off the end of the 16KB and back around
+				break;
+			}
+			break;
+	}
+}
+
+//the order bank settings get applied in
+//zero XX-XX-200X (long before jun 2012)
+//these are enumerated so that we can tune the order they get applied
+//in order to emulate prioritization rules for memory regions
+//with multiple banks mapped.
+//We're probably still not mapping things 100% correctly, but this helped us get closer:
+//goblet of fire "care of magical creatures" maps I and D to BOBJ (the I is an accident)
+//and requires A to override it.
+//This may create other bugs....
+//zero 21-jun-2012
+//tomwi's streaming music demo sets A and D to ABG (the A is an accident).
+//in this case, D should get priority. 
+//this is somewhat risky. will it break other things?
+static const int vram_bank_order[VRAM_BANKS] = {
+	VRAM_BANK_I, VRAM_BANK_H, VRAM_BANK_G, VRAM_BANK_F, VRAM_BANK_E,
+	VRAM_BANK_A, VRAM_BANK_B, VRAM_BANK_C, VRAM_BANK_D
+};
+
+//works out the page maps for the current VRAMCNT settings, without changing anything
+static void MMU_VRAMmapPages(VramPageMaps& maps)
+{
+	memset(maps.arm9, VRAM_PAGE_UNMAPPED, sizeof(maps.arm9));
+	memset(maps.lcdc, VRAM_PAGE_UNMAPPED, sizeof(maps.lcdc));
+	maps.arm7[0] = maps.arm7[1] = VRAM_PAGE_UNMAPPED;
+	maps.vramstat = 0;
+
+	for(int i=0;i<VRAM_BANKS;i++)
+		MMU_VRAMmapBankPages(maps, vram_bank_order[i]);
+
+	//-------------------------------
+	//set up arm9 mirrorings
+	//these are probably not entirely accurate. more study will be necessary.
+	//in general, we find that it is not uncommon at all for games to accidentally do this.
+	//
+	//being able to easily do these experiments was one of the primary motivations for this remake of the vram mapping system
+
+	//see the "unexpected mirroring" comments above for some more mirroring
+	//so far "unexpected mirrorings" are tested by combining these games:
+	//despereaux - storybook subtitles
+	//NSMB - world map sub screen
+	//drill spirits EU - mission select (just for control purposes, as it doesnt use H or I)
+	//...
+	//note that the "unexpected mirroring" items above may at some point rely on being executed in a certain order.
+	//(sequentially A..I)
+
+	const int types[] = {VRAM_PAGE_ABG,VRAM_PAGE_BBG,VRAM_PAGE_AOBJ,VRAM_PAGE_BOBJ};
+	const int sizes[] = {32,8,16,8};
+	for(int t=0;t<4;t++)
+	{
+		//the idea here is to pad out the mirrored space with copies of the mappable area,
+		//without respect to what is mapped within that mappable area.
+		//we hope that this is correct in all cases
+		//required for driller spirits in mission select (mapping is simple A,B,C,D to each purpose)
+		const int size = sizes[t];
+		const int mask = size-1;
+		const int type = types[t];
+		for(int i=size;i<128;i++)
+		{
+			const int page = type + i;
+			maps.arm9[page] = maps.arm9[type+(i&mask)];
+		}
+
+		//attempt #1: screen corruption in drill spirits EU
+		//it seems like these shouldnt pad out 128K banks (space beyond those should have remained unmapped)
+		//int mirrorMask = -1;
+		//int type = types[t];
+		////if(type==VRAM_PAGE_BOBJ) continue;
+		//if(type==VRAM_PAGE_AOBJ) continue;
+		//for(int i=0;i<128;i++)
+		//{
+		//	int page = type + i;
+		//	if(vram_arm9_map[page] == VRAM_PAGE_UNMAPPED)
+		//	{
+		//		if(i==0) break; //can't mirror anything if theres nothing mapped!
+		//		if(mirrorMask == -1)
+		//			mirrorMask = i-1;
+		//		vram_arm9_map[page] = vram_arm9_map[type+(i&mirrorMask)];
+		//	}
+		//}
 	}
 }
 
@@ -531,23 +747,14 @@ static inline void MMU_VRAMmapRefreshBank(const int bank)
 			{
 			case 0: //LCDC
 				vramConfiguration.banks[bank].purpose = VramConfiguration::LCDC;
-				MMU_vram_lcdc(bank);
 				if(ofs != 0) PROGINFO("Bank %i: MST %i OFS %i\n", mst, ofs);
 				break;
 			case 1: //ABG
 				vramConfiguration.banks[bank].purpose = VramConfiguration::ABG;
-				MMU_vram_arm9(bank,VRAM_PAGE_ABG+ofs*8);
 				break;
 			case 2: //AOBJ
 				vramConfiguration.banks[bank].purpose = VramConfiguration::AOBJ;
-				switch(ofs) {
-				case 0:
-				case 1:
-					MMU_vram_arm9(bank,VRAM_PAGE_AOBJ+ofs*8);
-					break;
-				default:
-					PROGINFO("Unsupported ofs setting %d for engine A OBJ vram bank %c\n", ofs, 'A'+bank);
-				}
+				if(ofs > 1) PROGINFO("Unsupported ofs setting %d for engine A OBJ vram bank %c\n", ofs, 'A'+bank);
 				break;
 			case 3: //texture
 				vramConfiguration.banks[bank].purpose = VramConfiguration::TEX;
@@ -565,27 +772,14 @@ static inline void MMU_VRAMmapRefreshBank(const int bank)
 			{
 			case 0: //LCDC
 				vramConfiguration.banks[bank].purpose = VramConfiguration::LCDC;
-				MMU_vram_lcdc(bank);
 				if(ofs != 0) PROGINFO("Bank %i: MST %i OFS %i\n", mst, ofs);
 				break;
 			case 1: //ABG
 				vramConfiguration.banks[bank].purpose = VramConfiguration::ABG;
-				MMU_vram_arm9(bank,VRAM_PAGE_ABG+ofs*8);
 				break;
 			case 2: //arm7
 				vramConfiguration.banks[bank].purpose = VramConfiguration::ARM7;
-				if(bank == 2) T1WriteByte(MMU.MMU_MEM[ARMCPU_ARM7][0x40], 0x240, T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM7][0x40], 0x240) | 1);
-				if(bank == 3) T1WriteByte(MMU.MMU_MEM[ARMCPU_ARM7][0x40], 0x240, T1ReadByte(MMU.MMU_MEM[ARMCPU_ARM7][0x40], 0x240) | 2);
-				//printf("DING!\n");
-				switch(ofs) {
-				case 0:
-				case 1:
-					vram_arm7_map[ofs] = vram_bank_info[bank].page_addr;
-					break;
-				default:
-					PROGINFO("Unsupported ofs setting %d for arm7 vram bank %c\n", ofs, 'A'+bank);
-				}
-
+				if(ofs > 1) PROGINFO("Unsupported ofs setting %d for arm7 vram bank %c\n", ofs, 'A'+bank);
 				break;
 			case 3: //texture
 				vramConfiguration.banks[bank].purpose = VramConfiguration::TEX;
@@ -594,10 +788,8 @@ static inline void MMU_VRAMmapRefreshBank(const int bank)
 			case 4: //BGB or BOBJ
 				if(bank == VRAM_BANK_C)  {
 					vramConfiguration.banks[bank].purpose = VramConfiguration::BBG;
-					MMU_vram_arm9(bank,VRAM_PAGE_BBG); //BBG
 				} else {
 					vramConfiguration.banks[bank].purpose = VramConfiguration::BOBJ;
-					MMU_vram_arm9(bank,VRAM_PAGE_BOBJ); //BOBJ
 				}
 				if(ofs != 0) PROGINFO("Bank %i: MST %i OFS %i\n", mst, ofs);
 				break;
@@ -611,15 +803,12 @@ static inline void MMU_VRAMmapRefreshBank(const int bank)
 			switch(mst) {
 			case 0: //LCDC
 				vramConfiguration.banks[bank].purpose = VramConfiguration::LCDC;
-				MMU_vram_lcdc(bank);
 				break;
 			case 1: //ABG
 				vramConfiguration.banks[bank].purpose = VramConfiguration::ABG;
-				MMU_vram_arm9(bank,VRAM_PAGE_ABG);
 				break;
 			case 2: //AOBJ
 				vramConfiguration.banks[bank].purpose = VramConfiguration::AOBJ;
-				MMU_vram_arm9(bank,VRAM_PAGE_AOBJ);
 				break;
 			case 3: //texture palette
 				vramConfiguration.banks[bank].purpose = VramConfiguration::TEXPAL;
@@ -649,18 +838,13 @@ static inline void MMU_VRAMmapRefreshBank(const int bank)
 			{
 			case 0: //LCDC
 				vramConfiguration.banks[bank].purpose = VramConfiguration::LCDC;
-				MMU_vram_lcdc(bank);
 				if(ofs != 0) PROGINFO("Bank %i: MST %i OFS %i\n", mst, ofs);
 				break;
 			case 1: //ABG
 				vramConfiguration.banks[bank].purpose = VramConfiguration::ABG;
-				MMU_vram_arm9(bank,VRAM_PAGE_ABG+pageofs);
-				MMU_vram_arm9(bank,VRAM_PAGE_ABG+pageofs+2); //unexpected mirroring (required by spyro eternal night)
 				break;
 			case 2: //AOBJ
 				vramConfiguration.banks[bank].purpose = VramConfiguration::AOBJ;
-				MMU_vram_arm9(bank,VRAM_PAGE_AOBJ+pageofs);
-				MMU_vram_arm9(bank,VRAM_PAGE_AOBJ+pageofs+2); //unexpected mirroring - I have no proof, but it is inferred from the ABG above
 				break;
 			case 3: //texture palette
 				vramConfiguration.banks[bank].purpose = VramConfiguration::TEXPAL;
@@ -698,12 +882,9 @@ static inline void MMU_VRAMmapRefreshBank(const int bank)
 			{
 			case 0: //LCDC
 				vramConfiguration.banks[bank].purpose = VramConfiguration::LCDC;
-				MMU_vram_lcdc(bank);
 				break;
 			case 1: //BBG
 				vramConfiguration.banks[bank].purpose = VramConfiguration::BBG;
-				MMU_vram_arm9(bank,VRAM_PAGE_BBG);
-				MMU_vram_arm9(bank,VRAM_PAGE_BBG + 4); //unexpected mirroring
 				break;
 			case 2: //B BG extended palette
 				vramConfiguration.banks[bank].purpose = VramConfiguration::BBGEXTPAL;
@@ -723,17 +904,12 @@ static inline void MMU_VRAMmapRefreshBank(const int bank)
 			{
 			case 0: //LCDC
 				vramConfiguration.banks[bank].purpose = VramConfiguration::LCDC;
-				MMU_vram_lcdc(bank);
 				break;
 			case 1: //BBG
 				vramConfiguration.banks[bank].purpose = VramConfiguration::BBG;
-				MMU_vram_arm9(bank,VRAM_PAGE_BBG+2);
-				MMU_vram_arm9(bank,VRAM_PAGE_BBG+3); //unexpected mirroring
 				break;
 			case 2: //BOBJ
 				vramConfiguration.banks[bank].purpose = VramConfiguration::BOBJ;
-				MMU_vram_arm9(bank,VRAM_PAGE_BOBJ);
-				MMU_vram_arm9(bank,VRAM_PAGE_BOBJ+1); //FF3 end scene (lens flare sprite) needs this as it renders a sprite off the end of the 16KB and back around
 				break;
 			case 3: //B OBJ extended palette
 				vramConfiguration.banks[bank].purpose = VramConfiguration::BOBJEXTPAL;
@@ -786,121 +962,333 @@ void MMU_VRAM_unmap_all()
 		MMU.texInfo.textureSlotAddr[i] = MMU.blank_memory;
 }
 
+//vram mapping changes are not applied when VRAMCNT is written, but once something next looks through the mapping:
+//the cpu accessing vram or VRAMSTAT, or the hardware (gpu, 3d, dma) running its next events.
+//games tend to write several VRAMCNT registers in a row, and this way the whole burst costs one remap.
+//while a remap is pending, the vram pages of the read page tables are parked so that the cpu takes the slow paths.
+bool MMU_vramRemapPending = false;
+static void MMU_VRAMpagesPark();
+static void MMU_VRAMpagesUpdate(const u8* old_arm9_map, const u8* old_lcdc_map, const u8* old_arm7_map);
+
 static inline void MMU_VRAMmapControl(u8 block, u8 VRAMBankCnt)
 {
 	//handle WRAM, first of all
 	if(block == 7)
 	{
 		MMU.WRAMCNT = VRAMBankCnt & 3;
+		MMU_PagesRefresh(0x03000000,0x04000000);
 		return;
 	}
 
+	//write the new value to the reg
+	T1WriteByte(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x240 + block, VRAMBankCnt);
+
+	if(!MMU_vramRemapPending)
+	{
+		MMU_vramRemapPending = true;
+		MMU_VRAMpagesPark();
+	}
+}
+
+void MMU_VRAMmapApply()
+{
+	MMU_vramRemapPending = false;
+
 	//first, save the texture info so we can check it for changes and trigger purges of the texcache
 	MMU_struct::TextureInfo oldTexInfo = MMU.texInfo;
 
+	//and the page maps, so that only the page table entries whose mapping changed need refreshing
+	u8 old_arm9_map[VRAM_ARM9_PAGES], old_lcdc_map[VRAM_LCDC_PAGES], old_arm7_map[2];
+	memcpy(old_arm9_map, vram_arm9_map, sizeof(old_arm9_map));
+	memcpy(old_lcdc_map, vram_lcdc_map, sizeof(old_lcdc_map));
+	memcpy(old_arm7_map, vram_arm7_map, sizeof(old_arm7_map));
+
 	//unmap everything
 	MMU_VRAM_unmap_all();
 
-	//unmap VRAM_BANK_C and VRAM_BANK_D from arm7. theyll get mapped again in a moment if necessary
-	T1WriteByte(MMU.MMU_MEM[ARMCPU_ARM7][0x40], 0x240, 0);
-
-	//write the new value to the reg
-	T1WriteByte(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x240 + block, VRAMBankCnt);
-
 	//refresh all bank settings
-	//zero XX-XX-200X (long before jun 2012)
-	//these are enumerated so that we can tune the order they get applied
-	//in order to emulate prioritization rules for memory regions
-	//with multiple banks mapped.
-	//We're probably still not mapping things 100% correctly, but this helped us get closer:
-	//goblet of fire "care of magical creatures" maps I and D to BOBJ (the I is an accident)
-	//and requires A to override it.
-	//This may create other bugs....
-	MMU_VRAMmapRefreshBank(VRAM_BANK_I);
-	MMU_VRAMmapRefreshBank(VRAM_BANK_H);
-	MMU_VRAMmapRefreshBank(VRAM_BANK_G);
-	MMU_VRAMmapRefreshBank(VRAM_BANK_F);
-	MMU_VRAMmapRefreshBank(VRAM_BANK_E);
-	//zero 21-jun-2012
-	//tomwi's streaming music demo sets A and D to ABG (the A is an accident).
-	//in this case, D should get priority. 
-	//this is somewhat risky. will it break other things?
-	MMU_VRAMmapRefreshBank(VRAM_BANK_A);
-	MMU_VRAMmapRefreshBank(VRAM_BANK_B);
-	MMU_VRAMmapRefreshBank(VRAM_BANK_C);
-	MMU_VRAMmapRefreshBank(VRAM_BANK_D);
+	VramPageMaps maps;
+	MMU_VRAMmapPages(maps);
+	for(int i=0;i<VRAM_BANKS;i++)
+		MMU_VRAMmapRefreshBank(vram_bank_order[i]);
+
+	memcpy(vram_arm9_map, maps.arm9, sizeof(maps.arm9));
+	memcpy(vram_lcdc_map, maps.lcdc, sizeof(maps.lcdc));
+	memcpy(vram_arm7_map, maps.arm7, sizeof(maps.arm7));
+	T1WriteByte(MMU.MMU_MEM[ARMCPU_ARM7][0x40], 0x240, maps.vramstat);
 
 	//printf(vramConfiguration.describe().c_str());
 	//printf("vram remapped at vcount=%d\n",nds.VCount);
 
-	//if texInfo changed, trigger notifications
-	if(memcmp(&oldTexInfo,&MMU.texInfo,sizeof(MMU_struct::TextureInfo)))
+	//if texInfo changed, trigger notifications for the slots which did
+	u32 texSlotsChanged = 0;
+	for(int i=0;i<4;i++)
+		if(oldTexInfo.textureSlotAddr[i] != MMU.texInfo.textureSlotAddr[i])
+			texSlotsChanged |= TEXCACHE_TEXTURE_SLOT(i);
+	for(int i=0;i<6;i++)
+		if(oldTexInfo.texPalSlot[i] != MMU.texInfo.texPalSlot[i])
+			texSlotsChanged |= TEXCACHE_PALETTE_SLOT(i);
+	if(texSlotsChanged)
 	{
 		//if(!nds.isIn3dVblank())
 	//		PROGINFO("Changing texture or texture palette mappings outside of 3d vblank\n");
-		gpu3D->NDS_3D_VramReconfigureSignal();
+		gpu3D->NDS_3D_VramReconfigureSignal(texSlotsChanged);
 	}
 
-	//-------------------------------
-	//set up arm9 mirrorings
-	//these are probably not entirely accurate. more study will be necessary.
-	//in general, we find that it is not uncommon at all for games to accidentally do this.
-	//
-	//being able to easily do these experiments was one of the primary motivations for this remake of the vram mapping system
+	MMU_VRAMpagesUpdate(old_arm9_map, old_lcdc_map, old_arm7_map);
+}
 
-	//see the "unexpected mirroring" comments above for some more mirroring
-	//so far "unexpected mirrorings" are tested by combining these games:
-	//despereaux - storybook subtitles
-	//NSMB - world map sub screen
-	//drill spirits EU - mission select (just for control purposes, as it doesnt use H or I)
-	//...
-	//note that the "unexpected mirroring" items above may at some point rely on being executed in a certain order.
-	//(sequentially A..I)
+u32 MMU_VRAMdebugRead(const int PROCNUM, const u32 addr, const int size)
+{
+	VramPageMaps maps;
+	MMU_VRAMmapPages(maps);
 
-	const int types[] = {VRAM_PAGE_ABG,VRAM_PAGE_BBG,VRAM_PAGE_AOBJ,VRAM_PAGE_BOBJ};
-	const int sizes[] = {32,8,16,8};
-	for(int t=0;t<4;t++)
+	const u32 ofs = addr & ~(u32)(size/8-1);
+	if(((ofs>>24)&0xF) != 6)
 	{
-		//the idea here is to pad out the mirrored space with copies of the mappable area,
-		//without respect to what is mapped within that mappable area.
-		//we hope that this is correct in all cases
-		//required for driller spirits in mission select (mapping is simple A,B,C,D to each purpose)
-		const int size = sizes[t];
-		const int mask = size-1;
-		const int type = types[t];
-		for(int i=size;i<128;i++)
-		{
-			const int page = type + i;
-			vram_arm9_map[page] = vram_arm9_map[type+(i&mask)];
-		}
+		//VRAMSTAT and WRAMSTAT, followed by two unused bytes
+		u32 val = T1ReadLong(MMU.MMU_MEM[ARMCPU_ARM7][0x40], 0x240);
+		val = (val & 0xFFFF0000) | (MMU.WRAMCNT<<8) | maps.vramstat;
+		return val >> ((ofs & 3) * 8);
+	}
 
-		//attempt #1: screen corruption in drill spirits EU
-		//it seems like these shouldnt pad out 128K banks (space beyond those should have remained unmapped)
-		//int mirrorMask = -1;
-		//int type = types[t];
-		////if(type==VRAM_PAGE_BOBJ) continue;
-		//if(type==VRAM_PAGE_AOBJ) continue;
-		//for(int i=0;i<128;i++)
-		//{
-		//	int page = type + i;
-		//	if(vram_arm9_map[page] == VRAM_PAGE_UNMAPPED)
-		//	{
-		//		if(i==0) break; //can't mirror anything if theres nothing mapped!
-		//		if(mirrorMask == -1)
-		//			mirrorMask = i-1;
-		//		vram_arm9_map[page] = vram_arm9_map[type+(i&mirrorMask)];
-		//	}
-		//}
+	//the same lookups MMU_LCDmap does
+	u32 page;
+	if(PROCNUM==ARMCPU_ARM7)
+		page = maps.arm7[(ofs >> 17) & 1];
+	else if((ofs & 0x0FFFFFFF) >= 0x06800000)
+	{
+		u32 lcdc = ofs & 0x0FFFFFFF;
+		if(lcdc >= 0x068A4000)
+			lcdc = 0x06800000 + (lcdc & 0x80000);
+		page = maps.lcdc[(lcdc>>14)&63];
 	}
+	else
+		page = maps.arm9[(ofs>>14)&(VRAM_ARM9_PAGES-1)];
 
-	//-------------------------------
+	if(page == VRAM_PAGE_UNMAPPED)
+		return 0;
+	const u8* ptr = MMU.ARM9_LCD + (page<<14) + (ofs & 0x3FFF);
+	switch(size)
+	{
+		case 8: return *ptr;
+		case 16: return T1ReadWord_guaranteedAligned((u8*)ptr, 0);
+		default: return T1ReadLong_guaranteedAligned((u8*)ptr, 0);
+	}
 }
 
 //////////////////////////////////////////////////////////////
 //end vram
 //////////////////////////////////////////////////////////////
 
+MMU_PAGE MMU_readPages[2][MMU_PAGES];
+MMU_PAGE MMU_writePages[2][MMU_PAGES];
 
+//works out the memory behind one page the same way the slow paths would, if it is plain memory
+template<int PROCNUM>
+static void MMU_PagesRefreshPage(const u32 page)
+{
+	MMU_PAGE& rd = MMU_readPages[PROCNUM][page];
+	MMU_PAGE& wr = MMU_writePages[PROCNUM][page];
+	rd.ptr = wr.ptr = NULL;
+	rd.mask = wr.mask = 0;
+
+	const u32 addr = page << MMU_PAGE_SHIFT;
+	const u32 region = addr >> 24;
+
+	if(PROCNUM==ARMCPU_ARM9 && (addr&(~0x3FFF)) == MMU.DTCMRegion)
+	{
+		rd.ptr = wr.ptr = MMU.ARM9_DTCM;
+		rd.mask = wr.mask = 0x3FFF;
+		return;
+	}
+
+	switch(region)
+	{
+	case 0x0:
+	case 0x1:
+		//itcm writes have to invalidate the jit, so only reads come through here
+		if(PROCNUM==ARMCPU_ARM9)
+		{
+			rd.ptr = MMU.ARM9_ITCM + (addr & 0x4000);
+			rd.mask = 0x3FFF;
+		}
+		return;
+
+	case 0x2:
+		rd.ptr = MMU.MAIN_MEM + (addr & _MMU_MAIN_MEM_MASK & ~0x3FFF);
+		rd.mask = 0x3FFF;
+		return;
+
+	case 0x3:
+	case 0x6:
+		break;
+
+	case 0x5: //palettes
+	case 0x7: //oam
+	case 0xF: //bios
+		if(PROCNUM==ARMCPU_ARM9) break;
+		return;
+
+	default:
+		return;
+	}
+
+	//the odd mirroring of the end of the lcdc range isnt linear within a page
+	if(PROCNUM==ARMCPU_ARM9 && addr >= 0x068A4000 && addr < 0x07000000) return;
+
+	bool unmapped, restricted;
+	const u32 mapped = MMU_LCDmap<PROCNUM>(addr, unmapped, restricted);
+	if(unmapped) return;
+
+	const u32 mask = MMU.MMU_MASK[PROCNUM][mapped>>20];
+	rd.ptr = MMU.MMU_MEM[PROCNUM][mapped>>20] + (mapped & mask & ~0x3FFF);
+	rd.mask = mask & 0x3FFF;
+
+	//wram needs no bookkeeping, except that arm7 code may run from it under the jit
+	if(region == 0x3)
+	{
+#ifdef HAVE_JIT
+		if(PROCNUM==ARMCPU_ARM7) return;
+#endif
+		wr = rd;
+	}
+}
+
+#ifdef HAVE_LUA
+//pages with lua memory hooks on them stay on the slow paths, where the hooks get called
+static void MMU_PagesUnwatch(const u32 page)
+{
+	const u32 addr = page << MMU_PAGE_SHIFT;
+	if(hookedRegions[LUAMEMHOOK_READ].PageWatched(addr))
+	{
+		MMU_readPages[ARMCPU_ARM9][page].ptr = MMU_readPages[ARMCPU_ARM7][page].ptr = NULL;
+		MMU_readPages[ARMCPU_ARM9][page].mask = MMU_readPages[ARMCPU_ARM7][page].mask = 0;
+	}
+	if(hookedRegions[LUAMEMHOOK_WRITE].PageWatched(addr))
+	{
+		MMU_writePages[ARMCPU_ARM9][page].ptr = MMU_writePages[ARMCPU_ARM7][page].ptr = NULL;
+		MMU_writePages[ARMCPU_ARM9][page].mask = MMU_writePages[ARMCPU_ARM7][page].mask = 0;
+	}
+}
+#endif
+
+#define VRAM_TABLE_FIRST (0x06000000>>MMU_PAGE_SHIFT)
+#define VRAM_TABLE_PAGES (0x01000000>>MMU_PAGE_SHIFT)
+//the read table entries for vram while a remap is pending (they are up to date with the old mapping)
+static MMU_PAGE vram_parkedPages[2][VRAM_TABLE_PAGES];
+
+static void MMU_VRAMpagesPark()
+{
+	for(u32 i = 0; i < VRAM_TABLE_PAGES; i++)
+	{
+		for(int proc = 0; proc < 2; proc++)
+		{
+			vram_parkedPages[proc][i] = MMU_readPages[proc][VRAM_TABLE_FIRST+i];
+			MMU_readPages[proc][VRAM_TABLE_FIRST+i].ptr = NULL;
+			MMU_readPages[proc][VRAM_TABLE_FIRST+i].mask = 0;
+		}
+	}
+}
+
+//puts the parked entries back, refreshing the ones whose page is now mapped differently
+static void MMU_VRAMpagesUpdate(const u8* old_arm9_map, const u8* old_lcdc_map, const u8* old_arm7_map)
+{
+	for(u32 i = 0; i < VRAM_TABLE_PAGES; i++)
+	{
+		const u32 page = VRAM_TABLE_FIRST+i;
+		const u32 addr = page << MMU_PAGE_SHIFT;
+
+		MMU_readPages[ARMCPU_ARM9][page] = vram_parkedPages[ARMCPU_ARM9][i];
+		MMU_readPages[ARMCPU_ARM7][page] = vram_parkedPages[ARMCPU_ARM7][i];
+
+		//the same lookups MMU_LCDmap does (the lcdc mirrors past 0x068A4000 never get a table entry)
+		bool changed9 = false;
+		if(addr < 0x06800000)
+			changed9 = old_arm9_map[i & (VRAM_ARM9_PAGES-1)] != vram_arm9_map[i & (VRAM_ARM9_PAGES-1)];
+		else if(addr < 0x068A4000)
+			changed9 = old_lcdc_map[i & 63] != vram_lcdc_map[i & 63];
+		const u32 bank7 = (addr >> 17) & 1;
+		const bool changed7 = old_arm7_map[bank7] != vram_arm7_map[bank7];
+
+		if(changed9) MMU_PagesRefreshPage<ARMCPU_ARM9>(page);
+		if(changed7) MMU_PagesRefreshPage<ARMCPU_ARM7>(page);
+#ifdef HAVE_LUA
+		if(changed9 || changed7) MMU_PagesUnwatch(page);
+#endif
+	}
+}
+
+void MMU_PagesRefresh(u32 start, u32 end)
+{
+	for(u32 page = start>>MMU_PAGE_SHIFT; page < (end>>MMU_PAGE_SHIFT); page++)
+	{
+		MMU_PagesRefreshPage<ARMCPU_ARM9>(page);
+		MMU_PagesRefreshPage<ARMCPU_ARM7>(page);
+#ifdef HAVE_LUA
+		MMU_PagesUnwatch(page);
+#endif
+
+		//vram entries stay parked while a remap is pending; they get refreshed again when it is applied if need be
+		if(MMU_vramRemapPending && page - VRAM_TABLE_FIRST < VRAM_TABLE_PAGES)
+		{
+			for(int proc = 0; proc < 2; proc++)
+			{
+				vram_parkedPages[proc][page - VRAM_TABLE_FIRST] = MMU_readPages[proc][page];
+				MMU_readPages[proc][page].ptr = NULL;
+				MMU_readPages[proc][page].mask = 0;
+			}
+		}
+	}
+}
+
+
+//================================================= polled registers
+//the registers games sit in loops polling are picked out by a small table, by address, before the big switches
+//in the read handlers get to look at it. a cpu that keeps reading the same value back from one of them that only
+//the sequencer changes (dispstat, vcount, keyinput) can't see anything new before the next event, so with
+//CommonSettings.poll_wait it is flagged in MMU_pollWait for the cpu loop to move it on towards that event.
+//IF gets changed by the other cpu in between events as well, so polling it only gets the fast handler.
+enum
+{
+	POLLREG_NONE = 0,
+	POLLREG_DISPSTAT,
+	POLLREG_VCOUNT,
+	POLLREG_KEYINPUT,
+	POLLREG_IF,
+	POLLREG_IF_HI,
+};
+#define POLLREG_END 0x04000218
+static u8 MMU_pollRegs[(POLLREG_END - 0x04000000) >> 1]; //per halfword, the same on both cpus
+
+//the same register read back with the same value this many times, no more than POLL_WAIT_GAP cycles apart, is a poll loop
+#define POLL_WAIT_STREAK 8
+#define POLL_WAIT_GAP 64
+struct PollTracker
+{
+	u64 time;
+	u32 val;
+	u8 reg;
+	u8 streak;
+};
+static PollTracker pollTracker[2];
+bool MMU_pollWait[2];
+
+static void MMU_pollInit()
+{
+	memset(MMU_pollRegs, POLLREG_NONE, sizeof(MMU_pollRegs));
+	MMU_pollRegs[(REG_DISPA_DISPSTAT - 0x04000000) >> 1] = POLLREG_DISPSTAT;
+	MMU_pollRegs[(REG_DISPA_VCOUNT - 0x04000000) >> 1] = POLLREG_VCOUNT;
+	MMU_pollRegs[(REG_KEYINPUT - 0x04000000) >> 1] = POLLREG_KEYINPUT;
+	MMU_pollRegs[(REG_IF - 0x04000000) >> 1] = POLLREG_IF;
+	MMU_pollRegs[(REG_IF + 2 - 0x04000000) >> 1] = POLLREG_IF_HI;
+}
+
+static void MMU_pollReset()
+{
+	memset(pollTracker, 0, sizeof(pollTracker));
+	MMU_pollWait[0] = MMU_pollWait[1] = false;
+}
 
 void MMU_Init(void)
 {
@@ -910,6 +1298,8 @@ void MMU_Init(void)
 
 	MMU.CART_ROM = MMU.UNUSED_RAM;
 
+	MMU_pollInit();
+
 	//MMU.DTCMRegion = 0x027C0000;
 	//even though apps may change dtcm immediately upon startup, this is the correct hardware starting value:
 	MMU.DTCMRegion = 0x08000000;
@@ -960,10 +1350,12 @@ void MMU_Reset()
 	memset(MMU.ARM9_DTCM, 0, sizeof(MMU.ARM9_DTCM));
 	memset(MMU.ARM9_ITCM, 0, sizeof(MMU.ARM9_ITCM));
 	memset(MMU.ARM9_LCD,  0, sizeof(MMU.ARM9_LCD));
+	MMU_VRAMnoteWriteAll();
 	memset(MMU.ARM9_OAM,  0, sizeof(MMU.ARM9_OAM));
 	memset(MMU.ARM9_REG,  0, sizeof(MMU.ARM9_REG));
 	memset(MMU.ARM9_VMEM, 0, sizeof(MMU.ARM9_VMEM));
 	memset(MMU.MAIN_MEM,  0, sizeof(MMU.MAIN_MEM));
+	MMU_MAINnoteWriteAll();
 
 	memset(MMU.blank_memory,  0, sizeof(MMU.blank_memory));
 	memset(MMU.UNUSED_RAM,    0, sizeof(MMU.UNUSED_RAM));
@@ -1004,6 +1396,9 @@ void MMU_Reset()
 	MMU.sqrtRunning = 0;
 	MMU.sqrtResult = 0;
 	MMU.sqrtCycles = 0;
+	MMU_mathWait = 0;
+
+	MMU_pollReset();
 
 	MMU.SPI_CNT = 0;
 	MMU.AUX_SPI_CNT = 0;
@@ -1019,6 +1414,7 @@ void MMU_Reset()
 	SubScreen.offset  = 192;
 	
 	MMU_VRAM_unmap_all();
+	MMU_vramRemapPending = false;
 
 	MMU.powerMan_CntReg = 0x00;
 	MMU.powerMan_CntRegWritten = FALSE;
@@ -1067,6 +1463,9 @@ void SetupMMU(bool debugConsole, bool dsi) {
 	if(dsi) _MMU_MAIN_MEM_MASK = 0xFFFFFF;
 	_MMU_MAIN_MEM_MASK16 = _MMU_MAIN_MEM_MASK & ~1;
 	_MMU_MAIN_MEM_MASK32 = _MMU_MAIN_MEM_MASK & ~3;
+
+	//the main memory size may have changed, and this is also where resets and loadstates end up
+	MMU_PagesRefresh(0,0x10000000);
 }
 
 void MMU_setRom(u8 * rom, u32 mask)
@@ -1161,6 +1560,48 @@ static void execdiv() {
 	NDS_Reschedule();
 }
 
+void MMU_divFinish()
+{
+	MMU_new.div.busy = 0;
+#ifdef _WIN64
+	T1WriteQuad(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A0, MMU.divResult);
+	T1WriteQuad(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A8, MMU.divMod);
+#else
+	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A0, (u32)MMU.divResult);
+	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A4, (u32)(MMU.divResult >> 32));
+	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A8, (u32)MMU.divMod);
+	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2AC, (u32)(MMU.divMod >> 32));
+#endif
+	MMU.divRunning = FALSE;
+}
+
+void MMU_sqrtFinish()
+{
+	MMU_new.sqrt.busy = 0;
+	T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2B4, MMU.sqrtResult);
+	MMU.sqrtRunning = FALSE;
+}
+
+//the usual way to use the units is to write the operands and spin on the busy bit until the sequencer gets to
+//the unit. the result is known as soon as the operands are written, so a cpu read of the busy bit finishes
+//the unit right away instead, and leaves the time it would have finished in MMU_mathWait for the cpu loop
+//to move the arm9 on to. that is where the polling would have got it to.
+u64 MMU_mathWait;
+
+void MMU_mathPoll(u32 adr)
+{
+	if (adr == REG_DIVCNT && MMU.divRunning)
+	{
+		MMU_mathWait = std::max(MMU_mathWait, MMU.divCycles);
+		MMU_divFinish();
+	}
+	else if (adr == REG_SQRTCNT && MMU.sqrtRunning)
+	{
+		MMU_mathWait = std::max(MMU_mathWait, MMU.sqrtCycles);
+		MMU_sqrtFinish();
+	}
+}
+
 DSI_TSC::DSI_TSC()
 {
 	for(int i=0;i<ARRAY_SIZE(registers);i++)
@@ -1891,42 +2332,6 @@ static void writereg_POWCNT1(const int size, const u32 adr, const u32 val) {
 	}
 }
 
-static INLINE void MMU_IPCSync(u8 proc, u32 val)
-{
-	//INFO("IPC%s sync 0x%04X (0x%02X|%02X)\n", proc?"7":"9", val, val >> 8, val & 0xFF);
-	u32 sync_l = T1ReadLong(MMU.MMU_MEM[proc][0x40], 0x180) & 0xFFFF;
-	u32 sync_r = T1ReadLong(MMU.MMU_MEM[proc^1][0x40], 0x180) & 0xFFFF;
-
-	sync_l = ( sync_l & 0x000F ) | ( val & 0x0F00 );
-	sync_r = ( sync_r & 0x6F00 ) | ( (val >> 8) & 0x000F );
-
-	sync_l |= val & 0x6000;
-
-	if(nds.ensataEmulation && proc==1 && nds.ensataIpcSyncCounter<9) {
-		u32 iteration = (val&0x0F00)>>8;
-
-		if(iteration==8-nds.ensataIpcSyncCounter)
-			nds.ensataIpcSyncCounter++;
-		else printf("ERROR: ENSATA IPC SYNC HACK FAILED; BAD THINGS MAY HAPPEN\n");
-
-		//for some reason, the arm9 doesn't handshake when ensata is detected.
-		//so we complete the protocol here, which is to mirror the values 8..0 back to 
-		//the arm7 as they are written by the arm7
-		sync_r &= 0xF0FF;
-		sync_r |= (iteration<<8);
-		sync_l &= 0xFFF0;
-		sync_l |= iteration;
-	}
-
-	T1WriteLong(MMU.MMU_MEM[proc][0x40], 0x180, sync_l);
-	T1WriteLong(MMU.MMU_MEM[proc^1][0x40], 0x180, sync_r);
-
-	if ((sync_l & IPCSYNC_IRQ_SEND) && (sync_r & IPCSYNC_IRQ_RECV))
-		NDS_makeIrq(proc^1, IRQ_BIT_IPCSYNC);
-
-	NDS_Reschedule();
-}
-
 static INLINE u16 read_timer(int proc, int timerIndex)
 {
 	//chained timers are always up to date
@@ -3222,6 +3627,132 @@ bool validateIORegsRead(u32 addr, u8 size)
 #define VALIDATE_IO_REGS_READ(PROC, SIZE) ;
 #endif
 
+#define COUNT_IO_ACCESS(PROC, SIZE, WRITE) if (CommonSettings.io_statistics) MMU_ioStats.count(PROC, SIZE, WRITE, adr);
+
+//the polled register at an io address, if any
+static FORCEINLINE u8 MMU_pollReg(u32 adr)
+{
+	if (adr >= POLLREG_END) return POLLREG_NONE;
+	return MMU_pollRegs[(adr - 0x04000000) >> 1];
+}
+
+template<int PROCNUM> static void MMU_notePoll(u8 reg, u32 val)
+{
+	PollTracker &tracker = pollTracker[PROCNUM];
+
+	if (reg == tracker.reg && val == tracker.val && nds_timer - tracker.time < POLL_WAIT_GAP)
+	{
+		if (++tracker.streak >= POLL_WAIT_STREAK)
+		{
+			MMU_pollWait[PROCNUM] = true;
+			tracker.streak = 0;
+		}
+	}
+	else
+	{
+		tracker.reg = reg;
+		tracker.val = val;
+		tracker.streak = 0;
+	}
+	tracker.time = nds_timer;
+}
+
+//these do what the read handlers' switches do for the polled registers
+template<int PROCNUM> static u16 MMU_readPolled16(u8 reg, u32 adr)
+{
+	u16 val;
+
+	switch (reg)
+	{
+		case POLLREG_IF: return MMU.gen_IF<PROCNUM>();
+		case POLLREG_IF_HI: return MMU.gen_IF<PROCNUM>()>>16;
+
+		case POLLREG_VCOUNT:
+			if(PROCNUM == ARMCPU_ARM9 && nds.ensataEmulation && nds.ensataHandshake == ENSATA_HANDSHAKE_query)
+			{
+				nds.ensataHandshake = ENSATA_HANDSHAKE_ack;
+				return 270;
+			}
+			val = nds.VCount;
+			break;
+
+		case POLLREG_KEYINPUT:
+			//the arm7 polls this every frame, so only the arm9 reading it counts as an input check
+			if (PROCNUM == ARMCPU_ARM9)
+				LagFrameFlag=0;
+			//fallthrough
+		default:
+			val = T1ReadWord_guaranteedAligned(MMU.MMU_MEM[PROCNUM][0x40], adr & MMU.MMU_MASK[PROCNUM][0x40]);
+			break;
+	}
+
+	if (CommonSettings.poll_wait)
+		MMU_notePoll<PROCNUM>(reg, val);
+	return val;
+}
+
+template<int PROCNUM> static u32 MMU_readPolled32(u8 reg, u32 adr)
+{
+	if (reg == POLLREG_IF)
+		return MMU.gen_IF<PROCNUM>();
+
+	if (PROCNUM == ARMCPU_ARM9 && reg == POLLREG_KEYINPUT)
+		LagFrameFlag=0;
+
+	//dispstat and vcount read together, or keyinput and keycnt
+	const u32 val = T1ReadLong_guaranteedAligned(MMU.MMU_MEM[PROCNUM][0x40], adr & MMU.MMU_MASK[PROCNUM][0x40]);
+	if (CommonSettings.poll_wait)
+		MMU_notePoll<PROCNUM>(reg, val);
+	return val;
+}
+
+MMU_IOStatistics MMU_ioStats;
+
+void MMU_IOStatistics::reset()
+{
+	memset(counts, 0, sizeof(counts));
+	memset(adr, 0, sizeof(adr));
+}
+
+struct IOStatisticsEntry
+{
+	u64 count;
+	u32 adr;
+	u8 procnum, write, size;
+	bool operator<(const IOStatisticsEntry &other) const { return count > other.count; }
+};
+
+void MMU_IOStatistics::dump(const char *title, u32 top)
+{
+	typedef IOStatisticsEntry Entry;
+	std::vector<Entry> entries;
+	u64 total = 0;
+
+	for (int proc = 0; proc < 2; proc++)
+		for (int write = 0; write < 2; write++)
+			for (int size = 0; size < 3; size++)
+				for (u32 s = 0; s < MMU_IOSTAT_SLOTS; s++)
+				{
+					const u64 n = counts[proc][write][size][s];
+					if (!n) continue;
+					Entry e = { n, adr[s], (u8)proc, (u8)write, (u8)(8<<size) };
+					entries.push_back(e);
+					total += n;
+				}
+
+	std::sort(entries.begin(), entries.end());
+
+	printf("io register accesses (%s): %llu in total\n", title, (unsigned long long)total);
+	for (u32 i = 0; i < entries.size() && i < top; i++)
+	{
+		const Entry &e = entries[i];
+		printf("  ARM%c %s%02d %08X %12llu %5.1f%%\n", e.procnum == ARMCPU_ARM9 ? '9' : '7', e.write ? "write" : "read", 
+			e.size, e.adr, (unsigned long long)e.count, 100.0 * e.count / total);
+	}
+
+	reset();
+}
+
 //================================================================================================== ARM9 *
 //=========================================================================================================
 //=========================================================================================================
@@ -3257,6 +3788,7 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM9, 8, true);
 		if (!validateIORegsWrite<ARMCPU_ARM9>(adr, 8, val)) return;
 		
 		// TODO: add pal reg
@@ -3494,9 +4026,11 @@ void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
 	if(restricted) return; //block 8bit vram writes
+	if((adr>>24) == 6) MMU_VRAMnoteWrite(adr - LCDC_HACKY_LOCATION);
+	else if((adr>>24) == 2) MMU_MAINnoteWrite(adr & _MMU_MAIN_MEM_MASK);
 
 //#ifdef HAVE_JIT
 //	if (JITLUT_MAPPED(adr, ARMCPU_ARM9))
@@ -3535,6 +4069,7 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM9, 16, true);
 		if (!validateIORegsWrite<ARMCPU_ARM9>(adr, 16, val)) return;
 
 		// TODO: add pal reg
@@ -3867,7 +4402,7 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 			case REG_IF+2: REG_IF_WriteWord<ARMCPU_ARM9>(2,val); return;
 
             case REG_IPCSYNC:
-				MMU_IPCSync(ARMCPU_ARM9, val);
+				IPC_Sync(ARMCPU_ARM9, val);
 				return;
 			case REG_IPCFIFOCNT:
 				IPC_FIFOcnt(ARMCPU_ARM9, val);
@@ -3954,8 +4489,10 @@ void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val)
 
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
+	if((adr>>24) == 6) MMU_VRAMnoteWrite(adr - LCDC_HACKY_LOCATION);
+	else if((adr>>24) == 2) MMU_MAINnoteWrite(adr & _MMU_MAIN_MEM_MASK);
 
 //#ifdef HAVE_JIT
 //	if (JITLUT_MAPPED(adr, ARMCPU_ARM9))
@@ -4003,6 +4540,7 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM9, 32, true);
 		if (!validateIORegsWrite<ARMCPU_ARM9>(adr, 32, val)) return;
 
 		// TODO: add pal reg
@@ -4333,7 +4871,7 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 				return;
 			
 			case REG_IPCSYNC:
-				MMU_IPCSync(ARMCPU_ARM9, val);
+				IPC_Sync(ARMCPU_ARM9, val);
 				return;
 			case REG_IPCFIFOCNT:
 				IPC_FIFOcnt(ARMCPU_ARM9, val);
@@ -4391,8 +4929,10 @@ void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return;
+	if((adr>>24) == 6) MMU_VRAMnoteWrite(adr - LCDC_HACKY_LOCATION);
+	else if((adr>>24) == 2) MMU_MAINnoteWrite(adr & _MMU_MAIN_MEM_MASK);
 
 //#ifdef HAVE_JIT
 //	if (JITLUT_MAPPED(adr, ARMCPU_ARM9))
@@ -4427,6 +4967,7 @@ u8 FASTCALL _MMU_ARM9_read08(u32 adr)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM9, 8, false);
 		VALIDATE_IO_REGS_READ(ARMCPU_ARM9, 8);
 		
 		if(MMU_new.is_dma(adr)) return MMU_new.read_dma(ARMCPU_ARM9,8,adr);
@@ -4495,7 +5036,7 @@ u8 FASTCALL _MMU_ARM9_read08(u32 adr)
 	}
 
 	bool unmapped, restricted;	
-	adr = MMU_LCDmap<ARMCPU_ARM9>(adr, unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM9>(adr, unmapped, restricted);
 	if(unmapped) return 0;
 
 	return MMU.MMU_MEM[ARMCPU_ARM9][(adr>>20)&0xFF][adr&MMU.MMU_MASK[ARMCPU_ARM9][(adr>>20)&0xFF]];
@@ -4522,6 +5063,11 @@ u16 FASTCALL _MMU_ARM9_read16(u32 adr)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM9, 16, false);
+
+		const u8 pollReg = MMU_pollReg(adr);
+		if (pollReg) return MMU_readPolled16<ARMCPU_ARM9>(pollReg, adr);
+
 		VALIDATE_IO_REGS_READ(ARMCPU_ARM9, 16);
 
 		if(MMU_new.is_dma(adr)) return MMU_new.read_dma(ARMCPU_ARM9,16,adr); 
@@ -4604,7 +5150,7 @@ u16 FASTCALL _MMU_ARM9_read16(u32 adr)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM9>(adr,unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM9>(adr,unmapped, restricted);
 	if(unmapped) return 0;
 	
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF
@@ -4632,6 +5178,11 @@ u32 FASTCALL _MMU_ARM9_read32(u32 adr)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM9, 32, false);
+
+		const u8 pollReg = MMU_pollReg(adr);
+		if (pollReg) return MMU_readPolled32<ARMCPU_ARM9>(pollReg, adr);
+
 		VALIDATE_IO_REGS_READ(ARMCPU_ARM9, 32);
 		
 		if(MMU_new.is_dma(adr)) return MMU_new.read_dma(ARMCPU_ARM9,32,adr); 
@@ -4746,7 +5297,7 @@ u32 FASTCALL _MMU_ARM9_read32(u32 adr)
 	}
 	
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM9>(adr,unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM9>(adr,unmapped, restricted);
 	if(unmapped) return 0;
 
 	// Removed the &0xFF as they are implicit with the adr&0x0FFFFFFF [zeromus, inspired by shash]
@@ -4790,6 +5341,7 @@ void FASTCALL _MMU_ARM7_write08(u32 adr, u8 val)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM7, 8, true);
 		if (!validateIORegsWrite<ARMCPU_ARM7>(adr, 8, val)) return;
 
 		if(MMU_new.is_dma(adr)) { MMU_new.write_dma(ARMCPU_ARM7,8,adr,val); return; }
@@ -4858,8 +5410,10 @@ void FASTCALL _MMU_ARM7_write08(u32 adr, u8 val)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return;
+	if((adr>>24) == 6) MMU_VRAMnoteWrite(adr - LCDC_HACKY_LOCATION);
+	else if((adr>>24) == 2) MMU_MAINnoteWrite(adr & _MMU_MAIN_MEM_MASK);
 
 #ifdef HAVE_JIT
 	if (JITLUT_MAPPED(adr, ARMCPU_ARM7))
@@ -4905,6 +5459,7 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM7, 16, true);
 		if (!validateIORegsWrite<ARMCPU_ARM7>(adr, 16, val)) return;
 
 		if(MMU_new.is_dma(adr)) { MMU_new.write_dma(ARMCPU_ARM7,16,adr,val); return; }
@@ -5011,7 +5566,7 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
 			case REG_IF+2: REG_IF_WriteWord<ARMCPU_ARM7>(2,val); return;
 				
             case REG_IPCSYNC:
-				MMU_IPCSync(ARMCPU_ARM7, val);
+				IPC_Sync(ARMCPU_ARM7, val);
 				return;
 			case REG_IPCFIFOCNT:
 				IPC_FIFOcnt(ARMCPU_ARM7, val);
@@ -5046,8 +5601,10 @@ void FASTCALL _MMU_ARM7_write16(u32 adr, u16 val)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return;
+	if((adr>>24) == 6) MMU_VRAMnoteWrite(adr - LCDC_HACKY_LOCATION);
+	else if((adr>>24) == 2) MMU_MAINnoteWrite(adr & _MMU_MAIN_MEM_MASK);
 
 #ifdef HAVE_JIT
 	if (JITLUT_MAPPED(adr, ARMCPU_ARM7))
@@ -5092,6 +5649,7 @@ void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM7, 32, true);
 		if (!validateIORegsWrite<ARMCPU_ARM7>(adr, 32, val)) return;
 
 		if(MMU_new.is_dma(adr)) { MMU_new.write_dma(ARMCPU_ARM7,32,adr,val); return; }
@@ -5129,7 +5687,7 @@ void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
 
 
 			case REG_IPCSYNC:
-				MMU_IPCSync(ARMCPU_ARM7, val);
+				IPC_Sync(ARMCPU_ARM7, val);
 				return;
 			case REG_IPCFIFOCNT:
 				IPC_FIFOcnt(ARMCPU_ARM7, val);
@@ -5151,8 +5709,10 @@ void FASTCALL _MMU_ARM7_write32(u32 adr, u32 val)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return;
+	if((adr>>24) == 6) MMU_VRAMnoteWrite(adr - LCDC_HACKY_LOCATION);
+	else if((adr>>24) == 2) MMU_MAINnoteWrite(adr & _MMU_MAIN_MEM_MASK);
 
 #ifdef HAVE_JIT
 	if (JITLUT_MAPPED(adr, ARMCPU_ARM7))
@@ -5210,6 +5770,7 @@ u8 FASTCALL _MMU_ARM7_read08(u32 adr)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM7, 8, false);
 		VALIDATE_IO_REGS_READ(ARMCPU_ARM7, 8);
 		
 		if(MMU_new.is_dma(adr)) return MMU_new.read_dma(ARMCPU_ARM7,8,adr); 
@@ -5231,7 +5792,7 @@ u8 FASTCALL _MMU_ARM7_read08(u32 adr)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return 0;
 
 	return MMU.MMU_MEM[ARMCPU_ARM7][adr>>20][adr&MMU.MMU_MASK[ARMCPU_ARM7][adr>>20]];
@@ -5269,6 +5830,11 @@ u16 FASTCALL _MMU_ARM7_read16(u32 adr)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM7, 16, false);
+
+		const u8 pollReg = MMU_pollReg(adr);
+		if (pollReg) return MMU_readPolled16<ARMCPU_ARM7>(pollReg, adr);
+
 		VALIDATE_IO_REGS_READ(ARMCPU_ARM7, 16);
 
 		if(MMU_new.is_dma(adr)) return MMU_new.read_dma(ARMCPU_ARM7,16,adr); 
@@ -5329,7 +5895,7 @@ u16 FASTCALL _MMU_ARM7_read16(u32 adr)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return 0;
 
 	/* Returns data from memory */
@@ -5373,6 +5939,11 @@ u32 FASTCALL _MMU_ARM7_read32(u32 adr)
 	// Address is an IO register
 	if ((adr >> 24) == 4)
 	{
+		COUNT_IO_ACCESS(ARMCPU_ARM7, 32, false);
+
+		const u8 pollReg = MMU_pollReg(adr);
+		if (pollReg) return MMU_readPolled32<ARMCPU_ARM7>(pollReg, adr);
+
 		VALIDATE_IO_REGS_READ(ARMCPU_ARM7, 32);
 		
 		if(MMU_new.is_dma(adr)) return MMU_new.read_dma(ARMCPU_ARM7,32,adr); 
@@ -5413,7 +5984,7 @@ u32 FASTCALL _MMU_ARM7_read32(u32 adr)
 	}
 
 	bool unmapped, restricted;
-	adr = MMU_LCDmap<ARMCPU_ARM7>(adr,unmapped, restricted);
+	adr = MMU_LCDmapAccess<ARMCPU_ARM7>(adr,unmapped, restricted);
 	if(unmapped) return 0;
 
 	//Returns data from memory
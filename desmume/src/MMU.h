@@ -20,6 +20,8 @@
 #ifndef MMU_H
 #define MMU_H
 
+#include <assert.h>
+
 #include "FIFO.h"
 #include "mem.h"
 #include "registers.h"
@@ -631,6 +633,136 @@ FORCEINLINE void* MMU_gpu_map(u32 vram_addr)
 	return MMU.ARM9_LCD + (vram_page<<14) + ofs;
 }
 
+//VRAMCNT writes are coalesced: the new mapping is only worked out when something next needs it.
+//the memory handlers take care of that themselves; code looking at the mapping from outside of them
+//(vramConfiguration, MMU.texInfo, MMU.ExtPal, MMU_gpu_map) has to flush it first.
+extern bool MMU_vramRemapPending;
+void MMU_VRAMmapApply();
+FORCEINLINE void MMU_VRAMmapFlush()
+{
+	if(MMU_vramRemapPending)
+		MMU_VRAMmapApply();
+}
+
+//debug reads (the debugger, lua, and the spu worker thread) mustnt apply a pending remap: it isnt theirs to apply,
+//and the spu worker isnt even on the emulation thread. they read through the mapping the remap would install instead
+u32 MMU_VRAMdebugRead(const int PROCNUM, const u32 addr, const int size);
+FORCEINLINE bool MMU_VRAMdebugPending(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 addr)
+{
+	return AT == MMU_AT_DEBUG && MMU_vramRemapPending &&
+		(((addr>>24)&0xF) == 6 || (PROCNUM==ARMCPU_ARM7 && (addr&0x0FFFFFFC) == REG_VRAMSTAT));
+}
+
+//one write generation counter per 16KB page of ARM9_LCD (and the blank memory after it).
+//a page's counter is bumped whenever anything may have written to that page, so that caches of
+//vram contents (such as the texture cache) can tell a page is unchanged without looking at it.
+#define VRAM_GENERATION_PAGES ((0xA4000+0x20000)>>14)
+extern u32 vram_page_generation[VRAM_GENERATION_PAGES];
+
+//the divider and sqrt unit finish by themselves when the sequencer gets to them, or early when the arm9 reads
+//DIVCNT or SQRTCNT while they are busy. the time the unit would have finished is then left in MMU_mathWait
+//(0 otherwise), and the cpu loop moves the arm9 on to it.
+void MMU_divFinish();
+void MMU_sqrtFinish();
+extern u64 MMU_mathWait;
+
+//finishes the unit whose control register is at adr if it is busy. called on arm9 cpu and dma reads of
+//DIVCNT/SQRTCNT before they get to the io handlers; debug reads must not, or peeking would change the timing
+void MMU_mathPoll(u32 adr);
+FORCEINLINE void MMU_mathPollRead(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u32 adr)
+{
+	//DIVCNT and SQRTCNT differ only in bits 4-5
+	if(PROCNUM==ARMCPU_ARM9 && AT != MMU_AT_DEBUG && (adr & ~0x30) == REG_DIVCNT)
+		MMU_mathPoll(adr);
+}
+
+//counts of io register accesses by cpu, direction, size and address, to see which registers are worth a fast handler.
+//the counting is always compiled in; it is switched on with CommonSettings.io_statistics, and costs the
+//io handlers one test of that while it is off.
+//0x04000000-0x04001FFF get a slot each, 0x041000xx (ipc/gamecard) and the rest (wifi) get 256 slots apiece
+#define MMU_IOSTAT_SLOTS 0x2200
+struct MMU_IOStatistics
+{
+	u64 counts[2][2][3][MMU_IOSTAT_SLOTS]; //[procnum][write][size>>4][slot]
+	u32 adr[MMU_IOSTAT_SLOTS]; //the last address counted in each slot
+
+	static FORCEINLINE u32 slot(u32 adr)
+	{
+		if ((adr & 0x00FFE000) == 0) return adr & 0x1FFF;
+		if ((adr & 0x00FFFF00) == 0x00100000) return 0x2000 + (adr & 0xFF);
+		return 0x2100 + ((adr >> 1) & 0xFF);
+	}
+
+	void count(int PROCNUM, int size, bool write, u32 adr)
+	{
+		const u32 s = slot(adr);
+		counts[PROCNUM][write?1:0][size>>4][s]++;
+		this->adr[s] = adr;
+	}
+
+	void reset();
+	//prints the busiest entries, most accessed first, and starts counting over
+	void dump(const char *title, u32 top = 32);
+};
+extern MMU_IOStatistics MMU_ioStats;
+
+//set when a cpu is seen polling a register that can't change before the next sequencer event (see MMU_readPolled16)
+extern bool MMU_pollWait[2];
+
+//notes a write at the given offset within ARM9_LCD
+FORCEINLINE void MMU_VRAMnoteWrite(u32 lcdc_ofs)
+{
+	vram_page_generation[lcdc_ofs>>14]++;
+}
+
+//notes that all of vram may have changed (for loadstates, resets and debug tools)
+void MMU_VRAMnoteWriteAll();
+
+//the same kind of counters for MAIN_MEM, one per 4KB page. they are bumped by the cpu write paths
+//(and with them dma), jit block stores and raw pointer writers, so that savestate checkpoints can
+//find the pages written since they were taken without comparing memory.
+#define MAIN_MEM_GENERATION_SHIFT 12
+#define MAIN_MEM_GENERATION_PAGES ((16*1024*1024)>>MAIN_MEM_GENERATION_SHIFT)
+extern u32 main_mem_page_generation[MAIN_MEM_GENERATION_PAGES];
+
+//notes a write at the given (masked) offset within MAIN_MEM
+FORCEINLINE void MMU_MAINnoteWrite(u32 ofs)
+{
+	main_mem_page_generation[ofs>>MAIN_MEM_GENERATION_SHIFT]++;
+}
+
+//notes that all of main memory may have changed
+void MMU_MAINnoteWriteAll();
+
+//software page tables for each cpu, in 16KB pages over the 0x0FFFFFFF address space.
+//a page with a NULL ptr takes the slow path through _MMU_ARMx_readXX/_MMU_ARMx_writeXX (io, slot2, unmapped memory
+//and the like); otherwise its memory is at ptr + (addr & mask). reads cover all the plain memory, dtcm included.
+//writes only cover the pages which need no bookkeeping (dtcm and shared/arm7 wram); main memory and vram writes
+//are counted for savestate checkpoints and stay on their own paths.
+//the tables are rebuilt by MMU_PagesRefresh whenever vram, WRAMCNT, the dtcm region or the main memory size change
+#define MMU_PAGE_SHIFT 14
+#define MMU_PAGES (0x10000000>>MMU_PAGE_SHIFT)
+struct MMU_PAGE
+{
+	u8* ptr;
+	u32 mask;
+};
+extern MMU_PAGE MMU_readPages[2][MMU_PAGES];
+extern MMU_PAGE MMU_writePages[2][MMU_PAGES];
+
+//rebuilds the pages of both cpus for the address range [start,end)
+void MMU_PagesRefresh(u32 start, u32 end);
+
+FORCEINLINE const MMU_PAGE& MMU_readPage(const int PROCNUM, const u32 addr)
+{
+	return MMU_readPages[PROCNUM][(addr&0x0FFFFFFF)>>MMU_PAGE_SHIFT];
+}
+
+FORCEINLINE const MMU_PAGE& MMU_writePage(const int PROCNUM, const u32 addr)
+{
+	return MMU_writePages[PROCNUM][(addr&0x0FFFFFFF)>>MMU_PAGE_SHIFT];
+}
+
 void FASTCALL _MMU_ARM9_write08(u32 adr, u8 val);
 void FASTCALL _MMU_ARM9_write16(u32 adr, u16 val);
 void FASTCALL _MMU_ARM9_write32(u32 adr, u32 val);
@@ -693,20 +825,23 @@ FORCEINLINE u8 _MMU_read08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u3
 		if((addr&(~0x3FFF)) == MMU.DTCMRegion) return 0; //dtcm
 	}
 
+	//plain memory (dtcm is patched on top of the rest in the arm9 table)
+	const MMU_PAGE& page = MMU_readPage(PROCNUM, addr);
+	if(page.ptr)
+		return T1ReadByte(page.ptr, addr & page.mask);
+
+	//pages watched by lua read hooks are left out of the table, so hooks only need checking from here on
 #ifdef HAVE_LUA
 	CallRegisteredLuaMemHook(addr, 1, /*FIXME*/ 0, LUAMEMHOOK_READ);
+	if(PROCNUM==ARMCPU_ARM9 && (addr&(~0x3FFF)) == MMU.DTCMRegion)
+		return T1ReadByte(MMU.ARM9_DTCM, addr & 0x3FFF);
 #endif
 
-	if(PROCNUM==ARMCPU_ARM9)
-		if((addr&(~0x3FFF)) == MMU.DTCMRegion)
-		{
-			//Returns data from DTCM (ARM9 only)
-			return T1ReadByte(MMU.ARM9_DTCM, addr & 0x3FFF);
-		}
-
-	if ( (addr & 0x0F000000) == 0x02000000)
-		return T1ReadByte( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK);
+	if(MMU_VRAMdebugPending(PROCNUM, AT, addr))
+		return (u8)MMU_VRAMdebugRead(PROCNUM, addr, 8);
 
+	//the busy bit is in the high byte
+	MMU_mathPollRead(PROCNUM, AT, addr-1);
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read08(addr);
 	else return _MMU_ARM7_read08(addr);
 }
@@ -728,13 +863,12 @@ FORCEINLINE u16 _MMU_read16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u
 		if((addr&(~0x3FFF)) == MMU.DTCMRegion) return 0; //dtcm
 	}
 
-#ifdef HAVE_LUA
-	CallRegisteredLuaMemHook(addr, 2, /*FIXME*/ 0, LUAMEMHOOK_READ);
-#endif
-
 	//special handling for execution from arm9, since we spend so much time in there
 	if(PROCNUM==ARMCPU_ARM9 && AT == MMU_AT_CODE)
 	{
+#ifdef HAVE_LUA
+		CallRegisteredLuaMemHook(addr, 2, /*FIXME*/ 0, LUAMEMHOOK_READ);
+#endif
 		if ((addr & 0x0F000000) == 0x02000000)
 			return T1ReadWord_guaranteedAligned( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16);
 
@@ -744,17 +878,25 @@ FORCEINLINE u16 _MMU_read16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u
 		goto dunno;
 	}
 
-	if(PROCNUM==ARMCPU_ARM9)
-		if((addr&(~0x3FFF)) == MMU.DTCMRegion)
-		{
-			//Returns data from DTCM (ARM9 only)
-			return T1ReadWord_guaranteedAligned(MMU.ARM9_DTCM, addr & 0x3FFE);
-		}
+	//plain memory (dtcm is patched on top of the rest in the arm9 table)
+	{
+		const MMU_PAGE& page = MMU_readPage(PROCNUM, addr);
+		if(page.ptr)
+			return T1ReadWord_guaranteedAligned(page.ptr, addr & page.mask & ~1);
+	}
 
-	if ( (addr & 0x0F000000) == 0x02000000)
-		return T1ReadWord_guaranteedAligned( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16);
+	//pages watched by lua read hooks are left out of the table
+#ifdef HAVE_LUA
+	CallRegisteredLuaMemHook(addr, 2, /*FIXME*/ 0, LUAMEMHOOK_READ);
+	if(PROCNUM==ARMCPU_ARM9 && (addr&(~0x3FFF)) == MMU.DTCMRegion)
+		return T1ReadWord_guaranteedAligned(MMU.ARM9_DTCM, addr & 0x3FFE);
+#endif
 
 dunno:
+	if(MMU_VRAMdebugPending(PROCNUM, AT, addr))
+		return (u16)MMU_VRAMdebugRead(PROCNUM, addr, 16);
+
+	MMU_mathPollRead(PROCNUM, AT, addr);
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read16(addr);
 	else return _MMU_ARM7_read16(addr);
 }
@@ -776,13 +918,12 @@ FORCEINLINE u32 _MMU_read32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u
 		if((addr&(~0x3FFF)) == MMU.DTCMRegion) return 0; //dtcm
 	}
 
-#ifdef HAVE_LUA
-	CallRegisteredLuaMemHook(addr, 4, /*FIXME*/ 0, LUAMEMHOOK_READ);
-#endif
-
 	//special handling for execution from arm9, since we spend so much time in there
 	if(PROCNUM==ARMCPU_ARM9 && AT == MMU_AT_CODE)
 	{
+#ifdef HAVE_LUA
+		CallRegisteredLuaMemHook(addr, 4, /*FIXME*/ 0, LUAMEMHOOK_READ);
+#endif
 		if ( (addr & 0x0F000000) == 0x02000000)
 			return T1ReadLong_guaranteedAligned( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32);
 
@@ -798,28 +939,26 @@ FORCEINLINE u32 _MMU_read32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const u
 		goto dunno;
 	}
 
-	//special handling for execution from arm7. try reading from main memory first
-	if(PROCNUM==ARMCPU_ARM7)
+	//plain memory. for other arm9 cases, dtcm has to come first because it is patched on top of the main memory range;
+	//the arm9 table already has it there
 	{
-		if ( (addr & 0x0F000000) == 0x02000000)
-			return T1ReadLong_guaranteedAligned( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32);
+		const MMU_PAGE& page = MMU_readPage(PROCNUM, addr);
+		if(page.ptr)
+			return T1ReadLong_guaranteedAligned(page.ptr, addr & page.mask & ~3);
 	}
 
-
-	//for other arm9 cases, we have to check from dtcm first because it is patched on top of the main memory range
-	if(PROCNUM==ARMCPU_ARM9)
-	{
-		if((addr&(~0x3FFF)) == MMU.DTCMRegion)
-		{
-			//Returns data from DTCM (ARM9 only)
-			return T1ReadLong_guaranteedAligned(MMU.ARM9_DTCM, addr & 0x3FFC);
-		}
-	
-		if ( (addr & 0x0F000000) == 0x02000000)
-			return T1ReadLong_guaranteedAligned( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32);
-	}
+	//pages watched by lua read hooks are left out of the table
+#ifdef HAVE_LUA
+	CallRegisteredLuaMemHook(addr, 4, /*FIXME*/ 0, LUAMEMHOOK_READ);
+	if(PROCNUM==ARMCPU_ARM9 && (addr&(~0x3FFF)) == MMU.DTCMRegion)
+		return T1ReadLong_guaranteedAligned(MMU.ARM9_DTCM, addr & 0x3FFC);
+#endif
 
 dunno:
+	if(MMU_VRAMdebugPending(PROCNUM, AT, addr))
+		return (u32)MMU_VRAMdebugRead(PROCNUM, addr, 32);
+
+	MMU_mathPollRead(PROCNUM, AT, addr);
 	if(PROCNUM==ARMCPU_ARM9) return _MMU_ARM9_read32(addr);
 	else return _MMU_ARM7_read32(addr);
 }
@@ -835,15 +974,23 @@ FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		if((addr&(~0x3FFF)) == MMU.DTCMRegion) return; //dtcm
 	}
 
-	if(PROCNUM==ARMCPU_ARM9)
-		if((addr&(~0x3FFF)) == MMU.DTCMRegion)
-		{
-			T1WriteByte(MMU.ARM9_DTCM, addr & 0x3FFF, val);
+	//dtcm and wram (pages watched by lua write hooks are left out of the table)
+	const MMU_PAGE& page = MMU_writePage(PROCNUM, addr);
+	if(page.ptr)
+	{
+		T1WriteByte(page.ptr, addr & page.mask, val);
+		return;
+	}
+
 #ifdef HAVE_LUA
-			CallRegisteredLuaMemHook(addr, 1, val, LUAMEMHOOK_WRITE);
+	//a watched dtcm page has no table entry either
+	if(PROCNUM==ARMCPU_ARM9 && (addr&(~0x3FFF)) == MMU.DTCMRegion)
+	{
+		T1WriteByte(MMU.ARM9_DTCM, addr & 0x3FFF, val);
+		CallRegisteredLuaMemHook(addr, 1, val, LUAMEMHOOK_WRITE);
+		return;
+	}
 #endif
-			return;
-		}
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
@@ -852,6 +999,7 @@ FORCEINLINE void _MMU_write08(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 			JITLUT_HANDLE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK, 0) = 0;
 		}
 #endif
+		MMU_MAINnoteWrite(addr & _MMU_MAIN_MEM_MASK);
 		T1WriteByte( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 1, val, LUAMEMHOOK_WRITE);
@@ -877,15 +1025,23 @@ FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		if((addr&(~0x3FFF)) == MMU.DTCMRegion) return; //dtcm
 	}
 
-	if(PROCNUM==ARMCPU_ARM9)
-		if((addr&(~0x3FFF)) == MMU.DTCMRegion)
-		{
-			T1WriteWord(MMU.ARM9_DTCM, addr & 0x3FFE, val);
+	//dtcm and wram (pages watched by lua write hooks are left out of the table)
+	const MMU_PAGE& page = MMU_writePage(PROCNUM, addr);
+	if(page.ptr)
+	{
+		T1WriteWord(page.ptr, addr & page.mask & ~1, val);
+		return;
+	}
+
 #ifdef HAVE_LUA
-			CallRegisteredLuaMemHook(addr, 2, val, LUAMEMHOOK_WRITE);
+	//a watched dtcm page has no table entry either
+	if(PROCNUM==ARMCPU_ARM9 && (addr&(~0x3FFF)) == MMU.DTCMRegion)
+	{
+		T1WriteWord(MMU.ARM9_DTCM, addr & 0x3FFE, val);
+		CallRegisteredLuaMemHook(addr, 2, val, LUAMEMHOOK_WRITE);
+		return;
+	}
 #endif
-			return;
-		}
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
@@ -894,6 +1050,7 @@ FORCEINLINE void _MMU_write16(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 			JITLUT_HANDLE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK16, 0) = 0;
 		}
 #endif
+		MMU_MAINnoteWrite(addr & _MMU_MAIN_MEM_MASK16);
 		T1WriteWord( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK16, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 2, val, LUAMEMHOOK_WRITE);
@@ -919,15 +1076,23 @@ FORCEINLINE void _MMU_write32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 		if((addr&(~0x3FFF)) == MMU.DTCMRegion) return; //dtcm
 	}
 
-	if(PROCNUM==ARMCPU_ARM9)
-		if((addr&(~0x3FFF)) == MMU.DTCMRegion)
-		{
-			T1WriteLong(MMU.ARM9_DTCM, addr & 0x3FFC, val);
+	//dtcm and wram (pages watched by lua write hooks are left out of the table)
+	const MMU_PAGE& page = MMU_writePage(PROCNUM, addr);
+	if(page.ptr)
+	{
+		T1WriteLong(page.ptr, addr & page.mask & ~3, val);
+		return;
+	}
+
 #ifdef HAVE_LUA
-			CallRegisteredLuaMemHook(addr, 4, val, LUAMEMHOOK_WRITE);
+	//a watched dtcm page has no table entry either
+	if(PROCNUM==ARMCPU_ARM9 && (addr&(~0x3FFF)) == MMU.DTCMRegion)
+	{
+		T1WriteLong(MMU.ARM9_DTCM, addr & 0x3FFC, val);
+		CallRegisteredLuaMemHook(addr, 4, val, LUAMEMHOOK_WRITE);
+		return;
+	}
 #endif
-			return;
-		}
 
 	if ( (addr & 0x0F000000) == 0x02000000) {
 #ifdef HAVE_JIT
@@ -937,6 +1102,7 @@ FORCEINLINE void _MMU_write32(const int PROCNUM, const MMU_ACCESS_TYPE AT, const
 			JITLUT_HANDLE_KNOWNBANK(addr, MAIN_MEM, _MMU_MAIN_MEM_MASK32, 1) = 0;
 		}
 #endif
+		MMU_MAINnoteWrite(addr & _MMU_MAIN_MEM_MASK32);
 		T1WriteLong( MMU.MAIN_MEM, addr & _MMU_MAIN_MEM_MASK32, val);
 #ifdef HAVE_LUA
 		CallRegisteredLuaMemHook(addr, 4, val, LUAMEMHOOK_WRITE);
@@ -1008,6 +1174,8 @@ FORCEINLINE u8* _MMU_read_getrawptr32(const u32 addr_s, const u32 addr_e)
 	return NULL;
 }
 
+//only the pages holding addr_s and addr_e are marked written, so callers must keep
+//the span within two 4KB main memory pages (an LDM/STM block of up to 16 words does)
 template<int PROCNUM, MMU_ACCESS_TYPE AT>
 FORCEINLINE u8* _MMU_write_getrawptr32(const u32 addr_s, const u32 addr_e)
 {
@@ -1028,6 +1196,10 @@ FORCEINLINE u8* _MMU_write_getrawptr32(const u32 addr_s, const u32 addr_e)
 	if ((addr_s & 0x0F000000) == 0x02000000 && 
 		(addr_e & 0x0F000000) == 0x02000000) 
 	{
+		//the caller is about to write through this pointer
+		assert(((addr_e - addr_s) & _MMU_MAIN_MEM_MASK32) < (1 << MAIN_MEM_GENERATION_SHIFT));
+		MMU_MAINnoteWrite(addr_s & _MMU_MAIN_MEM_MASK32);
+		MMU_MAINnoteWrite(addr_e & _MMU_MAIN_MEM_MASK32);
 		return &MMU.MAIN_MEM[addr_s & _MMU_MAIN_MEM_MASK32];
 	}
 
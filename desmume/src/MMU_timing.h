@@ -29,6 +29,10 @@
 #include "debug.h"
 #include "NDSSystem.h"
 
+#ifdef ENABLE_SSE2
+#include <emmintrin.h>
+#endif
+
 ////////////////////////////////////////////////////////////////
 // MEMORY TIMING ACCURACY CONFIGURATION
 //
@@ -134,13 +138,12 @@ private:
 		CacheBlock& block = m_blocks[blockIndex];
 		addr &= TAGMASK;
 
-		for(int way = 0; way < ASSOCIATIVITY; way++)
-			if(addr == block.tag[way])
-			{
-				// found it, already allocated
-				m_cacheCache = blockMasked;
-				return true;
-			}
+		if(block.Find(addr))
+		{
+			// found it, already allocated
+			m_cacheCache = blockMasked;
+			return true;
+		}
 		if(DIR == MMU_AD_READ)
 		{
 			// TODO: support other allocation orders?
@@ -174,6 +177,22 @@ private:
 			for(int way = 0; way < ASSOCIATIVITY; way++)
 				tag[way] = 0;
 		}
+
+		// compares all the ways at once instead of scanning them
+		FORCEINLINE bool Find(u32 addr) const
+		{
+#ifdef ENABLE_SSE2
+			if(ASSOCIATIVITY == 4)
+			{
+				const __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)tag), _mm_set1_epi32(addr));
+				return _mm_movemask_epi8(eq) != 0;
+			}
+#endif
+			bool found = false;
+			for(int way = 0; way < ASSOCIATIVITY; way++)
+				found |= (addr == tag[way]);
+			return found;
+		}
 	};
 
 	u32 m_cacheCache; // optimization
@@ -204,6 +223,19 @@ public:
 			return 1;
 		}
 
+#ifdef ENABLE_CACHE_CONTROLLER_EMULATION
+		// nothing but this unit touches its cache, so another access to the
+		// main memory line it last hit or filled is still a cache hit,
+		// as long as the protection unit still has the line cacheable.
+		if(TIMING && PROCNUM==ARMCPU_ARM9 && (address & LINEMASK) == m_lastLine && Cacheable(address))
+		{
+#ifdef ACCOUNT_FOR_NON_SEQUENTIAL_ACCESS
+			m_lastAddress = address;
+#endif
+			return 1;
+		}
+#endif
+
 		u32 time = _MMU_accesstime<PROCNUM, AT, READSIZE, DIRECTION,TIMING>(address,
 #ifdef ACCOUNT_FOR_NON_SEQUENTIAL_ACCESS
 			(TIMING?
@@ -219,12 +251,26 @@ public:
 		m_lastAddress = address;
 #endif
 
+#ifdef ENABLE_CACHE_CONTROLLER_EMULATION
+		// reads allocate on a miss, writes only stay in the cache if they hit.
+		// dtcm patched over main memory never went through the cache at all.
+		if(TIMING && PROCNUM==ARMCPU_ARM9)
+		{
+			if((address & 0x0F000000) == 0x02000000 && (DIRECTION == MMU_AD_READ || time == 1)
+				&& (AT != MMU_AT_DATA || (address & ~0x3FFF) != MMU.DTCMRegion) && Cacheable(address))
+				m_lastLine = address & LINEMASK;
+			else
+				m_lastLine = ~0;
+		}
+#endif
+
 		return time;
 	}
 
 	void Reset()
 	{
 		m_lastAddress = ~0;
+		m_lastLine = ~0;
 	}
 	FetchAccessUnit() { this->Reset(); }
 
@@ -235,11 +281,20 @@ public:
 	bool loadstate(EMUFILE* is, int version)
 	{
 		read32le(&m_lastAddress,is);
+		m_lastLine = ~0;
 		return true;
 	}
 
 private:
+	enum { LINEMASK = ~31 }; // the arm9 caches have 32-byte lines
+
+	FORCEINLINE bool Cacheable(u32 address)
+	{
+		return (AT == MMU_AT_CODE) ? cp15.isCodeCached(address) : cp15.isDataCached(address);
+	}
+
 	u32 m_lastAddress;
+	u32 m_lastLine;
 };
 
 
@@ -292,8 +347,12 @@ FORCEINLINE u32 _MMU_accesstime(u32 addr, bool sequential)
 		return MC; // DTCM
 #endif
 
-	// for now, assume the cache is always enabled for all of main memory
-	if(AT != MMU_AT_DMA && TIMING && PROCNUM==ARMCPU_ARM9 && (addr & 0x0F000000) == 0x02000000)
+	// main memory goes through the cache where the protection unit says it is cacheable
+	if(AT != MMU_AT_DMA && TIMING && PROCNUM==ARMCPU_ARM9 && (addr & 0x0F000000) == 0x02000000
+#ifdef ENABLE_CACHE_CONTROLLER_EMULATION
+		&& (AT==MMU_AT_CODE ? cp15.isCodeCached(addr) : cp15.isDataCached(addr))
+#endif
+		)
 	{
 #ifdef ENABLE_CACHE_CONTROLLER_EMULATION
 		bool cached = false;
@@ -21,6 +21,10 @@
 #include <algorithm>
 #include <math.h>
 #include <zlib.h>
+#ifndef _WINDOWS
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "common.h"
 #include "NDSSystem.h"
@@ -28,6 +32,7 @@
 #include "MMU.h"
 #include "ROMReader.h"
 #include "gfx3d.h"
+#include "texcache.h"
 #include "utils/decrypt/decrypt.h"
 #include "utils/decrypt/crc.h"
 #include "utils/advanscene.h"
@@ -42,6 +47,7 @@
 #include "firmware.h"
 #include "version.h"
 #include "path.h"
+#include "saves.h"
 
 //int xxctr=0;
 //#define LOG_ARM9
@@ -169,7 +175,19 @@ int NDS_Init( void)
 	return 0;
 }
 
+#ifdef DESMUME_SELFTEST
+bool NDS_SelfTest()
+{
+	return TexCache_SelfTest() && SPU_SelfTest() && savestate_selftest();
+}
+#endif
+
 void NDS_DeInit(void) {
+	savestate_flush();
+
+	if (CommonSettings.io_statistics == 2)
+		MMU_ioStats.dump("whole run");
+
 	if(MMU.CART_ROM != MMU.UNUSED_RAM)
 		NDS_FreeROM();
 
@@ -444,6 +462,9 @@ void GameInfo::populate()
 	memcpy(ROMname, header.gameTile, 12);
 	trim(ROMname,20);
 
+	if(hasRomBanner())
+		touchRange(header.IconOff, sizeof(RomBanner));
+
 		/*if(header.IconOff < romsize)
 		{
 			u8 num = (T1ReadByte((u8*)romdata, header.IconOff) == 1)?6:7;
@@ -457,6 +478,54 @@ void GameInfo::populate()
 
 }
 
+bool GameInfo::openLazy(void *file, int size)
+{
+#ifdef HAVE_LIBZ
+	resize(size);
+	fillGap();
+	lazyFile = file;
+	lazyLoaded.assign((size + (1 << ROM_LAZY_BLOCK_SHIFT) - 1) >> ROM_LAZY_BLOCK_SHIFT, 0);
+	return true;
+#else
+	return false;
+#endif
+}
+
+void GameInfo::closeLazy()
+{
+	if (lazyFile == NULL) return;
+#ifdef HAVE_LIBZ
+	BLOCKROMReader.DeInit(lazyFile);
+#endif
+	lazyFile = NULL;
+	lazyLoaded.clear();
+}
+
+void GameInfo::fetchBlock(u32 block)
+{
+#ifdef HAVE_LIBZ
+	//a block is only ever read in once, since secure area encryption and dldi patching write over romdata
+	lazyLoaded[block] = 1;
+	const u32 start = block << ROM_LAZY_BLOCK_SHIFT;
+	const u32 len = std::min<u32>(1 << ROM_LAZY_BLOCK_SHIFT, romsize - start);
+	BLOCKROMReader.Seek(lazyFile, start, SEEK_SET);
+	if (BLOCKROMReader.Read(lazyFile, romdata + start, len) != (int)len)
+	{
+		printf("Failed to read rom block at %08X\n", start);
+		memset(romdata + start, 0xFF, len);
+	}
+#endif
+}
+
+void GameInfo::touchRange(u32 adr, u32 len)
+{
+	if (lazyFile == NULL || len == 0) return;
+	const u32 last = std::min<u32>((adr + len - 1) >> ROM_LAZY_BLOCK_SHIFT, (u32)lazyLoaded.size() - 1);
+	for (u32 block = adr >> ROM_LAZY_BLOCK_SHIFT; block <= last; block++)
+		if (!lazyLoaded[block])
+			fetchBlock(block);
+}
+
 #ifdef _WINDOWS
 
 static std::vector<char> buffer;
@@ -516,6 +585,58 @@ static int rom_init_path(const char *filename, const char *physicalName, const c
 	return 1;
 }
 #else
+//gzip and zip roms are decompressed once into a cache file named after a hash of the archive,
+//which is then mapped like a plain rom
+static bool rom_map_cached(ROMReader_struct *reader, void *file, const char *filename, u32 size)
+{
+	FILE *archive = fopen(filename, "rb");
+	if (!archive)
+		return false;
+
+	std::vector<u8> buf(1024*1024);
+	u32 crc = 0, archiveSize = 0;
+	size_t n;
+	while ((n = fread(&buf[0], 1, buf.size(), archive)) > 0)
+	{
+		crc = crc32(crc, &buf[0], (uInt)n);
+		archiveSize += (u32)n;
+	}
+	fclose(archive);
+
+	char name[64];
+	sprintf(name, "romcache-%08X-%08X.nds", crc, archiveSize);
+	std::string cachename = path.getpath(path.TEMP) + name;
+
+	struct stat sb;
+	if (stat(cachename.c_str(), &sb) != 0 || (u32)sb.st_size != size)
+	{
+		//write under a temporary name, so that an interrupted write or another instance never sees half a rom
+		sprintf(name, ".%d.tmp", (int)getpid());
+		std::string tmpname = cachename + name;
+		FILE *out = fopen(tmpname.c_str(), "wb");
+		if (!out)
+			return false;
+
+		bool ok = true;
+		for (u32 left = size; left != 0 && ok; )
+		{
+			u32 todo = std::min<u32>(left, (u32)buf.size());
+			ok = reader->Read(file, &buf[0], todo) == (int)todo && fwrite(&buf[0], 1, todo, out) == todo;
+			left -= todo;
+		}
+		if (fclose(out) != 0)
+			ok = false;
+		if (!ok || rename(tmpname.c_str(), cachename.c_str()) != 0)
+		{
+			remove(tmpname.c_str());
+			reader->Seek(file, 0, SEEK_SET);
+			return false;
+		}
+	}
+
+	return gameInfo.map(cachename.c_str(), size);
+}
+
 static int rom_init_path(const char *filename, const char *physicalName, const char *logicalFilename)
 {
 	int			ret;
@@ -569,6 +690,32 @@ static int rom_init_path(const char *filename, const char *physicalName, const c
 	if(MMU.CART_ROM != MMU.UNUSED_RAM)
 		NDS_FreeROM();
 
+#ifdef HAVE_LIBZ
+	//block compressed roms are left in their container, and only read in as the game touches them
+	if (reader->id == ROMREADER_BLOCK && type != ROM_DSGBA && gameInfo.openLazy(file, size))
+	{
+		//the header and secure area are needed straight away
+		gameInfo.touchRange(0, 0x8000);
+		return size;
+	}
+#endif
+
+	//ds.gba roms start partway into the file, so they are always read in
+	if (CommonSettings.ROM_MapFile && type != ROM_DSGBA)
+	{
+		bool mapped;
+		if (reader->id == ROMREADER_STD)
+			mapped = gameInfo.map(filename, size);
+		else
+			mapped = rom_map_cached(reader, file, filename, size);
+
+		if (mapped)
+		{
+			reader->DeInit(file);
+			return size;
+		}
+	}
+
 	gameInfo.resize(size);
 	ret = reader->Read(file, gameInfo.romdata, size);
 	gameInfo.fillGap();
@@ -606,7 +753,12 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 	NDS_SetROM((u8*)gameInfo.romdata, gameInfo.mask);
 
 	gameInfo.populate();
-	gameInfo.crc = crc32(0,(u8*)gameInfo.romdata,gameInfo.romsize);
+#ifdef HAVE_LIBZ
+	if (gameInfo.lazyFile)
+		gameInfo.crc = BLOCKROMReaderCRC(gameInfo.lazyFile);
+	else
+#endif
+		gameInfo.crc = crc32(0,(u8*)gameInfo.romdata,gameInfo.romsize);
 
 	gameInfo.chipID  = 0xC2;														// The Manufacturer ID is defined by JEDEC (C2h = Macronix)
 	gameInfo.chipID |= ((((128 << gameInfo.header.cardSize) / 1024) - 1) << 8);		// Chip size in megabytes minus 1
@@ -663,7 +815,10 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 
 	//for homebrew, try auto-patching DLDI. should be benign if there is no DLDI or if it fails
 	if(gameInfo.isHomebrew)
+	{
+		gameInfo.touchAll();
 		DLDI::tryPatch((void*)gameInfo.romdata, gameInfo.romsize);
+	}
 
 	memset(buf, 0, MAX_PATH);
 	path.getpathnoext(path.BATTERY, buf);
@@ -686,8 +841,14 @@ int NDS_LoadROM(const char *filename, const char *physicalName, const char *logi
 void NDS_FreeROM(void)
 {
 	FCEUI_StopMovie();
+	gameInfo.closeLazy();
 	if ((u8*)MMU.CART_ROM == (u8*)gameInfo.romdata)
 	{
+		if (gameInfo.rommap)
+		{
+			gameInfo.release();
+			MMU.CART_ROM = NULL;
+		}
 		gameInfo.romdata = NULL;
 		if (gameInfo.filemap)
 		{
@@ -1327,17 +1488,7 @@ struct TSequenceItem_divider : public TSequenceItem
 	void exec()
 	{
 		IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[2]++);
-		MMU_new.div.busy = 0;
-#ifdef _WIN64
-		T1WriteQuad(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A0, MMU.divResult);
-		T1WriteQuad(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A8, MMU.divMod);
-#else
-		T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A0, (u32)MMU.divResult);
-		T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A4, (u32)(MMU.divResult >> 32));
-		T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2A8, (u32)MMU.divMod);
-		T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2AC, (u32)(MMU.divMod >> 32));
-#endif
-		MMU.divRunning = FALSE;
+		MMU_divFinish();
 	}
 
 };
@@ -1359,9 +1510,7 @@ struct TSequenceItem_sqrtunit : public TSequenceItem
 	FORCEINLINE void exec()
 	{
 		IF_DEVELOPER(DEBUG_statistics.sequencerExecutionCounters[3]++);
-		MMU_new.sqrt.busy = 0;
-		T1WriteLong(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x2B4, MMU.sqrtResult);
-		MMU.sqrtRunning = FALSE;
+		MMU_sqrtFinish();
 	}
 
 };
@@ -1995,6 +2144,31 @@ FORCEINLINE void arm7log()
 static const int kMaxWork = 4000;
 static const int kIrqWait = 4000;
 
+//a cpu flagged in MMU_pollWait is spinning on a register that won't change before the next event,
+//so it's moved on towards that the way a halted cpu is
+template<int PROCNUM> static FORCEINLINE s32 armPollWait(s32 time, s32 s32next)
+{
+	if (!MMU_pollWait[PROCNUM]) return time;
+	MMU_pollWait[PROCNUM] = false;
+	if (time >= s32next) return time;
+
+	const s32 next = min(s32next, time + kIrqWait);
+	nds.idleCycles[PROCNUM] += next-time;
+	return next;
+}
+
+
+//an arm9 that found the divider or sqrt unit busy has had it finished early (see MMU_mathWait),
+//so it's moved on to when the unit would have finished. its time is counted from nds_timer_base
+//rather than nds_timer, so nothing it spent before or after the poll in the same block is charged twice
+static FORCEINLINE s32 armMathWait(s32 time, const u64 nds_timer_base)
+{
+	if (!MMU_mathWait) return time;
+	const u64 done = MMU_mathWait;
+	MMU_mathWait = 0;
+	if (done <= nds_timer_base + time) return time;
+	return (s32)(done - nds_timer_base);
+}
 
 template<bool doarm9, bool doarm7>
 static FORCEINLINE s32 minarmtime(s32 arm9, s32 arm7)
@@ -2030,6 +2204,8 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 #else
 				arm9 += armcpu_exec<ARMCPU_ARM9>();
 #endif
+				arm9 = armPollWait<ARMCPU_ARM9>(arm9, s32next);
+				arm9 = armMathWait(arm9, nds_timer_base);
 				#ifdef DEVELOPER
 					nds_debug_continuing[0] = false;
 				#endif
@@ -2052,6 +2228,7 @@ static /*donotinline*/ std::pair<s32,s32> armInnerLoop(
 #else
 				arm7 += (armcpu_exec<ARMCPU_ARM7>()<<1);
 #endif
+				arm7 = armPollWait<ARMCPU_ARM7>(arm7, s32next);
 				#ifdef DEVELOPER
 					nds_debug_continuing[1] = false;
 				#endif
@@ -2152,6 +2329,8 @@ void NDS_exec(s32 nb)
 			#endif
 
 			nds.cpuloopIterationCount++;
+			//the gpu, 3d and dma all see vram through the mapping
+			MMU_VRAMmapFlush();
 			sequencer.execHardware();
 
 			//break out once per frame
@@ -2246,6 +2425,9 @@ void NDS_exec(s32 nb)
 	//	debug_pcount = 0;
 	//}
 
+	//frontend tools (vram viewers and such) look at the vram mapping between frames
+	MMU_VRAMmapFlush();
+
 	//end of frame emulation housekeeping
 	if(LagFrameFlag)
 	{
@@ -2258,6 +2440,9 @@ void NDS_exec(s32 nb)
 		lagframecounter = 0;
 	}
 	currFrameCounter++;
+	IPC_EndFrame();
+	if (CommonSettings.io_statistics == 1)
+		MMU_ioStats.dump("frame");
 	DEBUG_Notify.NextFrame();
 	if (cheats)
 		cheats->process();
@@ -2598,6 +2783,9 @@ bool NDS_FakeBoot()
 	//firmware loads the game card arm9 and arm7 programs as specified in rom header
 	{
 		//copy the arm9 program to the address specified by rom header
+		gameInfo.touchRange(header->ARM9src, header->ARM9binSize);
+		gameInfo.touchRange(header->ARM7src, header->ARM7binSize);
+
 		u32 src = header->ARM9src;
 		u32 dst = header->ARM9cpy;
 		for(u32 i = 0; i < (header->ARM9binSize>>2); ++i)
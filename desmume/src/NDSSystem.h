@@ -33,6 +33,7 @@
 #include "utils/FileMap.h"
 
 #include <string>
+#include <vector>
 
 #if defined(_WINDOWS)
 #include "pathsettings.h"
@@ -289,6 +290,25 @@ int NDS_Init ( void);
 
 void Desmume_InitOnce();
 
+#ifdef DESMUME_SELFTEST
+//checks the optimized kernels and the savestate codec against their reference versions.
+//returns false (after printing what differed) on the first failure
+bool NDS_SelfTest();
+
+//the self-tests draw their data from this rather than rand(), so they leave the program's
+//random sequence alone and see the same data on every platform. gives 31 bits, like glibc's rand()
+struct SelfTestRandom
+{
+	u64 state;
+	SelfTestRandom(u32 seed) : state(seed) {}
+	u32 operator()()
+	{
+		state = state*6364136223846793005ULL + 1442695040888963407ULL;
+		return (u32)(state>>33);
+	}
+};
+#endif
+
 void NDS_DeInit(void);
 
 BOOL NDS_SetROM(u8 * rom, u32 mask);
@@ -319,6 +339,8 @@ struct RomBanner
   //840h  -    End of Icon/Title structure (next 1C0h bytes usually FFh-filled)
 };
 
+#define ROM_LAZY_BLOCK_SHIFT 16
+
 struct GameInfo
 {
 	GameInfo() :	romdata(NULL),
@@ -328,6 +350,8 @@ struct GameInfo
 					allocatedSize(0),
 					mask(0),
 					filemap(NULL),
+					rommap(NULL),
+					lazyFile(NULL),
 					maxtmpsize(128 * 1024 * 1024)
 	{
 		memset(&header, 0, sizeof(header));
@@ -361,15 +385,21 @@ struct GameInfo
 		memset(romdata+romsize,0xFF,allocatedSize-romsize);
 	}
 
-	void resize(int size) {
-		if (filemap != NULL)
+	void release() {
+		closeLazy();
+		if (rommap != NULL)
 		{
-			filemap->Close();
-			romdata = NULL;
+			delete rommap;
+			rommap = NULL;
 		}
+		else if (filemap != NULL)
+			filemap->Close();
 		else if(romdata != NULL)
 			delete[] romdata;
+		romdata = NULL;
+	}
 
+	void setSize(int size) {
 		//calculate the necessary mask for the requested size
 		mask = size-1; 
 		mask |= (mask >>1);
@@ -381,6 +411,12 @@ struct GameInfo
 		//now, we actually need to over-allocate, because bytes from anywhere protected by that mask
 		//could be read from the rom
 		allocatedSize = mask+4;
+		romsize = size;
+	}
+
+	void resize(int size) {
+		release();
+		setSize(size);
 		if (filemap)
 		{
 			filemap->Open(allocatedSize, allocatedSize > maxtmpsize);
@@ -388,7 +424,42 @@ struct GameInfo
 		}
 		else
 			romdata = new char[allocatedSize];
-		romsize = size;
+	}
+
+	//maps a whole rom file in place of reading it in, already padded like fillGap() would.
+	//its pages stay shared with the page cache (and other instances) until something writes to them
+	bool map(const char* fname, int size) {
+		release();
+		setSize(size);
+		rommap = new FileMap(fname);
+		if (!rommap->Map(size, allocatedSize))
+		{
+			delete rommap;
+			rommap = NULL;
+			return false;
+		}
+		romdata = (char*)rommap->GetPtr();
+		return true;
+	}
+
+	//roms in a block compressed container are read in a block at a time, the first time the block is touched.
+	//anything reading romdata or MMU.CART_ROM past the header and secure area has to touch what it reads first
+	bool openLazy(void *file, int size);
+	void closeLazy();
+	void fetchBlock(u32 block);
+	void touchRange(u32 adr, u32 len);
+	void touchAll() { touchRange(0, romsize); }
+
+	//len may not be more than a block
+	FORCEINLINE void touch(u32 adr, u32 len = 1)
+	{
+		if (lazyFile == NULL) return;
+		const u32 first = adr >> ROM_LAZY_BLOCK_SHIFT;
+		const u32 last = (adr + len - 1) >> ROM_LAZY_BLOCK_SHIFT;
+		if (first < lazyLoaded.size() && !lazyLoaded[first])
+			fetchBlock(first);
+		if (last < lazyLoaded.size() && !lazyLoaded[last])
+			fetchBlock(last);
 	}
 	u32 crc;
 	u32 chipID;
@@ -402,6 +473,9 @@ struct GameInfo
 	u32 allocatedSize;
 	u32 mask;
 	FileMap *filemap;
+	FileMap *rommap; //the rom file itself when it is mapped, see map()
+	void *lazyFile; //the container a lazily read rom is read from, see openLazy()
+	std::vector<u8> lazyLoaded; //whether each block of a lazily read rom has been read in
 	u32 maxtmpsize;
 	const RomBanner& getRomBanner();
 	bool hasRomBanner();
@@ -541,8 +615,12 @@ extern struct TCommonSettings {
 		, GFX3D_LineHack(true)
 		, GFX3D_Zelda_Shadow_Depth_Hack(0)
 		, GFX3D_Renderer_Multisample(false)
+		, GFX3D_Renderer_Upscale(1)
 		, ROM_UseFileMap(false)
+		, ROM_MapFile(false)
 		, jit_max_block_size(100)
+		, io_statistics(0)
+		, poll_wait(false)
 		, UseExtBIOS(false)
 		, SWIFromBIOS(false)
 		, PatchSWI3(false)
@@ -561,6 +639,7 @@ extern struct TCommonSettings {
 		, autodetectBackupMethod(0)
 		, spu_captureMuted(false)
 		, spu_advanced(false)
+		, spu_threaded(false)
 		, StylusPressure(50)
 		, ConsoleType(NDS_CONSOLE_TYPE_FAT)
 		, StylusJitter(false)
@@ -592,8 +671,10 @@ extern struct TCommonSettings {
 	bool GFX3D_LineHack;
 	int  GFX3D_Zelda_Shadow_Depth_Hack;
 	bool GFX3D_Renderer_Multisample;
+	int  GFX3D_Renderer_Upscale; //internal resolution multiplier for the software renderer (1-4), downsampled to the native layer
 
 	bool ROM_UseFileMap;
+	bool ROM_MapFile; //map rom files in place instead of reading them. compressed roms are decompressed once into a cache
 
 	bool UseExtBIOS;
 	char ARM9BIOS[256];
@@ -626,6 +707,13 @@ extern struct TCommonSettings {
 
 	int CpuMode;
 	u32	jit_max_block_size;
+
+	//counting of io register accesses (MMU_ioStats): 0 - off, 1 - print the busiest registers every frame, 2 - print them at exit
+	int io_statistics;
+
+	//moves a cpu polling vcount, dispstat or keyinput in a loop on towards the next event instead of running the loop.
+	//games that count their polls will count fewer of them, so it is off by default
+	bool poll_wait;
 	
 	struct _Wifi {
 		int mode;
@@ -653,6 +741,8 @@ extern struct TCommonSettings {
 	bool spu_muteChannels[16];
 	bool spu_captureMuted;
 	bool spu_advanced;
+	//mix synchronous mode audio on a worker thread from timestamped register writes
+	bool spu_threaded;
 
 	struct _ShowGpu {
 		_ShowGpu() : main(true), sub(true) {}
@@ -418,12 +418,12 @@ static void OGLRender()
 	ENDGL();
 }
 
-static void OGLVramReconfigureSignal()
+static void OGLVramReconfigureSignal(u32 slotMask)
 {
 	if(!BEGINGL())
 		return;
 	
-	_OGLRenderer->VramReconfigureSignal();
+	_OGLRenderer->VramReconfigureSignal(slotMask);
 	
 	ENDGL();
 }
@@ -21,6 +21,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
 #ifdef HAVE_LIBZZIP
 #include <zzip/zzip.h>
 #endif
@@ -34,6 +37,11 @@
 ROMReader_struct * ROMReaderInit(char ** filename)
 {
 #ifdef HAVE_LIBZ
+	if(!strcasecmp(".ndz", *filename + (strlen(*filename) - 4)))
+	{
+		(*filename)[strlen(*filename) - 4] = '\0';
+		return &BLOCKROMReader;
+	}
 	if(!strcasecmp(".gz", *filename + (strlen(*filename) - 3)))
 	{
 		(*filename)[strlen(*filename) - 3] = '\0';
@@ -233,3 +241,270 @@ int ZIPROMReaderRead(void * file, void * buffer, u32 size)
 #endif
 }
 #endif
+
+#ifdef HAVE_LIBZ
+//block compressed rom layout, all little endian u32:
+//"NDZ1", block size shift, rom size, rom crc32, block count, then block count+1 file offsets.
+//a block runs to the next offset, and is stored as is when that is its full uncompressed size
+#define BLOCKROM_MAGIC 0x315A444E
+#define BLOCKROM_HEADER_SIZE 20
+#define BLOCKROM_DEFAULT_SHIFT 16
+#define BLOCKROM_CACHE_BLOCKS 8
+
+struct BLOCKROM_FILE
+{
+	struct CachedBlock
+	{
+		u32 block, lastUse;
+		std::vector<u8> data;
+	};
+
+	FILE *fp;
+	u32 blockShift, blockSize, blockCount;
+	u32 romSize, crc;
+	u32 pos, clock;
+	std::vector<u32> offsets;
+	std::vector<u8> packed;
+	CachedBlock cache[BLOCKROM_CACHE_BLOCKS];
+};
+
+void * BLOCKROMReaderInit(const char * filename);
+void BLOCKROMReaderDeInit(void *);
+u32 BLOCKROMReaderSize(void *);
+int BLOCKROMReaderSeek(void *, int, int);
+int BLOCKROMReaderRead(void *, void *, u32);
+
+ROMReader_struct BLOCKROMReader =
+{
+	ROMREADER_BLOCK,
+	"Block Compressed ROM Reader",
+	BLOCKROMReaderInit,
+	BLOCKROMReaderDeInit,
+	BLOCKROMReaderSize,
+	BLOCKROMReaderSeek,
+	BLOCKROMReaderRead
+};
+
+static bool BLOCKROMRead32(FILE *fp, u32 *val)
+{
+	u8 buf[4];
+	if (fread(buf, 1, 4, fp) != 4) return false;
+	*val = buf[0] | (buf[1]<<8) | (buf[2]<<16) | (buf[3]<<24);
+	return true;
+}
+
+static void BLOCKROMWrite32(FILE *fp, u32 val)
+{
+	u8 buf[4] = { (u8)val, (u8)(val>>8), (u8)(val>>16), (u8)(val>>24) };
+	fwrite(buf, 1, 4, fp);
+}
+
+void * BLOCKROMReaderInit(const char * filename)
+{
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) return NULL;
+
+	BLOCKROM_FILE *rom = new BLOCKROM_FILE();
+	rom->fp = fp;
+	rom->pos = 0;
+	rom->clock = 0;
+
+	u32 magic;
+	bool ok = BLOCKROMRead32(fp, &magic) && magic == BLOCKROM_MAGIC
+		&& BLOCKROMRead32(fp, &rom->blockShift) && rom->blockShift >= 12 && rom->blockShift <= 24
+		&& BLOCKROMRead32(fp, &rom->romSize)
+		&& BLOCKROMRead32(fp, &rom->crc)
+		&& BLOCKROMRead32(fp, &rom->blockCount);
+	if (ok)
+	{
+		rom->blockSize = 1 << rom->blockShift;
+		ok = rom->blockCount == (u32)(((u64)rom->romSize + rom->blockSize - 1) >> rom->blockShift);
+	}
+	if (ok)
+	{
+		rom->offsets.resize(rom->blockCount + 1);
+		for (u32 i = 0; i <= rom->blockCount && ok; i++)
+			ok = BLOCKROMRead32(fp, &rom->offsets[i]) && (i == 0 || rom->offsets[i] >= rom->offsets[i-1]);
+	}
+	if (!ok)
+	{
+		fclose(fp);
+		delete rom;
+		return NULL;
+	}
+
+	for (int i = 0; i < BLOCKROM_CACHE_BLOCKS; i++)
+	{
+		rom->cache[i].block = 0xFFFFFFFF;
+		rom->cache[i].lastUse = 0;
+	}
+
+	return rom;
+}
+
+void BLOCKROMReaderDeInit(void * file)
+{
+	if (!file) return ;
+	BLOCKROM_FILE *rom = (BLOCKROM_FILE*)file;
+	fclose(rom->fp);
+	delete rom;
+}
+
+u32 BLOCKROMReaderSize(void * file)
+{
+	if (!file) return 0 ;
+	return ((BLOCKROM_FILE*)file)->romSize;
+}
+
+u32 BLOCKROMReaderCRC(void * file)
+{
+	if (!file) return 0 ;
+	return ((BLOCKROM_FILE*)file)->crc;
+}
+
+int BLOCKROMReaderSeek(void * file, int offset, int whence)
+{
+	if (!file) return 0 ;
+	BLOCKROM_FILE *rom = (BLOCKROM_FILE*)file;
+
+	s64 pos = offset;
+	if (whence == SEEK_CUR) pos += rom->pos;
+	else if (whence == SEEK_END) pos += rom->romSize;
+	if (pos < 0 || pos > rom->romSize) return -1;
+
+	rom->pos = (u32)pos;
+	return 0;
+}
+
+//the most recently used blocks are kept inflated, since reads tend to come in runs
+static const u8 * BLOCKROMGetBlock(BLOCKROM_FILE *rom, u32 block)
+{
+	BLOCKROM_FILE::CachedBlock *victim = &rom->cache[0];
+	for (int i = 0; i < BLOCKROM_CACHE_BLOCKS; i++)
+	{
+		BLOCKROM_FILE::CachedBlock &cached = rom->cache[i];
+		if (cached.block == block)
+		{
+			cached.lastUse = ++rom->clock;
+			return &cached.data[0];
+		}
+		if (cached.lastUse < victim->lastUse)
+			victim = &cached;
+	}
+
+	const u32 len = std::min(rom->blockSize, rom->romSize - (block << rom->blockShift));
+	const u32 packedLen = rom->offsets[block+1] - rom->offsets[block];
+	victim->block = 0xFFFFFFFF;
+	victim->data.resize(rom->blockSize);
+
+	if (packedLen > len || fseek(rom->fp, rom->offsets[block], SEEK_SET) != 0)
+		return NULL;
+	if (packedLen == len)
+	{
+		if (fread(&victim->data[0], 1, len, rom->fp) != len)
+			return NULL;
+	}
+	else
+	{
+		rom->packed.resize(std::max(packedLen, 1u));
+		if (fread(&rom->packed[0], 1, packedLen, rom->fp) != packedLen)
+			return NULL;
+		uLongf destLen = len;
+		if (uncompress(&victim->data[0], &destLen, &rom->packed[0], packedLen) != Z_OK || destLen != len)
+			return NULL;
+	}
+
+	victim->block = block;
+	victim->lastUse = ++rom->clock;
+	return &victim->data[0];
+}
+
+int BLOCKROMReaderRead(void * file, void * buffer, u32 size)
+{
+	if (!file) return 0 ;
+	BLOCKROM_FILE *rom = (BLOCKROM_FILE*)file;
+
+	u32 done = 0;
+	while (done < size && rom->pos < rom->romSize)
+	{
+		const u32 block = rom->pos >> rom->blockShift;
+		const u32 ofs = rom->pos & (rom->blockSize - 1);
+		const u32 todo = std::min(std::min(size - done, rom->blockSize - ofs), rom->romSize - rom->pos);
+		const u8 *data = BLOCKROMGetBlock(rom, block);
+		if (!data) break;
+		memcpy((u8*)buffer + done, data + ofs, todo);
+		rom->pos += todo;
+		done += todo;
+	}
+	return done;
+}
+
+bool BLOCKROMConvert(const char * src, const char * dst)
+{
+	char *noext = strdup(src);
+	ROMReader_struct *reader = ROMReaderInit(&noext);
+	free(noext);
+
+	void *file = reader->Init(src);
+	if (!file) return false;
+	const u32 romSize = reader->Size(file);
+
+	FILE *out = fopen(dst, "wb");
+	if (!out)
+	{
+		reader->DeInit(file);
+		return false;
+	}
+
+	const u32 blockSize = 1 << BLOCKROM_DEFAULT_SHIFT;
+	const u32 blockCount = (u32)(((u64)romSize + blockSize - 1) >> BLOCKROM_DEFAULT_SHIFT);
+	std::vector<u32> offsets(blockCount + 1);
+	std::vector<u8> block(blockSize), packed(compressBound(blockSize));
+
+	//the crc and index are filled in once the blocks are written
+	fseek(out, BLOCKROM_HEADER_SIZE + (blockCount + 1) * 4, SEEK_SET);
+
+	bool ok = true;
+	u32 crc = 0;
+	u32 offset = BLOCKROM_HEADER_SIZE + (blockCount + 1) * 4;
+	for (u32 i = 0; i < blockCount && ok; i++)
+	{
+		const u32 len = std::min(blockSize, romSize - i * blockSize);
+		if (reader->Read(file, &block[0], len) != (int)len)
+		{
+			ok = false;
+			break;
+		}
+		crc = crc32(crc, &block[0], len);
+
+		uLongf packedLen = packed.size();
+		offsets[i] = offset;
+		if (compress2(&packed[0], &packedLen, &block[0], len, Z_BEST_COMPRESSION) == Z_OK && packedLen < len)
+		{
+			ok = fwrite(&packed[0], 1, packedLen, out) == packedLen;
+			offset += (u32)packedLen;
+		}
+		else
+		{
+			ok = fwrite(&block[0], 1, len, out) == len;
+			offset += len;
+		}
+	}
+	offsets[blockCount] = offset;
+	reader->DeInit(file);
+
+	fseek(out, 0, SEEK_SET);
+	BLOCKROMWrite32(out, BLOCKROM_MAGIC);
+	BLOCKROMWrite32(out, BLOCKROM_DEFAULT_SHIFT);
+	BLOCKROMWrite32(out, romSize);
+	BLOCKROMWrite32(out, crc);
+	BLOCKROMWrite32(out, blockCount);
+	for (u32 i = 0; i <= blockCount; i++)
+		BLOCKROMWrite32(out, offsets[i]);
+
+	if (ferror(out)) ok = false;
+	if (fclose(out) != 0) ok = false;
+	if (!ok) remove(dst);
+	return ok;
+}
+#endif
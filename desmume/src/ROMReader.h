@@ -27,6 +27,7 @@
 #define ROMREADER_STD	0
 #define ROMREADER_GZIP	1
 #define ROMREADER_ZIP	2
+#define ROMREADER_BLOCK	3
 
 typedef struct
 {
@@ -46,5 +47,16 @@ extern ROMReader_struct GZIPROMReader;
 #ifdef HAVE_LIBZZIP
 extern ROMReader_struct ZIPROMReader;
 #endif
+#ifdef HAVE_LIBZ
+//block compressed roms (.ndz) are split into fixed size blocks which are deflated separately and found
+//through an index, so any part of the rom can be read without inflating what comes before it
+extern ROMReader_struct BLOCKROMReader;
+
+//the crc32 of the whole uncompressed rom, which the container stores so it needn't be computed
+u32 BLOCKROMReaderCRC(void * file);
+
+//converts a rom readable by any of the readers into a block compressed rom
+bool BLOCKROMConvert(const char * src, const char * dst);
+#endif
 
 ROMReader_struct * ROMReaderInit(char ** filename);
@@ -21,6 +21,7 @@
 
 
 #define _USE_MATH_DEFINES
+#include <algorithm>
 #include <math.h>
 #ifndef M_PI
 #define M_PI 3.1415926535897932386
@@ -39,6 +40,7 @@
 #include "armcpu.h"
 #include "NDSSystem.h"
 #include "matrix.h"
+#include "utils/task.h"
 
 
 static inline s16 read16(u32 addr) { return (s16)_MMU_read16<ARMCPU_ARM7,MMU_AT_DEBUG>(addr); }
@@ -113,6 +115,30 @@ static const double samples_per_hline = (DESMUME_SAMPLE_RATE / 59.8261f) / 263.0
 
 static double samples = 0;
 
+//a register write waiting to be replayed against SPU_user in threaded mode.
+//time is the number of core samples emitted before the write happened.
+struct SPUCommand
+{
+	u32 time;
+	u32 addr;
+	u32 val;
+	u32 size;
+};
+
+static const u32 SPU_THREAD_BATCH = 512;
+
+static Task spuThread;
+static bool spuThreadStarted = false;
+static bool spuThreadBusy = false;
+static bool spuThreadActive = false;
+static u32 spuThreadClock = 0; //core samples emitted; advanced by the emulator thread
+static u32 spuThreadTarget = 0; //end of the batch handed to the worker
+static u32 spuThreadMixed = 0; //user samples mixed; owned by the worker while it is busy
+static SPSCRing<SPUCommand> spuThreadCommands(14);
+
+static void SPU_ThreadIdle();
+static void SPU_ThreadQueue(u32 addr, u32 val, u32 size);
+
 template<typename T>
 static FORCEINLINE T MinMax(T val, T min, T max)
 {
@@ -132,6 +158,7 @@ int SPU_ChangeSoundCore(int coreid, int buffersize)
 
 	::buffersize = buffersize;
 
+	SPU_ThreadIdle();
 	delete SPU_user; SPU_user = NULL;
 
 	// Make sure the old core is freed
@@ -233,6 +260,7 @@ void SPU_Pause(int pause)
 void SPU_CloneUser()
 {
 	if(SPU_user) {
+		SPU_ThreadIdle();
 		memcpy(SPU_user->channels,SPU_core->channels,sizeof(SPU_core->channels));
 		SPU_user->regs = SPU_core->regs;
 	}
@@ -241,6 +269,7 @@ void SPU_CloneUser()
 
 void SPU_SetSynchMode(int mode, int method)
 {
+	SPU_ThreadIdle();
 	synchmode = (ESynchMode)mode;
 	if(synchmethod != (ESynchMethod)method)
 	{
@@ -259,6 +288,12 @@ void SPU_SetSynchMode(int mode, int method)
 		SPU_user = new SPU_struct(buffersize);
 		SPU_CloneUser();
 	}
+	else if(CommonSettings.spu_threaded)
+	{
+		//in threaded synchronous mode the user spu belongs to the mixing worker
+		SPU_user = new SPU_struct(SPU_THREAD_BATCH);
+		SPU_CloneUser();
+	}
 }
 
 void SPU_ClearOutputBuffer()
@@ -279,10 +314,11 @@ void SPU_Reset(void)
 {
 	int i;
 
+	SPU_ThreadIdle();
 	SPU_core->reset();
 
 	if(SPU_user) {
-		if(SNDCore)
+		if(SNDCore && synchmode == ESynchMode_DualSynchAsynch)
 		{
 			SNDCore->DeInit();
 			SNDCore->Init(SPU_user->bufsize*2);
@@ -337,6 +373,10 @@ SPU_struct::~SPU_struct()
 
 void SPU_DeInit(void)
 {
+	SPU_ThreadIdle();
+	spuThread.shutdown();
+	spuThreadStarted = false;
+
 	if(SNDCore)
 		SNDCore->DeInit();
 	SNDCore = 0;
@@ -750,7 +790,8 @@ void SPU_WriteByte(u32 addr, u8 val)
 	addr &= 0xFFF;
 
 	SPU_core->WriteByte(addr,val);
-	if(SPU_user) SPU_user->WriteByte(addr,val);
+	if(spuThreadActive) SPU_ThreadQueue(addr,val,1);
+	else if(SPU_user) SPU_user->WriteByte(addr,val);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -767,7 +808,8 @@ void SPU_WriteWord(u32 addr, u16 val)
 	addr &= 0xFFF;
 
 	SPU_core->WriteWord(addr,val);
-	if(SPU_user) SPU_user->WriteWord(addr,val);
+	if(spuThreadActive) SPU_ThreadQueue(addr,val,2);
+	else if(SPU_user) SPU_user->WriteWord(addr,val);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -786,7 +828,8 @@ void SPU_WriteLong(u32 addr, u32 val)
 	addr &= 0xFFF;
 
 	SPU_core->WriteLong(addr,val);
-	if(SPU_user) 
+	if(spuThreadActive) SPU_ThreadQueue(addr,val,4);
+	else if(SPU_user) 
 		SPU_user->WriteLong(addr,val);
 }
 
@@ -822,7 +865,43 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE s32 Interpola
 
 //////////////////////////////////////////////////////////////////////////////
 
-template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch8BitData(channel_struct *chan, s32 *data)
+//where a channel's sample data is read from during one mixing span.
+//when the channel's whole source region sits in main memory or arm7 wram (which is where games keep their sounds),
+//the samples are read straight from there; anything more unusual goes through the debug memory accessors as before.
+struct SampleSource
+{
+	const u8 *ptr;
+	u32 addr;
+
+	SampleSource(const channel_struct * const chan)
+		: ptr(NULL)
+		, addr(chan->addr)
+	{
+		if(addr & 3) return;
+
+		//the fetches can read one sample past the end of the channel
+		const u32 len = (chan->totlength<<2) + 4;
+
+		if((addr & 0x0F000000) == 0x02000000)
+		{
+			const u32 ofs = addr & _MMU_MAIN_MEM_MASK;
+			if(ofs + len <= _MMU_MAIN_MEM_MASK + 1)
+				ptr = MMU.MAIN_MEM + ofs;
+		}
+		else if((addr & 0x0F800000) == 0x03800000)
+		{
+			const u32 ofs = addr & 0xFFFF;
+			if(ofs + len <= sizeof(MMU.ARM7_ERAM))
+				ptr = MMU.ARM7_ERAM + ofs;
+		}
+	}
+
+	FORCEINLINE s8 readS8(const u32 ofs) const { return ptr ? (s8)ptr[ofs] : read_s8(addr + ofs); }
+	FORCEINLINE u8 readU8(const u32 ofs) const { return ptr ? ptr[ofs] : read08(addr + ofs); }
+	FORCEINLINE s16 readS16(const u32 ofs) const { return ptr ? (s16)T1ReadWord_guaranteedAligned((void*)ptr, ofs) : read16(addr + ofs); }
+};
+
+template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch8BitData(channel_struct *chan, const SampleSource &src, s32 *data)
 {
 	if (chan->sampcnt < 0)
 	{
@@ -833,18 +912,18 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch8Bi
 	u32 loc = sputrunc(chan->sampcnt);
 	if(INTERPOLATE_MODE != SPUInterpolation_None)
 	{
-		s32 a = (s32)(read_s8(chan->addr + loc) << 8);
+		s32 a = (s32)(src.readS8(loc) << 8);
 		if(loc < (chan->totlength << 2) - 1) {
-			s32 b = (s32)(read_s8(chan->addr + loc + 1) << 8);
+			s32 b = (s32)(src.readS8(loc + 1) << 8);
 			a = Interpolate<INTERPOLATE_MODE>(a, b, chan->sampcnt);
 		}
 		*data = a;
 	}
 	else
-		*data = (s32)read_s8(chan->addr + loc)<< 8;
+		*data = (s32)src.readS8(loc)<< 8;
 }
 
-template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch16BitData(const channel_struct * const chan, s32 *data)
+template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch16BitData(const channel_struct * const chan, const SampleSource &src, s32 *data)
 {
 	if (chan->sampcnt < 0)
 	{
@@ -856,19 +935,19 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void Fetch16B
 	{
 		u32 loc = sputrunc(chan->sampcnt);
 		
-		s32 a = (s32)read16(loc*2 + chan->addr), b;
+		s32 a = (s32)src.readS16(loc*2), b;
 		if(loc < (chan->totlength << 1) - 1)
 		{
-			b = (s32)read16(loc*2 + chan->addr + 2);
+			b = (s32)src.readS16(loc*2 + 2);
 			a = Interpolate<INTERPOLATE_MODE>(a, b, chan->sampcnt);
 		}
 		*data = a;
 	}
 	else
-		*data = read16(chan->addr + sputrunc(chan->sampcnt)*2);
+		*data = src.readS16(sputrunc(chan->sampcnt)*2);
 }
 
-template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADPCMData(channel_struct * const chan, s32 * const data)
+template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADPCMData(channel_struct * const chan, const SampleSource &src, s32 * const data)
 {
 	if (chan->sampcnt < 8)
 	{
@@ -883,7 +962,7 @@ template<SPUInterpolationMode INTERPOLATE_MODE> static FORCEINLINE void FetchADP
 		for (u32 i = chan->lastsampcnt+1; i < endExclusive; i++)
 		{
 			const u32 shift = (i&1)<<2;
-			const u32 data4bit = ((u32)read08(chan->addr + (i>>1))) >> shift;
+			const u32 data4bit = ((u32)src.readU8(i>>1)) >> shift;
 
 			const s32 diff = precalcdifftbl[chan->index][data4bit & 0xF];
 			chan->index = precalcindextbl[chan->index][data4bit & 0x7];
@@ -954,28 +1033,29 @@ static FORCEINLINE void FetchPSGData(channel_struct *chan, s32 *data)
 
 //////////////////////////////////////////////////////////////////////////////
 
-static FORCEINLINE void MixL(SPU_struct* SPU, channel_struct *chan, s32 data)
+static FORCEINLINE void MixL(s32 *out, const channel_struct *chan, s32 data)
 {
 	data = spumuldiv7(data, chan->vol) >> chan->datashift;
-	SPU->sndbuf[SPU->bufpos<<1] += data;
+	out[0] += data;
 }
 
-static FORCEINLINE void MixR(SPU_struct* SPU, channel_struct *chan, s32 data)
+static FORCEINLINE void MixR(s32 *out, const channel_struct *chan, s32 data)
 {
 	data = spumuldiv7(data, chan->vol) >> chan->datashift;
-	SPU->sndbuf[(SPU->bufpos<<1)+1] += data;
+	out[1] += data;
 }
 
-static FORCEINLINE void MixLR(SPU_struct* SPU, channel_struct *chan, s32 data)
+static FORCEINLINE void MixLR(s32 *out, const channel_struct *chan, s32 data)
 {
 	data = spumuldiv7(data, chan->vol) >> chan->datashift;
-	SPU->sndbuf[SPU->bufpos<<1] += spumuldiv7(data, 127 - chan->pan);
-	SPU->sndbuf[(SPU->bufpos<<1)+1] += spumuldiv7(data, chan->pan);
+	out[0] += spumuldiv7(data, 127 - chan->pan);
+	out[1] += spumuldiv7(data, chan->pan);
 }
 
 //////////////////////////////////////////////////////////////////////////////
 
-template<int FORMAT> static FORCEINLINE void TestForLoop(SPU_struct *SPU, channel_struct *chan)
+//these return true when the channel has stopped
+template<int FORMAT> static FORCEINLINE bool TestForLoop(SPU_struct *SPU, channel_struct *chan)
 {
 	const int shift = (FORMAT == 0 ? 2 : 1);
 
@@ -993,12 +1073,13 @@ template<int FORMAT> static FORCEINLINE void TestForLoop(SPU_struct *SPU, channe
 		else
 		{
 			SPU->KeyOff(chan->num);
-			SPU->bufpos = SPU->buflength;
+			return true;
 		}
 	}
+	return false;
 }
 
-static FORCEINLINE void TestForLoop2(SPU_struct *SPU, channel_struct *chan)
+static FORCEINLINE bool TestForLoop2(SPU_struct *SPU, channel_struct *chan)
 {
 	chan->sampcnt += chan->sampinc;
 
@@ -1027,47 +1108,206 @@ static FORCEINLINE void TestForLoop2(SPU_struct *SPU, channel_struct *chan)
 		{
 			chan->status = CHANSTAT_STOPPED;
 			SPU->KeyOff(chan->num);
-			SPU->bufpos = SPU->buflength;
+			return true;
 		}
 	}
+	return false;
 }
 
-template<int CHANNELS> FORCEINLINE static void SPU_Mix(SPU_struct* SPU, channel_struct *chan, s32 data)
+template<int CHANNELS> FORCEINLINE static void SPU_Mix(s32 *out, const channel_struct *chan, s32 data)
 {
 	switch(CHANNELS)
 	{
-		case 0: MixL(SPU, chan, data); break;
-		case 1: MixLR(SPU, chan, data); break;
-		case 2: MixR(SPU, chan, data); break;
+		case 0: MixL(out, chan, data); break;
+		case 1: MixLR(out, chan, data); break;
+		case 2: MixR(out, chan, data); break;
 	}
-	SPU->lastdata = data;
 }
 
+#ifdef ENABLE_SSE2
+//the low 32 bits of a 32x32 multiply (pmulld needs SSE4.1)
+static FORCEINLINE __m128i SPU_mullo32(const __m128i a, const __m128i b)
+{
+	const __m128i even = _mm_mul_epu32(a,b);
+	const __m128i odd = _mm_mul_epu32(_mm_srli_si128(a,4),_mm_srli_si128(b,4));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even,_MM_SHUFFLE(0,0,2,0)),_mm_shuffle_epi32(odd,_MM_SHUFFLE(0,0,2,0)));
+}
+
+//spumuldiv7 on 4 samples
+static FORCEINLINE __m128i SPU_muldiv7(const __m128i val, const u8 multiplier)
+{
+	if(multiplier == 127) return val;
+	return _mm_srai_epi32(SPU_mullo32(val,_mm_set1_epi32(multiplier)),7);
+}
+#endif
+
+//applies a channel's volume, shift and panning to a run of its samples and accumulates them into the stereo output.
+//this gives exactly the same results as SPU_Mix, sample by sample.
+template<int CHANNELS> static void SPU_MixSpan(s32 *out, const channel_struct *chan, const s32 *data, const u32 count)
+{
+	u32 i = 0;
+#ifdef ENABLE_SSE2
+	const __m128i shift = _mm_cvtsi32_si128(chan->datashift);
+	for(; i+4 <= count; i+=4, out+=8)
+	{
+		const __m128i sample = _mm_sra_epi32(SPU_muldiv7(_mm_loadu_si128((const __m128i*)(data+i)),chan->vol),shift);
+		__m128i left, right;
+		switch(CHANNELS)
+		{
+			case 0: left = sample; right = _mm_setzero_si128(); break;
+			case 2: left = _mm_setzero_si128(); right = sample; break;
+			default:
+				left = SPU_muldiv7(sample,127 - chan->pan);
+				right = SPU_muldiv7(sample,chan->pan);
+				break;
+		}
+		_mm_storeu_si128((__m128i*)out, _mm_add_epi32(_mm_loadu_si128((const __m128i*)out),_mm_unpacklo_epi32(left,right)));
+		_mm_storeu_si128((__m128i*)(out+4), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(out+4)),_mm_unpackhi_epi32(left,right)));
+	}
+#endif
+	for(; i < count; i++, out+=2)
+		SPU_Mix<CHANNELS>(out, chan, data[i]);
+}
+
+//applies the master volume and converts the mix to 16 bits with saturation
+static void SPU_MasterVolume(s32 *sndbuf, s16 *outbuf, const u8 vol, const int count)
+{
+	int i = 0;
+#ifdef ENABLE_SSE2
+	for(; i+8 <= count; i+=8)
+	{
+		const __m128i lo = SPU_muldiv7(_mm_loadu_si128((const __m128i*)(sndbuf+i)),vol);
+		const __m128i hi = SPU_muldiv7(_mm_loadu_si128((const __m128i*)(sndbuf+i+4)),vol);
+		_mm_storeu_si128((__m128i*)(sndbuf+i), lo);
+		_mm_storeu_si128((__m128i*)(sndbuf+i+4), hi);
+		_mm_storeu_si128((__m128i*)(outbuf+i), _mm_packs_epi32(lo,hi));
+	}
+#endif
+	for(; i < count; i++)
+	{
+		sndbuf[i] = spumuldiv7(sndbuf[i], vol);
+		outbuf[i] = MinMax(sndbuf[i],-0x8000,0x7FFF);
+	}
+}
+
+#ifdef DESMUME_SELFTEST
+//runs random samples and channel settings through SPU_MixSpan and SPU_MasterVolume and
+//checks them against SPU_Mix and the per-sample master volume code
+bool SPU_SelfTest()
+{
+	static const u32 kCount = 64;
+	static const u8 shifts[] = { 0, 1, 2, 4 };
+	s32 data[kCount], expected[kCount*2], mixed[kCount*2];
+	s16 expected16[kCount*2], mixed16[kCount*2];
+	channel_struct chan;
+
+	SelfTestRandom rng(0x5D5);
+	for(int iteration=0;iteration<1024;iteration++)
+	{
+		chan.vol = rng()&127;
+		chan.pan = rng()&127;
+		chan.datashift = shifts[rng()&3];
+		//odd lengths leave the kernels with every size of tail
+		const u32 count = rng()%(kCount+1);
+		for(u32 i=0;i<count;i++)
+			data[i] = (s32)(rng()&0xFFFF) - 0x8000;
+		for(u32 i=0;i<count*2;i++)
+			expected[i] = mixed[i] = (s32)(rng()&0xFFFFF) - 0x80000;
+
+		for(int channels=0;channels<3;channels++)
+		{
+			for(u32 i=0;i<count;i++)
+			{
+				switch(channels)
+				{
+					case 0: SPU_Mix<0>(expected+i*2, &chan, data[i]); break;
+					case 1: SPU_Mix<1>(expected+i*2, &chan, data[i]); break;
+					case 2: SPU_Mix<2>(expected+i*2, &chan, data[i]); break;
+				}
+			}
+			switch(channels)
+			{
+				case 0: SPU_MixSpan<0>(mixed, &chan, data, count); break;
+				case 1: SPU_MixSpan<1>(mixed, &chan, data, count); break;
+				case 2: SPU_MixSpan<2>(mixed, &chan, data, count); break;
+			}
+			if(memcmp(expected,mixed,count*2*sizeof(s32)) != 0)
+			{
+				printf("SPU_SelfTest: SPU_MixSpan<%d> mixes differently\n",channels);
+				return false;
+			}
+		}
+
+		//the mix now holds values well outside 16 bits, which exercises the saturation
+		const u8 vol = rng()&127;
+		for(u32 i=0;i<count*2;i++)
+		{
+			expected[i] = spumuldiv7(expected[i], vol);
+			expected16[i] = MinMax(expected[i],-0x8000,0x7FFF);
+		}
+		SPU_MasterVolume(mixed, mixed16, vol, count*2);
+		if(memcmp(expected,mixed,count*2*sizeof(s32)) != 0 || memcmp(expected16,mixed16,count*2*sizeof(s16)) != 0)
+		{
+			printf("SPU_SelfTest: SPU_MasterVolume differs\n");
+			return false;
+		}
+	}
+	return true;
+}
+#endif
+
 //WORK
+//generates and mixes one channel over the whole span [bufpos,buflength)
 template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE, int CHANNELS> 
 	FORCEINLINE static void ____SPU_ChanUpdate(SPU_struct* const SPU, channel_struct* const chan)
 {
-	for (; SPU->bufpos < SPU->buflength; SPU->bufpos++)
+	//the source region is resolved once per span rather than once per sample
+	const SampleSource src(chan);
+	s32 *out = SPU->sndbuf + (SPU->bufpos<<1);
+	const u32 buflength = SPU->buflength;
+	s32 data = SPU->lastdata;
+
+	//samples are generated into a chunk buffer, which then gets mixed in one go
+	static const u32 kChunkSize = 256;
+	s32 chunk[kChunkSize];
+
+	bool stopped = false;
+	for (u32 bufpos = SPU->bufpos; bufpos < buflength && !stopped; )
 	{
-		if(CHANNELS != -1)
+		const u32 chunkEnd = std::min(buflength, bufpos + kChunkSize);
+		u32 count = 0;
+
+		while (bufpos < chunkEnd && !stopped)
 		{
-			s32 data;
-			switch(FORMAT)
+			if(CHANNELS != -1)
 			{
-				case 0: Fetch8BitData<INTERPOLATE_MODE>(chan, &data); break;
-				case 1: Fetch16BitData<INTERPOLATE_MODE>(chan, &data); break;
-				case 2: FetchADPCMData<INTERPOLATE_MODE>(chan, &data); break;
-				case 3: FetchPSGData(chan, &data); break;
+				switch(FORMAT)
+				{
+					case 0: Fetch8BitData<INTERPOLATE_MODE>(chan, src, &data); break;
+					case 1: Fetch16BitData<INTERPOLATE_MODE>(chan, src, &data); break;
+					case 2: FetchADPCMData<INTERPOLATE_MODE>(chan, src, &data); break;
+					case 3: FetchPSGData(chan, &data); break;
+				}
+				chunk[count++] = data;
+			}
+
+			switch(FORMAT) {
+				case 0: case 1: stopped = TestForLoop<FORMAT>(SPU, chan); break;
+				case 2: stopped = TestForLoop2(SPU, chan); break;
+				case 3: chan->sampcnt += chan->sampinc; break;
 			}
-			SPU_Mix<CHANNELS>(SPU, chan, data);
+			bufpos++;
 		}
 
-		switch(FORMAT) {
-			case 0: case 1: TestForLoop<FORMAT>(SPU, chan); break;
-			case 2: TestForLoop2(SPU, chan); break;
-			case 3: chan->sampcnt += chan->sampinc; break;
+		if(CHANNELS != -1)
+		{
+			SPU_MixSpan<CHANNELS>(out, chan, chunk, count);
+			out += count<<1;
 		}
 	}
+
+	SPU->bufpos = buflength;
+	SPU->lastdata = data;
 }
 
 template<int FORMAT, SPUInterpolationMode INTERPOLATE_MODE> 
@@ -1368,21 +1608,139 @@ static void SPU_MixAudio(bool actuallyMix, SPU_struct *SPU, int length)
 
 	u8 vol = SPU->regs.mastervol;
 
-	// convert from 32-bit->16-bit
+	// Apply Master Volume and convert from 32-bit->16-bit
 	if(actuallyMix && speakers)
-		for (int i = 0; i < length*2; i++)
+		SPU_MasterVolume(SPU->sndbuf, SPU->outbuf, vol, length*2);
+
+
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+
+//------------------------threaded spu---------------------------------
+//In threaded mode the emulator thread stops mixing altogether. SPU_core keeps stepping unmixed
+//so that register reads stay exact, and every register write is also stamped with the core
+//sample clock and queued for SPU_user. A worker replays those writes at their timestamps while
+//mixing a batch at a time, and feeds the synchronizer itself.
+//Advanced mixing (sound capture, among others) is only done for SPU_core, and recording wants the
+//mixed core output, so either one drains the worker and falls back to mixing on the emulator
+//thread until it is off; SPU_user is recloned from SPU_core afterwards.
+
+static void* SPU_ThreadProc(void*)
+{
+	const u32 target = spuThreadTarget;
+	while(spuThreadMixed != target)
+	{
+		u32 span = target - spuThreadMixed;
+
+		//replay every write stamped at or before the current position,
+		//and stop the span short of the next one
+		while(spuThreadCommands.size() != 0)
 		{
-			// Apply Master Volume
-			SPU->sndbuf[i] = spumuldiv7(SPU->sndbuf[i], vol);
-			s16 outsample = MinMax(SPU->sndbuf[i],-0x8000,0x7FFF);
-			SPU->outbuf[i] = outsample;
+			const SPUCommand &cmd = spuThreadCommands.peek(0);
+			const s32 until = (s32)(cmd.time - spuThreadMixed);
+			if(until > 0)
+			{
+				span = std::min(span,(u32)until);
+				break;
+			}
+			switch(cmd.size)
+			{
+				case 1: SPU_user->WriteByte(cmd.addr,(u8)cmd.val); break;
+				case 2: SPU_user->WriteWord(cmd.addr,(u16)cmd.val); break;
+				default: SPU_user->WriteLong(cmd.addr,cmd.val); break;
+			}
+			spuThreadCommands.skip(1);
 		}
 
+		span = std::min(span,SPU_user->bufsize);
+		SPU_MixAudio(true, SPU_user, span);
+		synchronizer->enqueue_samples(SPU_user->outbuf, span);
+		spuThreadMixed += span;
+	}
+	return NULL;
+}
+
+//hands everything up to the current clock to the worker
+static void SPU_ThreadDispatch()
+{
+	if(spuThreadBusy)
+		spuThread.finish();
+	if(!spuThreadStarted)
+	{
+		spuThread.start(false);
+		spuThreadStarted = true;
+	}
+	spuThreadTarget = spuThreadClock;
+	spuThread.execute(SPU_ThreadProc, NULL);
+	spuThreadBusy = true;
+}
 
+//mixes everything up to the current clock on the calling thread
+static void SPU_ThreadDrain()
+{
+	if(spuThreadBusy)
+	{
+		spuThread.finish();
+		spuThreadBusy = false;
+	}
+	spuThreadTarget = spuThreadClock;
+	SPU_ThreadProc(NULL);
 }
 
-//////////////////////////////////////////////////////////////////////////////
+//stops the worker and drops pending writes; the user spu must be recloned before it runs again
+static void SPU_ThreadIdle()
+{
+	if(spuThreadBusy)
+	{
+		spuThread.finish();
+		spuThreadBusy = false;
+	}
+	spuThreadCommands.clear();
+	spuThreadActive = false;
+}
+
+static void SPU_ThreadQueue(u32 addr, u32 val, u32 size)
+{
+	SPUCommand cmd = { spuThreadClock, addr, val, size };
+	//everything queued is due by now, so draining always makes room
+	while(!spuThreadCommands.push(cmd))
+		SPU_ThreadDrain();
+}
 
+//returns true if the hline was handed to the worker
+static bool SPU_ThreadEmulate()
+{
+	//the advanced mixing path only ever runs on SPU_core (see SPU_MixAudio), so with it on the
+	//output has to come from the core, as does anything being recorded
+	const bool advanced = CommonSettings.spu_advanced;
+	const bool recording = driver->AVI_IsRecording() || driver->WAV_IsRecording();
+
+	if(advanced || recording)
+	{
+		if(spuThreadActive)
+		{
+			SPU_ThreadDrain();
+			SPU_ThreadIdle();
+		}
+		return false;
+	}
+
+	if(!spuThreadActive)
+	{
+		SPU_CloneUser();
+		spuThreadMixed = spuThreadTarget = spuThreadClock;
+		spuThreadActive = true;
+	}
+
+	SPU_MixAudio(false, SPU_core, spu_core_samples);
+	spuThreadClock += spu_core_samples;
+	if(spuThreadClock - spuThreadTarget >= SPU_THREAD_BATCH)
+		SPU_ThreadDispatch();
+
+	return true;
+}
 
 //emulates one hline of the cpu core.
 //this will produce a variable number of samples, calculated to keep a 44100hz output
@@ -1396,6 +1754,9 @@ void SPU_Emulate_core()
 	samples += samples_per_hline;
 	spu_core_samples = (int)(samples);
 	samples -= spu_core_samples;
+
+	if(SPU_user && synchmode == ESynchMode_Synchronous && SPU_ThreadEmulate())
+		return;
 	
 	// We don't need to mix audio for Dual Synch/Asynch mode since we do this
 	// later in SPU_Emulate_user(). Disable mixing here to speed up processing.
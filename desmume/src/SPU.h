@@ -220,6 +220,11 @@ extern int spu_core_samples;
 void spu_savestate(EMUFILE* os);
 bool spu_loadstate(EMUFILE* is, int size);
 
+#ifdef DESMUME_SELFTEST
+//compares the vectorized mixing stages against the per-sample code over random data
+bool SPU_SelfTest();
+#endif
+
 enum WAVMode
 {
 	WAVMODE_ANY = -1,
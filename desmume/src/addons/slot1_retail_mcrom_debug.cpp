@@ -61,6 +61,7 @@ public:
 
 		curr_file_id = 0xFFFF;
 		fpROM = NULL;
+		gameInfo.touchAll();
 		fs = new FS_NITRO(MMU.CART_ROM);
 		fs->rebuildFAT(pathData);
 	}
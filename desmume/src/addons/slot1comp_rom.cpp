@@ -32,6 +32,7 @@ u32 Slot1Comp_Rom::read()
 	{
 	case eSlot1Operation_00_ReadHeader_Unencrypted:
 		{
+			gameInfo.touch(address, 4);
 			u32 ret = T1ReadLong(MMU.CART_ROM, address);
 			address = (address + 4) & 0xFFF;
 			return ret;
@@ -42,6 +43,7 @@ u32 Slot1Comp_Rom::read()
 		{
 			//see B7 for details
 			address &= gameInfo.mask; //sanity check
+			gameInfo.touch(address, 4);
 			u32 ret = T1ReadLong(MMU.CART_ROM, address);
 			address = (address&~0xFFF) + ((address+4)&0xFFF);
 			return ret;
@@ -76,6 +78,7 @@ u32 Slot1Comp_Rom::read()
 			}
 
 			//actually read from the ROM provider
+			gameInfo.touch(address, 4);
 			u32 ret = T1ReadLong(MMU.CART_ROM, address);
 
 			//"However, the datastream wraps to the begin of the current 4K block when address+length crosses a 4K boundary (1000h bytes)"
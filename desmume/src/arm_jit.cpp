@@ -1484,6 +1484,159 @@ static const OpLDR LDRB_tab[2][5]  = { T(OP_LDRB) };
 static const OpLDR LDRSB_tab[2][5]  = { T(OP_LDRSB) };
 #undef T
 
+//-----------------------------------------------------------------------------
+//   Inline memory access
+//-----------------------------------------------------------------------------
+// loads and stores whose first address was main memory or dtcm are emitted inline.
+// the generated code checks that the address is still plain memory in the same 16MB
+// region, accesses host memory directly and only calls the helper otherwise.
+// without advanced timing the access cycles only depend on the region, so they are
+// worked out at compile time; advanced timing needs the bookkeeping in the helpers,
+// so it always takes them. like the ldm/stm helpers, the inline paths skip debug events.
+#define ACCESS_SIGNED 0x100
+
+enum
+{
+	LDR_access = 32, LDRH_access = 16, LDRSH_access = 16|ACCESS_SIGNED, LDRB_access = 8, LDRSB_access = 8|ACCESS_SIGNED,
+	STR_access = 32, STRH_access = 16, STRB_access = 8
+};
+
+template<int PROCNUM, int READSIZE, MMU_ACCESS_DIRECTION DIRECTION>
+static u32 inline_access_cycles(u32 aluCycles, u32 adr)
+{
+	return MMU_aluMemCycles<PROCNUM>(aluCycles, _MMU_accesstime<PROCNUM,MMU_AT_DATA,READSIZE,DIRECTION,false>(adr, true));
+}
+
+typedef u32 (*InlineCycles)(u32, u32);
+#define T(p, size) { inline_access_cycles<p,size,MMU_AD_READ>, inline_access_cycles<p,size,MMU_AD_WRITE> }
+static const InlineCycles inline_cycles_tab[2][3][2] = { { T(0,8), T(0,16), T(0,32) }, { T(1,8), T(1,16), T(1,32) } };
+#undef T
+
+static void emit_test_advanced_timing()
+{
+	GpVar flag = c.newGpVar(kX86VarTypeGpz);
+	c.mov(flag, (uintptr_t)&CommonSettings.advanced_timing);
+	c.test(byte_ptr(flag), 1);
+	c.unuse(flag);
+}
+
+// emits the checks which send an access of the given size at adr to slow, and
+// sets host and ofs so that the memory behind it is at host + ofs.
+// returns false when there is no inline path for the address, in which case nothing was emitted
+static bool emit_inline_access(GpVar adr, u32 adr_first, u32 size, bool store, GpVar &host, GpVar &ofs, Label slow)
+{
+#ifdef WORDS_BIGENDIAN
+	return false;
+#else
+	const u32 memtype = classify_adr(adr_first, store);
+	if(memtype != MEMTYPE_MAIN && memtype != MEMTYPE_DTCM)
+		return false;
+
+	// main memory stores are counted for savestate checkpoints (and clear compiled arm7 code),
+	// so they aren't in the write pages. lua write hooks on main memory are only checked by the helpers
+	const bool main_store = store && memtype == MEMTYPE_MAIN;
+#ifdef HAVE_LUA
+	if(main_store)
+		return false;
+#endif
+
+	JIT_COMMENT("inline %s%u (%s)", store ? "store" : "load", size, memtype == MEMTYPE_MAIN ? "main" : "dtcm");
+	emit_test_advanced_timing();
+	c.jnz(slow);
+
+	GpVar tmp = c.newGpVar(kX86VarTypeGpd);
+	c.mov(tmp, adr);
+	c.and_(tmp, 0x0F000000);
+	c.cmp(tmp, adr_first & 0x0F000000);
+	c.jne(slow);
+
+	host = c.newGpVar(kX86VarTypeGpz);
+	ofs = c.newGpVar(kX86VarTypeGpd);
+	if(main_store)
+	{
+		GpVar mem = c.newGpVar(kX86VarTypeGpz);
+		if(PROCNUM == ARMCPU_ARM9)
+		{
+			c.mov(mem, (uintptr_t)&MMU.DTCMRegion);
+			c.mov(tmp, adr);
+			c.and_(tmp, 0xFFFFC000);
+			c.cmp(tmp, dword_ptr(mem));
+			c.je(slow);
+		}
+		c.mov(mem, (uintptr_t)(size == 32 ? &_MMU_MAIN_MEM_MASK32 : size == 16 ? &_MMU_MAIN_MEM_MASK16 : &_MMU_MAIN_MEM_MASK));
+		c.mov(ofs, adr);
+		c.and_(ofs, dword_ptr(mem));
+		c.unuse(mem);
+		c.mov(host, (uintptr_t)MMU.MAIN_MEM);
+		c.unuse(tmp);
+		return true;
+	}
+
+	// the page tables have main memory, its mirrors and dtcm on top of them as they are mapped right now
+	GpVar page = c.newGpVar(kX86VarTypeGpz);
+	c.mov(tmp, adr);
+	c.and_(tmp, 0x0FFFFFFF);
+	c.shr(tmp, MMU_PAGE_SHIFT);
+	c.shl(tmp, sizeof(MMU_PAGE) == 16 ? 4 : 3);
+	c.mov(page, (uintptr_t)(store ? MMU_writePages[PROCNUM] : MMU_readPages[PROCNUM]));
+	c.mov(host, sysint_ptr(page, tmp.r64(), 0, offsetof(MMU_PAGE, ptr)));
+	c.test(host, host);
+	c.jz(slow);
+	c.mov(ofs, adr);
+	c.and_(ofs, dword_ptr(page, tmp.r64(), 0, offsetof(MMU_PAGE, mask)));
+	if(size > 8)
+		c.and_(ofs, ~((size>>3)-1));
+	c.unuse(page);
+	c.unuse(tmp);
+	return true;
+#endif
+}
+
+// loads into *dst, and sets bb_cycles
+static void emit_load(GpVar adr, GpVar dst, u32 access, u32 adr_first, const OpLDR *tab)
+{
+	const u32 size = access & 0xFF;
+	Label slow = c.newLabel();
+	Label done = c.newLabel();
+	GpVar host, ofs;
+	const bool inline_path = emit_inline_access(adr, adr_first, size, false, host, ofs, slow);
+
+	if(inline_path)
+	{
+		GpVar data = c.newGpVar(kX86VarTypeGpd);
+		if(size == 32)
+			c.mov(data, dword_ptr(host, ofs.r64()));
+		else if(access & ACCESS_SIGNED)
+			c.movsx(data, size == 16 ? word_ptr(host, ofs.r64()) : byte_ptr(host, ofs.r64()));
+		else
+			c.movzx(data, size == 16 ? word_ptr(host, ofs.r64()) : byte_ptr(host, ofs.r64()));
+		if(size == 32)
+		{
+			// misaligned words are rotated, as in OP_LDR
+			GpVar rot = c.newGpVar(kX86VarTypeGpd);
+			c.mov(rot, adr);
+			c.and_(rot, 3);
+			c.shl(rot, 3);
+			c.ror(data, rot.r8Lo());
+			c.unuse(rot);
+		}
+		c.mov(dword_ptr(dst), data);
+		c.unuse(data);
+		c.mov(bb_cycles, inline_cycles_tab[PROCNUM][size>>4][0](3, adr_first));
+		c.jmp(done);
+		c.bind(slow);
+	}
+
+	X86CompilerFuncCall *ctx = c.call((void*)tab[classify_adr(adr_first,0)]);
+	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<u32, u32, u32*>());
+	ctx->setArgument(0, adr);
+	ctx->setArgument(1, dst);
+	ctx->setReturn(bb_cycles);
+
+	if(inline_path)
+		c.bind(done);
+}
+
 static u32 add(u32 lhs, u32 rhs) { return lhs + rhs; }
 static u32 sub(u32 lhs, u32 rhs) { return lhs - rhs; }
 
@@ -1511,11 +1664,7 @@ static u32 sub(u32 lhs, u32 rhs) { return lhs - rhs; }
 		} \
 	} \
 	u32 adr_first = sign_op(cpu->R[REG_POS(i,16)], rhs_first); \
-	X86CompilerFuncCall *ctx = c.call((void*)mem_op##_tab[PROCNUM][classify_adr(adr_first,0)]); \
-	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<u32, u32, u32*>()); \
-	ctx->setArgument(0, adr); \
-	ctx->setArgument(1, dst); \
-	ctx->setReturn(bb_cycles); \
+	emit_load(adr, dst, mem_op##_access, adr_first, mem_op##_tab[PROCNUM]); \
 	if(REG_POS(i,12)==15) \
 	{ \
 		GpVar tmp = c.newGpVar(kX86VarTypeGpd); \
@@ -1679,6 +1828,68 @@ static const OpSTR STRH_tab[2][3]  = { T(OP_STRH) };
 static const OpSTR STRB_tab[2][3]  = { T(OP_STRB) };
 #undef T
 
+// stores data, and sets bb_cycles
+static void emit_store(GpVar adr, GpVar data, u32 access, u32 adr_first, const OpSTR *tab)
+{
+	const u32 size = access & 0xFF;
+	Label slow = c.newLabel();
+	Label done = c.newLabel();
+	GpVar host, ofs;
+	const bool inline_path = emit_inline_access(adr, adr_first, size, true, host, ofs, slow);
+
+	if(inline_path)
+	{
+		if(classify_adr(adr_first,1) == MEMTYPE_MAIN)
+		{
+			// MMU_MAINnoteWrite
+			GpVar gen = c.newGpVar(kX86VarTypeGpz);
+			GpVar idx = c.newGpVar(kX86VarTypeGpd);
+			c.mov(gen, (uintptr_t)main_mem_page_generation);
+			c.mov(idx, ofs);
+			c.shr(idx, MAIN_MEM_GENERATION_SHIFT);
+			c.add(dword_ptr(gen, idx.r64(), 2), 1);
+			if(PROCNUM == ARMCPU_ARM7)
+			{
+				// the compiled code for the written halfwords, as _MMU_write32 clears it
+#ifdef MAPPED_JIT_FUNCS
+				c.mov(gen, (uintptr_t)g_JitLut.MAIN_MEM);
+				c.mov(idx, ofs);
+#else
+				c.mov(gen, (uintptr_t)g_CompiledFuncs);
+				c.mov(idx, adr);
+				c.and_(idx, 0x07FFFFFE);
+#endif
+				c.shr(idx, 1);
+				c.mov(sysint_ptr(gen, idx.r64(), sizeof(uintptr_t) == 8 ? 3 : 2), 0);
+#ifdef MAPPED_JIT_FUNCS
+				if(size == 32)
+					c.mov(sysint_ptr(gen, idx.r64(), sizeof(uintptr_t) == 8 ? 3 : 2, sizeof(uintptr_t)), 0);
+#endif
+			}
+			c.unuse(idx);
+			c.unuse(gen);
+		}
+		if(size == 32)
+			c.mov(dword_ptr(host, ofs.r64()), data);
+		else if(size == 16)
+			c.mov(word_ptr(host, ofs.r64()), data.r16());
+		else
+			c.mov(byte_ptr(host, ofs.r64()), data.r8Lo());
+		c.mov(bb_cycles, inline_cycles_tab[PROCNUM][size>>4][1](2, adr_first));
+		c.jmp(done);
+		c.bind(slow);
+	}
+
+	X86CompilerFuncCall *ctx = c.call((void*)tab[classify_adr(adr_first,1)]);
+	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<u32, u32, u32>());
+	ctx->setArgument(0, adr);
+	ctx->setArgument(1, data);
+	ctx->setReturn(bb_cycles);
+
+	if(inline_path)
+		c.bind(done);
+}
+
 #define OP_STR_(mem_op, arg, sign_op, writeback) \
 	GpVar adr = c.newGpVar(kX86VarTypeGpd); \
 	GpVar data = c.newGpVar(kX86VarTypeGpd); \
@@ -1703,11 +1914,7 @@ static const OpSTR STRB_tab[2][3]  = { T(OP_STRB) };
 		} \
 	} \
 	u32 adr_first = sign_op(cpu->R[REG_POS(i,16)], rhs_first); \
-	X86CompilerFuncCall *ctx = c.call((void*)mem_op##_tab[PROCNUM][classify_adr(adr_first,1)]); \
-	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<u32, u32, u32>()); \
-	ctx->setArgument(0, adr); \
-	ctx->setArgument(1, data); \
-	ctx->setReturn(bb_cycles); \
+	emit_store(adr, data, mem_op##_access, adr_first, mem_op##_tab[PROCNUM]); \
 	return 1;
 
 static int OP_STR_P_IMM_OFF(const u32 i) { OP_STR_(STR, IMM_OFF_12, add, 0); }
@@ -2014,7 +2221,7 @@ static LDM_INLINE u32 FASTCALL OP_LDM_STM_other(u32 adr, u64 regs, int n)
 	do {
 		if(PROCNUM==ARMCPU_ARM9)
 			if(store) _MMU_ARM9_write32(adr, cpu->R[regs&0xF]);
-			else cpu->R[regs&0xF] = _MMU_ARM9_read32(adr);
+			else { MMU_mathPollRead(ARMCPU_ARM9, MMU_AT_DATA, adr); cpu->R[regs&0xF] = _MMU_ARM9_read32(adr); }
 		else
 			if(store) _MMU_ARM7_write32(adr, cpu->R[regs&0xF]);
 			else cpu->R[regs&0xF] = _MMU_ARM7_read32(adr);
@@ -2089,6 +2296,12 @@ static u32 OP_LDM_STM(u32 adr, u64 regs, int n)
 	{
 		ptr = MMU.MAIN_MEM + (adr & _MMU_MAIN_MEM_MASK32);
 		cycles = n * ((PROCNUM==ARMCPU_ARM9) ? 4 : 2);
+		if(store)
+		{
+			// at most 16 words inside one 16KB page, so the span touches two 4KB pages at most
+			MMU_MAINnoteWrite(adr & _MMU_MAIN_MEM_MASK32);
+			MMU_MAINnoteWrite((adr + dir*(n-1)*4) & _MMU_MAIN_MEM_MASK32);
+		}
 	}
 	else if(PROCNUM==ARMCPU_ARM7 && !store && (adr & 0xFF800000) == 0x03800000)
 	{
@@ -2414,6 +2627,21 @@ static void maskPrecalc(u32 _num)
 	ctxM->setArgument(0, _num); \
 }
 
+// moves dtcm like armcp15_t::moveARM2CP does: the page tables of the old and new 16KB get rebuilt
+// and the compiled code is flushed through the active cpu core, since it may have been compiled against the old region
+static void setDTCMRegion(u32 val)
+{
+	u32 DTCMRegion_old = MMU.DTCMRegion;
+	MMU.DTCMRegion = cp15.DTCMRegion = val & 0x0FFFF000;
+	if (DTCMRegion_old != MMU.DTCMRegion)
+	{
+		MMU_PagesRefresh(DTCMRegion_old & ~0x3FFF, (DTCMRegion_old & ~0x3FFF) + 0x4000);
+		MMU_PagesRefresh(MMU.DTCMRegion & ~0x3FFF, (MMU.DTCMRegion & ~0x3FFF) + 0x4000);
+		if (arm_cpubase)
+			arm_cpubase->Clear[ARMCPU_ARM9](0, CPUBASE_FLUSHALL);
+	}
+}
+
 static int OP_MCR(const u32 i)
 {
 	if (PROCNUM == ARMCPU_ARM7) return 0;
@@ -2577,11 +2805,9 @@ static int OP_MCR(const u32 i)
 							case 0:
 								{
 									//MMU.DTCMRegion = DTCMRegion = val & 0x0FFFF000;
-									c.and_(data, 0x0FFFF000);
-									GpVar bb_mmu = c.newGpVar(kX86VarTypeGpz);
-									c.mov(bb_mmu, (uintptr_t)&MMU);
-									c.mov(mmu_ptr(DTCMRegion), data);
-									c.mov(cp15_ptr(DTCMRegion), data);
+									X86CompilerFuncCall* ctxD = c.call((uintptr_t)setDTCMRegion);
+									ctxD->setPrototype(kX86FuncConvDefault, FuncBuilder1<Void, u32>());
+									ctxD->setArgument(0, data);
 								}
 								break;
 							case 1:
@@ -3393,11 +3619,7 @@ static int OP_TST(const u32 i)
 		adr_first += cpu->R[_REG_NUM(i, 6)]; \
 	} \
 	c.mov(data, reg_pos_thumb(0)); \
-	X86CompilerFuncCall *ctx = c.call((void*)mem_op##_tab[PROCNUM][classify_adr(adr_first,1)]); \
-	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<Void, u32, u32>()); \
-	ctx->setArgument(0, addr); \
-	ctx->setArgument(1, data); \
-	ctx->setReturn(bb_cycles); \
+	emit_store(addr, data, mem_op##_access, adr_first, mem_op##_tab[PROCNUM]); \
 	return 1;
 
 #define LDR_THUMB(mem_op, offset) \
@@ -3420,11 +3642,7 @@ static int OP_TST(const u32 i)
 		adr_first += cpu->R[_REG_NUM(i, 6)]; \
 	} \
 	c.lea(data, reg_pos_thumb(0)); \
-	X86CompilerFuncCall *ctx = c.call((void*)mem_op##_tab[PROCNUM][classify_adr(adr_first,0)]); \
-	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<Void, u32, u32*>()); \
-	ctx->setArgument(0, addr); \
-	ctx->setArgument(1, data); \
-	ctx->setReturn(bb_cycles); \
+	emit_load(addr, data, mem_op##_access, adr_first, mem_op##_tab[PROCNUM]); \
 	return 1;
 
 static int OP_STRB_IMM_OFF(const u32 i) { STR_THUMB(STRB, ((i>>6)&0x1F)); }
@@ -3454,11 +3672,7 @@ static int OP_STR_SPREL(const u32 i)
 	if (imm) c.add(addr, imm);
 	GpVar data = c.newGpVar(kX86VarTypeGpd);
 	c.mov(data, reg_pos_thumb(8));
-	X86CompilerFuncCall *ctx = c.call((void*)STR_tab[PROCNUM][classify_adr(adr_first,1)]);
-	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<Void, u32, u32>());
-	ctx->setArgument(0, addr);
-	ctx->setArgument(1, data);
-	ctx->setReturn(bb_cycles);
+	emit_store(addr, data, STR_access, adr_first, STR_tab[PROCNUM]);
 	return 1;
 }
 
@@ -3472,11 +3686,7 @@ static int OP_LDR_SPREL(const u32 i)
 	if (imm) c.add(addr, imm);
 	GpVar data = c.newGpVar(kX86VarTypeGpz);
 	c.lea(data, reg_pos_thumb(8));
-	X86CompilerFuncCall *ctx = c.call((void*)LDR_tab[PROCNUM][classify_adr(adr_first,0)]);
-	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<Void, u32, u32*>());
-	ctx->setArgument(0, addr);
-	ctx->setArgument(1, data);
-	ctx->setReturn(bb_cycles);
+	emit_load(addr, data, LDR_access, adr_first, LDR_tab[PROCNUM]);
 	return 1;
 }
 
@@ -3488,11 +3698,7 @@ static int OP_LDR_PCREL(const u32 i)
 	GpVar data = c.newGpVar(kX86VarTypeGpz);
 	c.mov(addr, adr_first);
 	c.lea(data, reg_pos_thumb(8));
-	X86CompilerFuncCall *ctx = c.call((void*)LDR_tab[PROCNUM][classify_adr(adr_first,0)]);
-	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<Void, u32, u32*>());
-	ctx->setArgument(0, addr);
-	ctx->setArgument(1, data);
-	ctx->setReturn(bb_cycles);
+	emit_load(addr, data, LDR_access, adr_first, LDR_tab[PROCNUM]);
 	return 1;
 }
 
@@ -3941,6 +4147,70 @@ static void _armlog(u8 proc, u32 addr, u32 opcode)
 #endif
 }
 
+//-----------------------------------------------------------------------------
+//   Code fetch timing
+//-----------------------------------------------------------------------------
+// with advanced timing, an arm9 instruction costs max(execute, fetch) cycles.
+// a block is straight-line code, so where each of its fetches comes from is known
+// when it is compiled: itcm fetches and fetches from a main memory line already
+// fetched earlier in the block never exceed the execute time, and the other
+// regions aren't cached, so their sequential fetches have a fixed cost.
+// only the first fetch of a block and the first fetch of each main memory line
+// depend on the cache and have to be probed at run time.
+template<int READSIZE>
+static u32 FASTCALL arm9_fetch_penalty(u32 adr, u32 executeCycles)
+{
+	const u32 fetchCycles = MMU_codeFetchCycles<ARMCPU_ARM9,READSIZE>(adr);
+	return MMU_fetchExecuteCycles<ARMCPU_ARM9>(executeCycles, fetchCycles) - executeCycles;
+}
+
+static void emit_fetch_probe(u32 adr, u32 executeCycles)
+{
+	JIT_COMMENT("fetch probe (%08X)", adr);
+	Label skip = c.newLabel();
+	emit_test_advanced_timing();
+	c.jz(skip);
+	GpVar arg_adr = c.newGpVar(kX86VarTypeGpd);
+	GpVar arg_cycles = c.newGpVar(kX86VarTypeGpd);
+	GpVar penalty = c.newGpVar(kX86VarTypeGpz);
+	c.mov(arg_adr, adr);
+	c.mov(arg_cycles, executeCycles);
+	X86CompilerFuncCall* ctx = c.call(bb_thumb ? (void*)arm9_fetch_penalty<16> : (void*)arm9_fetch_penalty<32>);
+	ctx->setPrototype(ASMJIT_CALL_CONV, FuncBuilder2<u32, u32, u32>());
+	ctx->setArgument(0, arg_adr);
+	ctx->setArgument(1, arg_cycles);
+	ctx->setReturn(penalty);
+	c.add(bb_total_cycles, penalty);
+	c.bind(skip);
+}
+
+// returns the fetch cycles of the instruction at adr that are known at compile time,
+// or emits a probe for them. lastLine is the main memory line fetched last in this block.
+static u32 compile_fetch_cycles(u32 adr, u32 executeCycles, bool first, u32 &lastLine)
+{
+	if(adr < 0x02000000)
+		return 0; // ITCM
+
+	if((adr & 0x0F000000) == 0x02000000)
+	{
+		if(!first && (adr & ~31) == lastLine)
+			return 0;
+		lastLine = adr & ~31;
+		emit_fetch_probe(adr, executeCycles);
+		return 0;
+	}
+
+	lastLine = ~0;
+	if(first)
+	{
+		emit_fetch_probe(adr, executeCycles);
+		return 0;
+	}
+	const u32 fetchCycles = bb_thumb ? _MMU_accesstime<ARMCPU_ARM9,MMU_AT_CODE,16,MMU_AD_READ,true>(adr, true)
+	                                 : _MMU_accesstime<ARMCPU_ARM9,MMU_AT_CODE,32,MMU_AD_READ,true>(adr, true);
+	return std::max(executeCycles, fetchCycles) - executeCycles;
+}
+
 template<int PROCNUM>
 static u32 compile_basicblock()
 {
@@ -3985,6 +4255,8 @@ static u32 compile_basicblock()
 #endif
 
 	bb_constant_cycles = 0;
+	u32 fetch_cycles = 0;
+	u32 fetch_line = ~0;
 	for(u32 i=0, bEndBlock = 0; bEndBlock == 0; i++)
 	{
 		bb_adr = start_adr + (i * bb_opcodesize);
@@ -4016,6 +4288,9 @@ static u32 compile_basicblock()
 
 		JIT_COMMENT("%s (PC:%08X)", disassemble(opcode), bb_adr);
 
+		if(PROCNUM == ARMCPU_ARM9)
+			fetch_cycles += compile_fetch_cycles(bb_adr, (instr_is_conditional(opcode) || cycles == 0) ? 1 : cycles, i == 0, fetch_line);
+
 #if (PROFILER_JIT_LEVEL > 0)
 		JIT_COMMENT("*** profiler - counter");
 		if (bb_thumb)
@@ -4076,6 +4351,16 @@ static u32 compile_basicblock()
 	if (bb_constant_cycles > 0)
 		c.add(bb_total_cycles, bb_constant_cycles);
 
+	if (fetch_cycles > 0)
+	{
+		JIT_COMMENT("fetch cycles (%d)", fetch_cycles);
+		Label skip = c.newLabel();
+		emit_test_advanced_timing();
+	c.jz(skip);
+		c.add(bb_total_cycles, fetch_cycles);
+		c.bind(skip);
+	}
+
 #if (PROFILER_JIT_LEVEL > 1)
 	JIT_COMMENT("*** profiler - cycles");
 	u32 padr = ((start_adr & 0x07FFFFFE) >> 1);
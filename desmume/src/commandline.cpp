@@ -20,12 +20,15 @@
 #include <glib.h>
 #include <algorithm>
 #include <stdio.h>
+#include <stdlib.h>
 #include "commandline.h"
 #include "types.h"
 #include "movie.h"
 #include "addons.h"
 #include "slot1.h"
 #include "NDSSystem.h"
+#include "saves.h"
+#include "ROMReader.h"
 #include "utils/xstring.h"
 
 int _scanline_filter_a = 0, _scanline_filter_b = 2, _scanline_filter_c = 2, _scanline_filter_d = 4;
@@ -44,13 +47,24 @@ CommandLine::CommandLine()
 , _bios_arm7(NULL)
 , _bios_swi(0)
 , _spu_advanced(0)
+, _spu_threaded(0)
 , _num_cores(-1)
+, _savestate_codec(-1)
+, _movie_keyframe_interval(0)
+, _rom_map_file(0)
+, _convert_rom(NULL)
+, _softrast_scale(-1)
 , _rigorous_timing(0)
 , _advanced_timing(-1)
 , _slot1(NULL)
 , _slot1_fat_dir(NULL)
 , _cpu_mode(-1)
 , _jit_size(-1)
+, _io_stats(-1)
+, _poll_wait(-1)
+#ifdef DESMUME_SELFTEST
+, _self_test(0)
+#endif
 , _console_type(NULL)
 , depth_threshold(-1)
 , load_slot(-1)
@@ -89,7 +103,13 @@ void CommandLine::loadCommonOptions()
 		{ "bios-arm7", 0, 0, G_OPTION_ARG_FILENAME, &_bios_arm7, "Uses the arm7 bios provided at the specified path", "BIOS_ARM7_PATH"},
 		{ "bios-swi", 0, 0, G_OPTION_ARG_INT, &_bios_swi, "Uses SWI from the provided bios files", "BIOS_SWI"},
 		{ "spu-advanced", 0, 0, G_OPTION_ARG_INT, &_spu_advanced, "Uses advanced SPU capture functions", "SPU_ADVANCED"},
+		{ "spu-threaded", 0, 0, G_OPTION_ARG_INT, &_spu_threaded, "Mixes synchronous mode audio on a separate thread", "SPU_THREADED"},
 		{ "num-cores", 0, 0, G_OPTION_ARG_INT, &_num_cores, "Override numcores detection and use this many", "NUM_CORES"},
+		{ "rom-map-file", 0, 0, G_OPTION_ARG_INT, &_rom_map_file, "Maps the rom file in place instead of reading it; compressed roms are decompressed once into a cache", "ROM_MAP_FILE"},
+		{ "convert-rom", 0, 0, G_OPTION_ARG_FILENAME, &_convert_rom, "Converts the given rom to a block compressed .ndz rom at this path, then exits", "CONVERT_ROM"},
+		{ "savestate-codec", 0, 0, G_OPTION_ARG_INT, &_savestate_codec, "Compresses savestates with 0 = none, 1 = zlib, 2 = fast lz (default 1)", "SAVESTATE_CODEC"},
+		{ "movie-keyframe-interval", 0, 0, G_OPTION_ARG_INT, &_movie_keyframe_interval, "Keep a savestate in the movie every this many frames, for seeking in binary movies (default 0, none)", "MOVIE_KEYFRAME_INTERVAL"},
+		{ "softrast-scale", 0, 0, G_OPTION_ARG_INT, &_softrast_scale, "Supersample 3D with the software renderer: render at this multiple of the native resolution and scale down, 1-4 (default 1)", "SOFTRAST_SCALE"},
 		{ "scanline-filter-a", 0, 0, G_OPTION_ARG_INT, &_scanline_filter_a, "Intensity of fadeout for scanlines filter (topleft) (default 0)", "SCANLINE_FILTER_A"},
 		{ "scanline-filter-b", 0, 0, G_OPTION_ARG_INT, &_scanline_filter_b, "Intensity of fadeout for scanlines filter (topright) (default 2)", "SCANLINE_FILTER_B"},
 		{ "scanline-filter-c", 0, 0, G_OPTION_ARG_INT, &_scanline_filter_c, "Intensity of fadeout for scanlines filter (bottomleft) (default 2)", "SCANLINE_FILTER_C"},
@@ -102,6 +122,8 @@ void CommandLine::loadCommonOptions()
 		{ "console-type", 0, 0, G_OPTION_ARG_STRING, &_console_type, "Select console type: {fat,lite,ique,debug,dsi}", "CONSOLETYPE" },
 		{ "cpu-mode", 0, 0, G_OPTION_ARG_INT, &_cpu_mode, "ARM CPU emulation mode: 0 - interpreter, 1 - thread interpreter, 2 - dynarec (default 1)", NULL},
 		{ "jit-size", 0, 0, G_OPTION_ARG_INT, &_jit_size, "ARM JIT block size: 1..100 (1 - accuracy, 100 - faster) (default 100)", NULL},
+		{ "poll-wait", 0, 0, G_OPTION_ARG_INT, &_poll_wait, "Skip ahead cpus polling vcount, dispstat or keyinput in a loop (default 0)", "POLL_WAIT"},
+		{ "io-stats", 0, 0, G_OPTION_ARG_INT, &_io_stats, "Count io register accesses and print the busiest: 0 - off, 1 - every frame, 2 - at exit (default 0)", "IO_STATS"},
 #ifndef _MSC_VER
 		{ "disable-sound", 0, 0, G_OPTION_ARG_NONE, &disable_sound, "Disables the sound emulation", NULL},
 		{ "disable-limiter", 0, 0, G_OPTION_ARG_NONE, &disable_limiter, "Disables the 60fps limiter", NULL},
@@ -110,6 +132,9 @@ void CommandLine::loadCommonOptions()
 #ifdef GDB_STUB
 		{ "arm9gdb", 0, 0, G_OPTION_ARG_INT, &arm9_gdb_port, "Enable the ARM9 GDB stub on the given port", "PORT_NUM"},
 		{ "arm7gdb", 0, 0, G_OPTION_ARG_INT, &arm7_gdb_port, "Enable the ARM7 GDB stub on the given port", "PORT_NUM"},
+#endif
+#ifdef DESMUME_SELFTEST
+		{ "self-test", 0, 0, G_OPTION_ARG_NONE, &_self_test, "Checks the optimized code paths against their reference versions, then exits", NULL},
 #endif
 		{ "autodetect_method", 0, 0, G_OPTION_ARG_INT, &autodetect_method, "Autodetect backup method (0 - internal, 1 - from database)", "AUTODETECT_METHOD"},
 		{ NULL }
@@ -146,6 +171,9 @@ bool CommandLine::parse(int argc,char **argv)
 	if(_gbaslot_rom) gbaslot_rom = _gbaslot_rom;
 
 	if(_num_cores != -1) CommonSettings.num_cores = _num_cores;
+	if(_savestate_codec >= SAVESTATE_CODEC_NONE && _savestate_codec <= SAVESTATE_CODEC_FAST) savestate_codec = _savestate_codec;
+	if(_movie_keyframe_interval > 0) movie_keyframe_interval = _movie_keyframe_interval;
+	if(_softrast_scale != -1) CommonSettings.GFX3D_Renderer_Upscale = _softrast_scale;
 	if(_rigorous_timing) CommonSettings.rigorous_timing = true;
 	if(_advanced_timing != -1) CommonSettings.advanced_timing = _advanced_timing==1;
 	if(_cpu_mode != -1) CommonSettings.CpuMode = _cpu_mode;
@@ -156,6 +184,8 @@ bool CommandLine::parse(int argc,char **argv)
 		else
 			CommonSettings.jit_max_block_size = _jit_size;
 	}
+	if(_io_stats >= 0 && _io_stats <= 2) CommonSettings.io_statistics = _io_stats;
+	if(_poll_wait != -1) CommonSettings.poll_wait = _poll_wait==1;
 	if(depth_threshold != -1)
 		CommonSettings.GFX3D_Zelda_Shadow_Depth_Hack = depth_threshold;
 
@@ -183,12 +213,44 @@ bool CommandLine::parse(int argc,char **argv)
 	if(_bios_arm7) { CommonSettings.UseExtBIOS = true; strcpy(CommonSettings.ARM7BIOS,_bios_arm7); }
 	if(_bios_swi) CommonSettings.SWIFromBIOS = true;
 	if(_spu_advanced) CommonSettings.spu_advanced = true;
+	if(_spu_threaded) CommonSettings.spu_threaded = true;
+	if(_rom_map_file) CommonSettings.ROM_MapFile = true;
 
 	if (argc == 2)
 		nds_file = argv[1];
 	if (argc > 2)
 		return false;
 
+	if(_convert_rom)
+	{
+#ifdef HAVE_LIBZ
+		if(nds_file == "")
+		{
+			g_printerr("Need to specify a rom to convert.\n");
+			exit(1);
+		}
+		if(!BLOCKROMConvert(nds_file.c_str(), _convert_rom))
+		{
+			g_printerr("Failed to convert %s to %s\n", nds_file.c_str(), _convert_rom);
+			exit(1);
+		}
+		printf("Converted %s to %s\n", nds_file.c_str(), _convert_rom);
+		exit(0);
+#else
+		g_printerr("Block compressed roms need zlib support.\n");
+		exit(1);
+#endif
+	}
+
+#ifdef DESMUME_SELFTEST
+	if(_self_test)
+	{
+		const bool ok = NDS_SelfTest();
+		printf("Self-test %s\n", ok ? "passed" : "failed");
+		exit(ok ? 0 : 1);
+	}
+#endif
+
 	return true;
 }
 
@@ -204,6 +266,11 @@ bool CommandLine::validate()
 		}
 	}
 
+	if (_softrast_scale != -1 && (_softrast_scale < 1 || _softrast_scale > 4)) {
+		g_printerr("Invalid softrast-scale value specified, must be 1-4.\n");
+		return false;
+	}
+
 	if (load_slot < -1 || load_slot > 10) {
 		g_printerr("I only know how to load from slots 0-10; -1 means 'do not load savegame' and is default\n");
 		return false;
@@ -87,11 +87,22 @@ private:
 	char* _bios_arm9, *_bios_arm7;
 	int _bios_swi;
 	int _spu_advanced;
+	int _spu_threaded;
 	int _num_cores;
+	int _savestate_codec;
+	int _movie_keyframe_interval;
+	int _rom_map_file;
+	char* _convert_rom;
+	int _softrast_scale;
 	int _rigorous_timing;
 	int _advanced_timing;
 	int _cpu_mode;
 	int _jit_size;
+	int _io_stats;
+	int _poll_wait;
+#ifdef DESMUME_SELFTEST
+	int _self_test;
+#endif
 	char* _slot1;
 	char *_slot1_fat_dir;
 	char* _console_type;
@@ -132,8 +132,25 @@ void armcp15_t::setSingleRegionAccess(u8 num, u32 mask, u32 set) {
 			regionExecuteSet_SYS[num] = set ;
 			break ;
 	}
+	setRegionBounds(num, mask, set) ;
 } ;
 
+/* the region's mask/set for regionAt, and which access types the precalculated sets leave it */
+void armcp15_t::setRegionBounds(u8 num, u32 mask, u32 set)
+{
+	const u32 *sets[6] = { regionWriteSet_USR, regionWriteSet_SYS, regionReadSet_USR,
+	                       regionReadSet_SYS, regionExecuteSet_USR, regionExecuteSet_SYS } ;
+
+	regionMask[num] = mask ;
+	regionSet[num] = set ;
+
+	/* a denied access type has its set at 0xFFFFFFFF, which no allowed region's set can be */
+	u8 allowed = 0 ;
+	for (int access=0;access<6;access++)
+		if (sets[access][num] != 0xFFFFFFFF) allowed |= 1 << access ;
+	regionAllowed[num] = allowed ;
+}
+
 /* precalculate region masks/sets from cp15 register */
 void armcp15_t::maskPrecalc()
 {
@@ -163,31 +180,12 @@ void armcp15_t::maskPrecalc()
 
 BOOL armcp15_t::isAccessAllowed(u32 address,u32 access)
 {
-	int i ;
+	u32 region ;
 	if (!(ctrl & 1)) return TRUE ;        /* protection checking is not enabled */
-	for (i=0;i<8;i++) {
-		switch (access) {
-		case CP15_ACCESS_WRITEUSR:
-			if ((address & regionWriteMask_USR[i]) == regionWriteSet_USR[i]) return TRUE ;
-			break ;
-		case CP15_ACCESS_WRITESYS:
-			if ((address & regionWriteMask_SYS[i]) == regionWriteSet_SYS[i]) return TRUE ;
-			break ;
-		case CP15_ACCESS_READUSR:
-			if ((address & regionReadMask_USR[i]) == regionReadSet_USR[i]) return TRUE ;
-			break ;
-		case CP15_ACCESS_READSYS:
-			if ((address & regionReadMask_SYS[i]) == regionReadSet_SYS[i]) return TRUE ;
-			break ;
-		case CP15_ACCESS_EXECUSR:
-			if ((address & regionExecuteMask_USR[i]) == regionExecuteSet_USR[i]) return TRUE ;
-			break ;
-		case CP15_ACCESS_EXECSYS:
-			if ((address & regionExecuteMask_SYS[i]) == regionExecuteSet_SYS[i]) return TRUE ;
-			break ;
-		}
-	}
-	/* when protections are enabled, but no region allows access, deny access */
+	/* the highest priority region containing the address decides */
+	region = regionAt(address) ;
+	if (region != 0) return (regionAllowed[region-1] >> access) & 1 ;
+	/* when protections are enabled, but no region contains the address, deny access */
 	return FALSE ;
 }
 
@@ -460,6 +458,8 @@ BOOL armcp15_t::moveARM2CP(u32 val, u8 CRn, u8 CRm, u8 opcode1, u8 opcode2)
 						MMU.DTCMRegion = DTCMRegion = val & 0x0FFFF000;
 						if (DTCMRegion_old != DTCMRegion)
 						{
+							MMU_PagesRefresh(DTCMRegion_old & ~0x3FFF, (DTCMRegion_old & ~0x3FFF) + 0x4000);
+							MMU_PagesRefresh(DTCMRegion & ~0x3FFF, (DTCMRegion & ~0x3FFF) + 0x4000);
 							if (arm_cpubase)
 								arm_cpubase->Clear[NDS_ARM9.proc_ID](0, CPUBASE_FLUSHALL);
 						}
@@ -552,6 +552,17 @@ bool armcp15_t::loadone(EMUFILE* is)
     for(int i=0;i<8;i++) if(!read32le(&regionReadSet_SYS[i],is)) return false;
     for(int i=0;i<8;i++) if(!read32le(&regionExecuteSet_USR[i],is)) return false;
     for(int i=0;i<8;i++) if(!read32le(&regionExecuteSet_SYS[i],is)) return false;
+    for(int i=0;i<8;i++)
+    {
+        u32 mask = 0, set = 0xFFFFFFFF;
+        if (BIT_N(protectBaseSize[i],0))
+        {
+            mask = CP15_MASKFROMREG(protectBaseSize[i]);
+            set = CP15_SETFROMREG(protectBaseSize[i]);
+            if (CP15_SIZEIDENTIFIER(protectBaseSize[i])==0x1F) { mask = 0; set = 0; }
+        }
+        setRegionBounds(i, mask, set);
+    }
 
     return true;
 }
@@ -74,8 +74,14 @@ public:
         u32 regionReadSet_SYS[8] ;
         u32 regionExecuteSet_USR[8] ;
         u32 regionExecuteSet_SYS[8] ;
+        /* each region's bounds as a mask/set pair (disabled regions never match, see maskPrecalc), */
+        /* and the CP15_ACCESS_* types its permissions allow, as bits. kept up to date by setSingleRegionAccess */
+        u32 regionMask[8] ;
+        u32 regionSet[8] ;
+        u8 regionAllowed[8] ;
 
 		void setSingleRegionAccess(u8 num, u32 mask, u32 set);
+		void setRegionBounds(u8 num, u32 mask, u32 set);
 		void maskPrecalc();
 
 public:
@@ -113,6 +119,7 @@ public:
 			memset(&regionReadSet_SYS[0], 0, sizeof(regionReadSet_SYS));
 			memset(&regionExecuteSet_USR[0], 0, sizeof(regionExecuteSet_USR));
 			memset(&regionExecuteSet_SYS[0], 0, sizeof(regionExecuteSet_SYS));
+			for (int i=0;i<8;i++) setRegionBounds(i, 0, 0xFFFFFFFF);
 		}
 		BOOL dataProcess(u8 CRd, u8 CRn, u8 CRm, u8 opcode1, u8 opcode2);
 		BOOL load(u8 CRd, u8 adr);
@@ -120,6 +127,24 @@ public:
 		BOOL moveCP2ARM(u32 * R, u8 CRn, u8 CRm, u8 opcode1, u8 opcode2);
 		BOOL moveARM2CP(u32 val, u8 CRn, u8 CRm, u8 opcode1, u8 opcode2);
 		BOOL isAccessAllowed(u32 address,u32 access);
+
+		/* the highest priority region containing address, plus one, or 0 if there is none */
+		FORCEINLINE u32 regionAt(u32 address)
+		{
+			for (int i=7;i>=0;i--)
+				if ((address & regionMask[i]) == regionSet[i]) return i+1;
+			return 0;
+		}
+		/* whether accesses to address go through the data/instruction cache: */
+		/* the protection unit and the cache are on, and the region is marked cacheable */
+		FORCEINLINE bool isDataCached(u32 address)
+		{
+			return (ctrl & 0x5) == 0x5 && (((DCConfig << 1) >> regionAt(address)) & 1);
+		}
+		FORCEINLINE bool isCodeCached(u32 address)
+		{
+			return (ctrl & 0x1001) == 0x1001 && (((ICConfig << 1) >> regionAt(address)) & 1);
+		}
 		// savestate
 		void saveone(EMUFILE* os);
 		bool loadone(EMUFILE* is);
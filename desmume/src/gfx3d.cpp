@@ -2228,31 +2228,86 @@ void gfx3d_glFlush(u32 v)
 	GFX_DELAY(1);
 }
 
-static bool gfx3d_ysort_compare(int num1, int num2)
-{
-	const POLY &poly1 = polylist->list[num1];
-	const POLY &poly2 = polylist->list[num2];
+//the opaque polys (and the translucent ones, when autosorting) are drawn in order of maxy, then miny.
+//this may be verified by checking the game create menus in harvest moon island of happiness
+//also the buttons in the knights in the nightmare frontend depend on this and the perspective division.
+//notably, the main shop interface in harvest moon will not have a correct RTN button
+//i think this is due to a math error rounding its position to one pixel too high and it popping behind
+//the bar that it sits on.
+//everything else in all the other menus that I could find looks right..
+//
+//the two y values are packed into one integer key per poly, which is radix sorted along with the poly indices.
+//the sort must be stable so that we respect the game's ordering in cases of complete ties;
+//or else advance wars DOR will flicker in the main map mode
+static CACHE_ALIGN u64 ysortKeys[POLYLIST_SIZE];
+static CACHE_ALIGN u64 ysortKeysTemp[POLYLIST_SIZE];
+static CACHE_ALIGN int ysortIndexTemp[POLYLIST_SIZE];
+
+//maps a float to an integer which sorts the same way
+static FORCEINLINE u32 gfx3d_ysort_floatKey(float f)
+{
+	u32 bits;
+	memcpy(&bits,&f,4);
+	//-0 and +0 compare equal, so they need the same key. this is done on the bits, since fast-math builds are
+	//free to drop float arithmetic that would only change the sign of a zero
+	if((bits & 0x7FFFFFFF) == 0) bits = 0;
+	return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+}
+
+static void gfx3d_ysort(u64 *keys, int *indices, const int count)
+{
+	if(count < 2) return;
+
+	//histogram every byte of the keys in one pass
+	u32 histogram[8][256];
+	memset(histogram,0,sizeof(histogram));
+	for(int i=0;i<count;i++)
+	{
+		const u64 key = keys[i];
+		for(int pass=0;pass<8;pass++)
+			histogram[pass][(key>>(pass*8))&0xFF]++;
+	}
+
+	u64 *srcKeys = keys, *dstKeys = ysortKeysTemp;
+	int *srcIndices = indices, *dstIndices = ysortIndexTemp;
+	for(int pass=0;pass<8;pass++)
+	{
+		const int shift = pass*8;
+		u32 *offsets = histogram[pass];
 
-	//this may be verified by checking the game create menus in harvest moon island of happiness
-	//also the buttons in the knights in the nightmare frontend depend on this and the perspective division
-	if (poly1.maxy < poly2.maxy) return true;
-	if (poly1.maxy > poly2.maxy) return false;
-	if (poly1.miny < poly2.miny) return true;
-	if (poly1.miny > poly2.miny) return false;
-	//notably, the main shop interface in harvest moon will not have a correct RTN button
-	//i think this is due to a math error rounding its position to one pixel too high and it popping behind
-	//the bar that it sits on.
-	//everything else in all the other menus that I could find looks right..
+		//nothing to do if every key has the same value in this byte (the usual case for the high bytes)
+		if(offsets[(srcKeys[0]>>shift)&0xFF] == (u32)count)
+			continue;
 
-	//make sure we respect the game's ordering in cases of complete ties
-	//this makes it a stable sort.
-	//this must be a stable sort or else advance wars DOR will flicker in the main map mode
-	if (num1 < num2) return true;
-	else return false;
+		u32 sum = 0;
+		for(int i=0;i<256;i++)
+		{
+			const u32 n = offsets[i];
+			offsets[i] = sum;
+			sum += n;
+		}
+
+		for(int i=0;i<count;i++)
+		{
+			const u32 dst = offsets[(srcKeys[i]>>shift)&0xFF]++;
+			dstKeys[dst] = srcKeys[i];
+			dstIndices[dst] = srcIndices[i];
+		}
+
+		std::swap(srcKeys,dstKeys);
+		std::swap(srcIndices,dstIndices);
+	}
+
+	if(srcIndices != indices)
+		memcpy(indices,srcIndices,count*sizeof(int));
 }
 
 static void gfx3d_doFlush()
 {
+	//the lists handed out at the last flush go back to being built into at the end of this one (see twiddleLists),
+	//so a renderer job still reading them has to be done first
+	gpu3D->NDS_3D_RenderFinish();
+
 	gfx3d.frameCtr++;
 
 	//the renderer will get the lists we just built
@@ -2296,56 +2351,75 @@ static void gfx3d_doFlush()
 	osd->addFixed(180, 35, "%i/%i", max_polys, max_verts);		// max
 #endif
 
-	//find the min and max y values for each poly.
+	//find the min and max y values for each poly, and build the sort keys.
+	//the opaque polys are gathered at the front of the index list and the translucent ones at the back (in reverse).
 	//TODO - this could be a small waste of time if we are manual sorting the translucent polys
 	//TODO - this _MUST_ be moved later in the pipeline, after clipping.
 	//the w-division here is just an approximation to fix the shop in harvest moon island of happiness
 	//also the buttons in the knights in the nightmare frontend depend on this
+	int opaqueCount = 0;
+	int translucentPos = polycount;
 	for(int i=0; i<polycount; i++)
 	{
 		POLY &poly = polylist->list[i];
-		float verty = vertlist->list[poly.vertIndexes[0]].y;
-		float vertw = vertlist->list[poly.vertIndexes[0]].w;
-		verty = 1.0f-(verty+vertw)/(2*vertw);
-		poly.miny = poly.maxy = verty;
 
-		for(int j=1; j<poly.type; j++)
+		CACHE_ALIGN float verty[4];
+#ifdef ENABLE_SSE
 		{
-			verty = vertlist->list[poly.vertIndexes[j]].y;
-			vertw = vertlist->list[poly.vertIndexes[j]].w;
-			verty = 1.0f-(verty+vertw)/(2*vertw);
-			poly.miny = min(poly.miny, verty);
-			poly.maxy = max(poly.maxy, verty);
+			const VERT &v0 = vertlist->list[poly.vertIndexes[0]];
+			const VERT &v1 = vertlist->list[poly.vertIndexes[1]];
+			const VERT &v2 = vertlist->list[poly.vertIndexes[2]];
+			const VERT &v3 = vertlist->list[poly.vertIndexes[(poly.type==4)?3:0]];
+			const __m128 y = _mm_set_ps(v3.y,v2.y,v1.y,v0.y);
+			const __m128 w = _mm_set_ps(v3.w,v2.w,v1.w,v0.w);
+			_mm_store_ps(verty,_mm_sub_ps(_mm_set1_ps(1.0f),_mm_div_ps(_mm_add_ps(y,w),_mm_add_ps(w,w))));
 		}
+#else
+		for(int j=0; j<poly.type; j++)
+		{
+			const float y = vertlist->list[poly.vertIndexes[j]].y;
+			const float w = vertlist->list[poly.vertIndexes[j]].w;
+			verty[j] = 1.0f-(y+w)/(2*w);
+		}
+#endif
 
-	}
+		float miny = verty[0], maxy = verty[0];
+		for(int j=1; j<poly.type; j++)
+		{
+			miny = min(miny, verty[j]);
+			maxy = max(maxy, verty[j]);
+		}
+		poly.miny = miny;
+		poly.maxy = maxy;
 
-	//we need to sort the poly list with alpha polys last
-	//first, look for opaque polys
-	int ctr=0;
-	for(int i=0;i<polycount;i++) {
-		POLY &poly = polylist->list[i];
+		const u64 key = ((u64)gfx3d_ysort_floatKey(maxy)<<32) | gfx3d_ysort_floatKey(miny);
 		if(!poly.isTranslucent())
-			gfx3d.indexlist.list[ctr++] = i;
-	}
-	int opaqueCount = ctr;
-	//then look for translucent polys
-	for(int i=0;i<polycount;i++) {
-		POLY &poly = polylist->list[i];
-		if(poly.isTranslucent())
-			gfx3d.indexlist.list[ctr++] = i;
+		{
+			ysortKeys[opaqueCount] = key;
+			gfx3d.indexlist.list[opaqueCount++] = i;
+		}
+		else
+		{
+			translucentPos--;
+			ysortKeys[translucentPos] = key;
+			gfx3d.indexlist.list[translucentPos] = i;
+		}
 	}
 
+	//put the translucent polys back in the game's order
+	std::reverse(gfx3d.indexlist.list + opaqueCount, gfx3d.indexlist.list + polycount);
+	std::reverse(ysortKeys + opaqueCount, ysortKeys + polycount);
+
 	//now we have to sort the opaque polys by y-value.
 	//(test case: harvest moon island of happiness character cretor UI)
 	//should this be done after clipping??
-	std::sort(gfx3d.indexlist.list, gfx3d.indexlist.list + opaqueCount, gfx3d_ysort_compare);
+	gfx3d_ysort(ysortKeys, gfx3d.indexlist.list, opaqueCount);
 	
 	if(!gfx3d.state.sortmode)
 	{
 		//if we are autosorting translucent polys, we need to do this also
 		//TODO - this is unverified behavior. need a test case
-		std::sort(gfx3d.indexlist.list + opaqueCount, gfx3d.indexlist.list + polycount, gfx3d_ysort_compare);
+		gfx3d_ysort(ysortKeys + opaqueCount, gfx3d.indexlist.list + opaqueCount, polycount - opaqueCount);
 	}
 
 	//switch to the new lists
@@ -2385,6 +2459,8 @@ void gfx3d_VBlankEndSignal(bool skipFrame)
 
 	if(!CommonSettings.showGpu.main)
 	{
+		//a renderer job from an earlier frame may still be writing its output, if nothing has composited it yet
+		gpu3D->NDS_3D_RenderFinish();
 		memset(gfx3d_convertedScreen,0,sizeof(gfx3d_convertedScreen));
 		return;
 	}
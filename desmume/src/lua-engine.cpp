@@ -25,6 +25,7 @@
 #include <algorithm>
 #include "zlib.h"
 #include "NDSSystem.h"
+#include "MMU.h"
 #include "movie.h"
 #include "GPU_osd.h"
 #include "saves.h"
@@ -1827,6 +1828,7 @@ DEFINE_LUA_FUNCTION(vram_writeword, "address,value")
 	int address = luaL_checkinteger(L,1);
 	u16 value = (u16)(luaL_checkinteger(L,2) & 0xFFFF);
 	T1WriteWord(MMU.ARM9_LCD,address,value);
+	MMU_VRAMnoteWrite((u32)address % sizeof(MMU.ARM9_LCD));
 	return 0;
 }
 DEFINE_LUA_FUNCTION(memory_writedword, "address,value")
@@ -5426,6 +5428,9 @@ static void CalculateMemHookRegions(LuaMemHookType hookType)
 		++iter;
 	}
 	hookedRegions[hookType].Calculate(hookedBytes);
+
+	//watched pages have to come off the mmu's plain memory page tables
+	MMU_PagesRefresh(0, 0x10000000);
 }
 
 
@@ -131,6 +131,7 @@ void DontWorryLua();
 
 #include <vector>
 #include <algorithm>
+#include <string.h>
 
 // the purpose of this structure is to provide a way of
 // QUICKLY determining whether a memory address range has a hook associated with it,
@@ -188,6 +189,11 @@ struct TieredRegion
 	Region<0x1000> mid;
 	Region<0> narrow;
 
+	// one bit per 16KB page of the (mirrored) 256MB bus, set when any hooked byte lies in that page.
+	// the same granularity as the MMU page tables, so a page can be kept off the fast paths while it is watched.
+	enum { PAGE_SHIFT = 14, PAGE_COUNT = 0x10000000 >> PAGE_SHIFT };
+	u32 pages[PAGE_COUNT/32];
+
 	void Calculate(std::vector<unsigned int>& bytes)
 	{
 		std::sort(bytes.begin(), bytes.end());
@@ -195,6 +201,15 @@ struct TieredRegion
 		broad.Calculate(bytes);
 		mid.Calculate(bytes);
 		narrow.Calculate(bytes);
+
+		memset(pages, 0, sizeof(pages));
+		std::vector<unsigned int>::const_iterator iter = bytes.begin();
+		std::vector<unsigned int>::const_iterator end = bytes.end();
+		for(; iter != end; ++iter)
+		{
+			unsigned int page = (*iter & 0x0FFFFFFF) >> PAGE_SHIFT;
+			pages[page>>5] |= 1 << (page&31);
+		}
 	}
 
 	TieredRegion()
@@ -208,6 +223,18 @@ struct TieredRegion
 		return broad.islands.size();
 	}
 
+	FORCEINLINE bool PageWatched(unsigned int address) const
+	{
+		unsigned int page = (address & 0x0FFFFFFF) >> PAGE_SHIFT;
+		return (pages[page>>5] >> (page&31)) & 1;
+	}
+
+	// true if either end of the access lands in a watched page (accesses are at most 4 bytes, so never span more than two)
+	FORCEINLINE bool PageWatched(unsigned int address, int size) const
+	{
+		return PageWatched(address) || PageWatched(address+size-1);
+	}
+
 	// note: it is illegal to call this if NotEmpty() returns 0
 	FORCEINLINE bool Contains(unsigned int address, int size)
 	{
@@ -231,7 +258,7 @@ FORCEINLINE void CallRegisteredLuaMemHook(unsigned int address, int size, unsign
 	{
 		//if((hookType <= LUAMEMHOOK_EXEC) && (address >= 0xE00000))
 		//	address |= 0xFF0000; // gens: account for mirroring of RAM
-		if(hookedRegions[hookType].Contains(address, size))
+		if(hookedRegions[hookType].PageWatched(address, size) && hookedRegions[hookType].Contains(address, size))
 			CallRegisteredLuaMemHook_LuaMatch(address, size, value, hookType); // something has hooked this specific address
 	}
 }
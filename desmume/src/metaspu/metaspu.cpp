@@ -20,7 +20,6 @@
 #include "types.h"
 #include "metaspu.h"
 #include <queue>
-#include <vector>
 #include <assert.h>
 
 //for pcsx2 method
@@ -67,11 +66,7 @@ public:
 
 	virtual void enqueue_samples(s16* buf, int samples_provided)
 	{
-		for(int i=0;i<samples_provided;i++) {
-			s16 left = *buf++;
-			s16 right = *buf++;
-			adjustobuf.enqueue(left,right);
-		}
+		adjustobuf.enqueue((const StereoFrame*)buf,samples_provided);
 	}
 
 	//returns the number of samples actually supplied, which may not match the number requested
@@ -79,13 +74,13 @@ public:
 	{
 		int done = 0;
 		if(!mixqueue_go) {
-			if(adjustobuf.size > 200)
+			if(adjustobuf.size() > 200)
 				mixqueue_go = true;
 		}
 		else
 		{
 			for(int i=0;i<samples_requested;i++) {
-				if(adjustobuf.size==0) {
+				if(adjustobuf.size()==0) {
 					mixqueue_go = false;
 					break;
 				}
@@ -105,9 +100,9 @@ private:
 	{
 	public:
 		Adjustobuf(int _minLatency, int _maxLatency)
-			: size(0)
-			, minLatency(_minLatency)
+			: minLatency(_minLatency)
 			, maxLatency(_maxLatency)
+			, buffer(METASPU_RING_SIZE_LOG2)
 		{
 			rollingTotalSize = 0;
 			targetLatency = (maxLatency + minLatency)/2;
@@ -119,17 +114,16 @@ private:
 
 		float rate, cursor;
 		int minLatency, targetLatency, maxLatency;
-		std::queue<s16> buffer;
-		int size;
+		SPSCRing<StereoFrame> buffer;
 		s16 curr[2];
 
 		std::queue<int> statsHistory;
 
-		void enqueue(s16 left, s16 right) 
+		int size() const { return (int)buffer.size(); }
+
+		void enqueue(const StereoFrame* frames, int count)
 		{
-			buffer.push(left);
-			buffer.push(right);
-			size++;
+			buffer.write(frames,count);
 		}
 
 		s64 rollingTotalSize;
@@ -138,6 +132,7 @@ private:
 
 		void addStatistic()
 		{
+			const int size = this->size();
 			statsHistory.push(size);
 			rollingTotalSize += size;
 			if(statsHistory.size()>kAverageSize)
@@ -170,14 +165,14 @@ private:
 		{
 			left = right = 0; 
 			addStatistic();
-			if(size==0) { return; }
+			if(size()==0) { return; }
 			cursor += rate;
 			while(cursor>1.0f) {
 				cursor -= 1.0f;
-				if(size>0) {
-					curr[0] = buffer.front(); buffer.pop();
-					curr[1] = buffer.front(); buffer.pop();
-					size--;
+				StereoFrame frame;
+				if(buffer.read(&frame,1)) {
+					curr[0] = frame.l;
+					curr[1] = frame.r;
 				}
 			}
 			left = curr[0]; 
@@ -189,14 +184,9 @@ private:
 class NitsujaSynchronizer : public ISynchronizingAudioBuffer
 {
 private:
-	struct ssamp
-	{
-		s16 l, r;
-		ssamp() {}
-		ssamp(s16 ll, s16 rr) : l(ll), r(rr) {}
-	};
+	typedef StereoFrame ssamp;
 
-	std::vector<ssamp> sampleQueue;
+	SPSCRing<ssamp> sampleQueue;
 
 	// returns values going between 0 and y-1 in a saw wave pattern, based on x
 	static FORCEINLINE int pingpong(int x, int y)
@@ -240,23 +230,20 @@ private:
 		*outbuf++ = sample.r;
 	}
 
-	static FORCEINLINE void emit_samples(s16*& outbuf, const ssamp* samplebuf, int samples)
+	static FORCEINLINE void emit_samples(s16*& outbuf, const SPSCRing<ssamp>& queue, int samples)
 	{
 		for(int i=0;i<samples;i++)
-			emit_sample(outbuf,samplebuf[i]);
+			emit_sample(outbuf,queue.peek(i));
 	}
 
 public:
 	NitsujaSynchronizer()
+		: sampleQueue(METASPU_RING_SIZE_LOG2)
 	{}
 
 	virtual void enqueue_samples(s16* buf, int samples_provided)
 	{
-		for(int i=0;i<samples_provided;i++)
-		{
-			sampleQueue.push_back(ssamp(buf[0],buf[1]));
-			buf += 2;
-		}
+		sampleQueue.write((const ssamp*)buf,samples_provided);
 	}
 
 	virtual int output_samples(s16* buf, int samples_requested)
@@ -282,7 +269,7 @@ public:
 					for(int i = 0; i < audiosize; i++)
 					{
 						int j = i + queued - audiosize;
-						ssamp outsamp = crossfade(sampleQueue[i],sampleQueue[j], i,0,audiosize);
+						ssamp outsamp = crossfade(sampleQueue.peek(i),sampleQueue.peek(j), i,0,audiosize);
 						emit_sample(buf,outsamp);
 					}
 				}
@@ -324,7 +311,7 @@ public:
 						int bestenddiff = worstdiff;
 						for(int i = 0; i < 128; i+=2)
 						{
-							int diff = abs(sampleQueue[i].l - sampleQueue[i+1].l) + abs(sampleQueue[i].r - sampleQueue[i+1].r);
+							int diff = abs(sampleQueue.peek(i).l - sampleQueue.peek(i+1).l) + abs(sampleQueue.peek(i).r - sampleQueue.peek(i+1).r);
 							if(diff < beststartdiff)
 							{
 								beststartdiff = diff;
@@ -333,7 +320,7 @@ public:
 						}
 						for(int i = queued-3; i > queued-3-128; i-=2)
 						{
-							int diff = abs(sampleQueue[i].l - sampleQueue[i+1].l) + abs(sampleQueue[i].r - sampleQueue[i+1].r);
+							int diff = abs(sampleQueue.peek(i).l - sampleQueue.peek(i+1).l) + abs(sampleQueue.peek(i).r - sampleQueue.peek(i+1).r);
 							if(diff < bestenddiff)
 							{
 								bestenddiff = diff;
@@ -351,9 +338,9 @@ public:
 
 						for(int x = 0; x < beststart; x++)
 						{
-							emit_sample(buf,sampleQueue[x]);
+							emit_sample(buf,sampleQueue.peek(x));
 						}
-						sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + beststart);
+						sampleQueue.skip(beststart);
 					}
 
 
@@ -395,7 +382,7 @@ public:
 					for(int x = 0; x < leftMidpointX; x++)
 					{
 						int i = pingpong(x, queued);
-						emit_sample(buf,sampleQueue[i]);
+						emit_sample(buf,sampleQueue.peek(i));
 					}
 
 					// output the middle stretch (section "B")
@@ -403,27 +390,27 @@ public:
 					int dyMidLeft  = (leftMidpointY  < midpointY) ? 1 : -1;
 					int dyMidRight = (rightMidpointY > midpointY) ? 1 : -1;
 					for(int x = leftMidpointX; x < midpointX; x++, y+=dyMidLeft)
-						emit_sample(buf,sampleQueue[y]);
+						emit_sample(buf,sampleQueue.peek(y));
 					for(int x = midpointX; x < rightMidpointX; x++, y+=dyMidRight)
-						emit_sample(buf,sampleQueue[y]);
+						emit_sample(buf,sampleQueue.peek(y));
 
 					// output the end of the queued sound (section "C")
 					for(int x = rightMidpointX; x < audiosize; x++)
 					{
 						int i = (queued-1) - pingpong((int)audiosize-1 - x + queued*2, queued);
-						emit_sample(buf,sampleQueue[i]);
+						emit_sample(buf,sampleQueue.peek(i));
 					}
 
 					for(int x = 0; x < extraAtEnd; x++)
 					{
 						int i = queued + x;
-						emit_sample(buf,sampleQueue[i]);
+						emit_sample(buf,sampleQueue.peek(i));
 					}
 					queued += extraAtEnd;
 					audiosize += beststart + extraAtEnd;
 				} //end else
 
-				sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + queued);
+				sampleQueue.skip(queued);
 				return audiosize;
 			}
 			else
@@ -439,14 +426,14 @@ public:
 
 				if(audiosize >= queued)
 				{
-					emit_samples(buf,&sampleQueue[0],queued);
-					sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin() + queued);
+					emit_samples(buf,sampleQueue,queued);
+					sampleQueue.skip(queued);
 					return queued;
 				}
 				else
 				{
-					emit_samples(buf,&sampleQueue[0],audiosize);
-					sampleQueue.erase(sampleQueue.begin(), sampleQueue.begin()+audiosize);
+					emit_samples(buf,sampleQueue,audiosize);
+					sampleQueue.skip(audiosize);
 					return audiosize;
 				}
 
@@ -469,8 +456,10 @@ private:
 class PCSX2Synchronizer : public ISynchronizingAudioBuffer
 {
 public:
-	std::queue<s16> readySamples;
+	StereoOut16 readySamples[SndOutPacketSize];
+	int readyPos;
 	PCSX2Synchronizer()
+		: readyPos(SndOutPacketSize)
 	{
 		SndBuffer::Init();
 	}
@@ -488,17 +477,13 @@ public:
 	virtual int output_samples(s16* buf, int samples_requested)
 	{
 		for(int i=0;i<samples_requested;i++) {
-			if(readySamples.size()==0) {
-				//SndOutPacketSize
-				StereoOut16 temp[SndOutPacketSize*2];
-				SndBuffer::ReadSamples( temp );
-				for(int i=0;i<SndOutPacketSize;i++) {
-					readySamples.push(temp[i].Left);
-					readySamples.push(temp[i].Right);
-				}
+			if(readyPos == SndOutPacketSize) {
+				SndBuffer::ReadSamples( readySamples );
+				readyPos = 0;
 			}
-			*buf++ = readySamples.front(); readySamples.pop();
-			*buf++ = readySamples.front(); readySamples.pop();
+			*buf++ = readySamples[readyPos].Left;
+			*buf++ = readySamples[readyPos].Right;
+			readyPos++;
 		}
 		return samples_requested;
 	}
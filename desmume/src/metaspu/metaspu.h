@@ -38,6 +38,101 @@ static FORCEINLINE T GetClamped( T src, T min, T max )
 	return std::min( std::max( src, min ), max );
 }
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+//x86 stores are not reordered with other stores nor loads with other loads,
+//so keeping the compiler from reordering is all the ring needs there
+#define METASPU_BARRIER() _ReadWriteBarrier()
+#else
+#define METASPU_BARRIER() __sync_synchronize()
+#endif
+
+struct StereoFrame
+{
+	StereoFrame() {}
+	StereoFrame(s16 ll, s16 rr) : l(ll), r(rr) {}
+	s16 l, r;
+};
+
+//a fixed size ring which is safe without locks as long as exactly one thread writes
+//(write/push/space) and exactly one thread reads (size/peek/read/skip/clear).
+//indices run freely and are masked on access, so size is always head-tail.
+//nothing is buffered outside the ring, so clear empties everything that was written before it.
+template<typename T>
+class SPSCRing
+{
+public:
+	SPSCRing(int capacityLog2)
+		: mask((1u<<capacityLog2)-1)
+		, head(0)
+		, tail(0)
+	{
+		buffer = new T[mask+1];
+	}
+
+	~SPSCRing() { delete[] buffer; }
+
+	//producer: returns the number of elements actually written, which is less than count when full.
+	//whatever doesnt fit is dropped, so size the ring for the largest backlog the reader can fall behind by
+	u32 write(const T* src, u32 count)
+	{
+		const u32 h = head;
+		u32 avail = (mask+1) - (h - tail);
+		if(count > avail) count = avail;
+		for(u32 i=0;i<count;i++)
+			buffer[(h+i)&mask] = src[i];
+		METASPU_BARRIER();
+		head = h + count;
+		return count;
+	}
+
+	bool push(const T& val) { return write(&val,1) == 1; }
+
+	u32 space() const { return (mask+1) - (head - tail); }
+
+	//consumer: the element count is a snapshot; the producer may append more meanwhile
+	u32 size() const
+	{
+		const u32 h = head;
+		METASPU_BARRIER();
+		return h - tail;
+	}
+
+	const T& peek(u32 index) const { return buffer[(tail+index)&mask]; }
+
+	u32 read(T* dst, u32 count)
+	{
+		const u32 avail = size();
+		if(count > avail) count = avail;
+		for(u32 i=0;i<count;i++)
+			dst[i] = buffer[(tail+i)&mask];
+		skip(count);
+		return count;
+	}
+
+	void skip(u32 count)
+	{
+		METASPU_BARRIER();
+		tail = tail + count;
+	}
+
+	void clear() { skip(size()); }
+
+private:
+	SPSCRing(const SPSCRing&);
+	SPSCRing& operator=(const SPSCRing&);
+
+	const u32 mask;
+	T* buffer;
+	volatile u32 head, tail;
+};
+
+//the synchronizers' frame rings hold about three seconds at 44100Hz. that covers the largest
+//latency either one aims for (zeromus' debug window is 44000) plus whatever the emulator can
+//produce while the output is stalled for a few frames; frames past that are dropped
+#define METASPU_RING_SIZE_LOG2 17
+
+//enqueue_samples and output_samples may be called from two different threads (one each)
 class ISynchronizingAudioBuffer
 {
 public:
@@ -20,6 +20,8 @@
 #include <limits.h>
 #include <ctype.h>
 #include <time.h>
+#include <algorithm>
+#include <zlib.h>
 #include "utils/guid.h"
 #include "utils/xstring.h"
 #include "utils/datetime.h"
@@ -34,6 +36,7 @@
 #include "GPU_osd.h"
 #include "path.h"
 #include "emufile.h"
+#include "saves.h"
 
 using namespace std;
 bool freshMovie = false;	  //True when a movie loads, false when movie is altered.  Used to determine if a movie has been altered since opening
@@ -63,6 +66,10 @@ char curMovieFilename[512] = {0};
 MovieData currMovieData;
 int currRerecordCount;
 bool movie_reset_command = false;
+int movie_keyframe_interval = 0;
+
+//set while a keyframe is being saved, so it leaves out the movie
+static bool savingKeyframe = false;
 //--------------
 
 
@@ -210,6 +217,8 @@ void MovieData::truncateAt(int frame)
 {
 	if((int)records.size() > frame)
 		records.resize(frame);
+	while(!keyframes.empty() && keyframes.back().frame > frame)
+		keyframes.pop_back();
 }
 
 
@@ -294,6 +303,25 @@ void MovieData::installValue(std::string& key, std::string& val)
 int MovieData::dump(EMUFILE* fp, bool binary)
 {
 	int start = fp->ftell();
+	dumpHeader(fp, binary);
+
+	if(binary)
+	{
+		//put one | to start the binary dump
+		fp->fputc('|');
+		for(int i=0;i<(int)records.size();i++)
+			records[i].dumpBinary(this,fp,i);
+	}
+	else
+		for(int i=0;i<(int)records.size();i++)
+			records[i].dump(this,fp,i);
+
+	int end = fp->ftell();
+	return end-start;
+}
+
+void MovieData::dumpHeader(EMUFILE* fp, bool binary)
+{
 	fp->fprintf("version %d\n", version);
 	fp->fprintf("emuVersion %d\n", emuVersion);
 	fp->fprintf("rerecordCount %d\n", rerecordCount);
@@ -349,20 +377,6 @@ int MovieData::dump(EMUFILE* fp, bool binary)
 		fp->fprintf("savestate %s\n", BytesToString(&savestate[0],savestate.size()).c_str());
 	if(sram.size() != 0)
 		fp->fprintf("sram %s\n", BytesToString(&sram[0],sram.size()).c_str());
-
-	if(binary)
-	{
-		//put one | to start the binary dump
-		fp->fputc('|');
-		for(int i=0;i<(int)records.size();i++)
-			records[i].dumpBinary(this,fp,i);
-	}
-	else
-		for(int i=0;i<(int)records.size();i++)
-			records[i].dump(this,fp,i);
-
-	int end = fp->ftell();
-	return end-start;
 }
 
 //yuck... another custom text parser.
@@ -514,6 +528,135 @@ void FCEUI_StopMovie()
 }
 
 
+//little endian 4-byte cookie for indexed binary movies
+static const u32 kDSMB = 0x424D5344;
+#define BINARY_MOVIE_VERSION 1
+#define BINARY_MOVIE_RECORD_SIZE 6
+
+bool LoadBinaryMovie(MovieData& movieData, EMUFILE* fp)
+{
+	u32 cookie, version, headerSize;
+	if(!read32le(&cookie,fp) || cookie != kDSMB) return false;
+	if(!read32le(&version,fp) || version != BINARY_MOVIE_VERSION) return false;
+
+	//the header is the same text as in a text movie
+	if(!read32le(&headerSize,fp) || headerSize > (u32)fp->size()) return false;
+	std::vector<u8> header(headerSize);
+	if(headerSize != 0) fp->fread(&header[0],headerSize);
+	if(fp->fail()) return false;
+	EMUFILE_MEMORY headerms(&header);
+	if(!LoadFM2(movieData, &headerms, headerSize, true)) return false;
+
+	u32 recordSize, numRecords;
+	if(!read32le(&recordSize,fp) || recordSize != BINARY_MOVIE_RECORD_SIZE) return false;
+	if(!read32le(&numRecords,fp) || numRecords > (u32)fp->size()/BINARY_MOVIE_RECORD_SIZE) return false;
+	movieData.records.resize(numRecords);
+	for(u32 i=0;i<numRecords;i++)
+		movieData.records[i].parseBinary(&movieData,fp);
+
+	u32 numKeyframes;
+	if(!read32le(&numKeyframes,fp) || numKeyframes > numRecords+1) return false;
+	std::vector<u32> offsets(numKeyframes), sizes(numKeyframes);
+	movieData.keyframes.resize(numKeyframes);
+	for(u32 i=0;i<numKeyframes;i++)
+	{
+		u32 frame;
+		if(!read32le(&frame,fp) || !read32le(&offsets[i],fp) || !read32le(&sizes[i],fp)) return false;
+		if(frame > numRecords || (i != 0 && (int)frame <= movieData.keyframes[i-1].frame)) return false;
+		movieData.keyframes[i].frame = frame;
+	}
+	for(u32 i=0;i<numKeyframes;i++)
+	{
+		if(sizes[i] > (u32)fp->size()) return false;
+		movieData.keyframes[i].state.resize(sizes[i]);
+		fp->fseek(offsets[i],SEEK_SET);
+		if(sizes[i] != 0) fp->fread(&movieData.keyframes[i].state[0],sizes[i]);
+		if(fp->fail()) return false;
+	}
+
+	return true;
+}
+
+bool FCEUI_SaveBinaryMovie(const char *fname)
+{
+	EMUFILE_FILE fp(fname, "wb");
+	if(fp.fail()) return false;
+
+	EMUFILE_MEMORY header;
+	currMovieData.dumpHeader(&header, false);
+
+	write32le(kDSMB,&fp);
+	write32le(BINARY_MOVIE_VERSION,&fp);
+	write32le(header.size(),&fp);
+	fp.fwrite(header.buf(),header.size());
+
+	write32le(BINARY_MOVIE_RECORD_SIZE,&fp);
+	write32le(currMovieData.records.size(),&fp);
+	for(int i=0;i<(int)currMovieData.records.size();i++)
+		currMovieData.records[i].dumpBinary(&currMovieData,&fp,i);
+
+	const std::vector<MovieKeyframe>& keyframes = currMovieData.keyframes;
+	write32le(keyframes.size(),&fp);
+	u32 offset = fp.ftell() + keyframes.size()*12;
+	for(size_t i=0;i<keyframes.size();i++)
+	{
+		write32le(keyframes[i].frame,&fp);
+		write32le(offset,&fp);
+		write32le(keyframes[i].state.size(),&fp);
+		offset += keyframes[i].state.size();
+	}
+	for(size_t i=0;i<keyframes.size();i++)
+		if(keyframes[i].state.size() != 0)
+			fp.fwrite(&keyframes[i].state[0],keyframes[i].state.size());
+
+	return !fp.fail();
+}
+
+static void captureKeyframe()
+{
+	if(movie_keyframe_interval <= 0) return;
+	if(movieMode != MOVIEMODE_PLAY && movieMode != MOVIEMODE_RECORD) return;
+	if(currFrameCounter % movie_keyframe_interval) return;
+
+	std::vector<MovieKeyframe>& keyframes = currMovieData.keyframes;
+	if(!keyframes.empty() && keyframes.back().frame >= currFrameCounter) return;
+
+	MovieKeyframe keyframe;
+	keyframe.frame = currFrameCounter;
+	keyframes.push_back(keyframe);
+
+	EMUFILE_MEMORY ms(&keyframes.back().state);
+	savingKeyframe = true;
+	savestate_save(&ms, Z_BEST_SPEED);
+	savingKeyframe = false;
+	keyframes.back().state.resize(ms.size());
+}
+
+int FCEUI_MovieSeek(int frame)
+{
+	if(movieMode != MOVIEMODE_PLAY && movieMode != MOVIEMODE_FINISHED) return -1;
+	if(frame < 0 || frame > (int)currMovieData.records.size()) return -1;
+
+	//find the last keyframe at or before the frame
+	const std::vector<MovieKeyframe>& keyframes = currMovieData.keyframes;
+	int lo = 0, hi = (int)keyframes.size();
+	while(lo < hi)
+	{
+		int mid = (lo+hi)/2;
+		if(keyframes[mid].frame <= frame) lo = mid+1;
+		else hi = mid;
+	}
+	if(lo == 0) return -1;
+
+	MovieKeyframe keyframe = keyframes[lo-1];
+	EMUFILE_MEMORY ms(&keyframe.state);
+	if(!savestate_load(&ms)) return -1;
+
+	if(currFrameCounter < (int)currMovieData.records.size())
+		movieMode = MOVIEMODE_PLAY;
+	return currFrameCounter;
+}
+
 //begin playing an existing movie
 const char* _CDECL_ FCEUI_LoadMovie(const char *fname, bool _read_only, bool tasedit, int _pauseframe)
 {
@@ -552,7 +695,13 @@ const char* _CDECL_ FCEUI_LoadMovie(const char *fname, bool _read_only, bool tas
 		EMUFILE* fp = new EMUFILE_FILE(fname, "rb");
 //		if(fs.is_open())
 //		{
-			loadedfm2 = LoadFM2(currMovieData, fp, INT_MAX, false);
+			u32 cookie = 0;
+			read32le(&cookie,fp);
+			fp->fseek(0,SEEK_SET);
+			if(cookie == kDSMB)
+				loadedfm2 = LoadBinaryMovie(currMovieData, fp);
+			else
+				loadedfm2 = LoadFM2(currMovieData, fp, INT_MAX, false);
 			opened = true;
 //		}
 //		fs.close();
@@ -740,6 +889,8 @@ void FCEUI_SaveMovie(const char *fname, std::wstring author, int flag, std::stri
 
  void FCEUMOV_HandlePlayback()
  {
+	 captureKeyframe();
+
 	 if(movieMode == MOVIEMODE_PLAY)
 	 {
 		 //stop when we run out of frames
@@ -870,6 +1021,7 @@ static void FCEUMOV_AddCommand(int cmd)
 //little endian 4-byte cookies
 static const int kMOVI = 0x49564F4D;
 static const int kNOMO = 0x4F4D4F4E;
+static const int kKEYF = 0x4659454B; //a movie keyframe, which belongs to the movie already loaded
 
 void mov_savestate(EMUFILE* fp)
 {
@@ -877,7 +1029,11 @@ void mov_savestate(EMUFILE* fp)
 	//if(movieMode == MOVIEMODE_RECORD || movieMode == MOVIEMODE_PLAY)
 	//	return currMovieData.dump(os, true);
 	//else return 0;
-	if(movieMode != MOVIEMODE_INACTIVE)
+	if(savingKeyframe)
+	{
+		write32le(kKEYF,fp);
+	}
+	else if(movieMode != MOVIEMODE_INACTIVE)
 	{
 		write32le(kMOVI,fp);
 		currMovieData.dump(fp, true);
@@ -930,6 +1086,12 @@ bool mov_loadstate(EMUFILE* fp, int size)
 			FinishPlayback();
 		return true;
 	}
+	else if(cookie == kKEYF)
+	{
+		//the movie carries on as it is
+		load_successful = true;
+		return true;
+	}
 	else if(cookie != kMOVI)
 		return false;
 
@@ -1035,7 +1197,18 @@ bool mov_loadstate(EMUFILE* fp, int size)
 
 		if(!movie_readonly)
 		{
+			//keyframes stay good up to where the movies part ways
+			std::vector<MovieKeyframe> keyframes;
+			keyframes.swap(currMovieData.keyframes);
+			int same = 0;
+			int common = std::min(currMovieData.getNumRecords(), tempMovieData.getNumRecords());
+			while(same < common && currMovieData.records[same].Compare(tempMovieData.records[same]))
+				same++;
+			while(!keyframes.empty() && keyframes.back().frame > same)
+				keyframes.pop_back();
+
 			currMovieData = tempMovieData;
+			currMovieData.keyframes.swap(keyframes);
 			currMovieData.rerecordCount = currRerecordCount;
 		}
 
@@ -131,6 +131,13 @@ private:
 };
 
 
+//a savestate taken at the start of a frame of a movie, so playback can resume from there
+struct MovieKeyframe
+{
+	int frame;
+	std::vector<u8> state;
+};
+
 class MovieData
 {
 public:
@@ -148,6 +155,7 @@ public:
 	std::vector<u8> sram;
 	std::vector<MovieRecord> records;
 	std::vector<std::wstring> comments;
+	std::vector<MovieKeyframe> keyframes; //in frame order
 	
 	int rerecordCount;
 	Desmume_Guid guid;
@@ -190,6 +198,7 @@ public:
 	void truncateAt(int frame);
 	void installValue(std::string& key, std::string& val);
 	int dump(EMUFILE* fp, bool binary);
+	void dumpHeader(EMUFILE* fp, bool binary);
 	void clearRecordRange(int start, int len);
 	void insertEmpty(int at, int frames);
 	
@@ -228,6 +237,18 @@ void mov_savestate(EMUFILE* fp);
 bool mov_loadstate(EMUFILE* fp, int size);
 void LoadFM2_binarychunk(MovieData& movieData, EMUFILE* fp, int size);
 bool LoadFM2(MovieData& movieData, EMUFILE* fp, int size, bool stopAfterHeader);
+
+//indexed binary movies hold the usual text header, then fixed size frame records so any frame is found
+//directly, then an index of keyframes and the keyframe savestates. FCEUI_LoadMovie recognizes them
+bool LoadBinaryMovie(MovieData& movieData, EMUFILE* fp);
+bool FCEUI_SaveBinaryMovie(const char *fname);
+
+//frames between keyframes captured while a movie plays or records (0 = none)
+extern int movie_keyframe_interval;
+
+//loads the latest keyframe at or before frame and returns the frame it was taken at, or -1 if there is none.
+//playing on from there until currFrameCounter reaches frame replays only the remainder
+int FCEUI_MovieSeek(int frame);
 extern bool movie_readonly;
 extern bool ShowInputDisplay;
 void FCEUI_MakeBackupMovie(bool dispMessage);
@@ -115,8 +115,10 @@ static FORCEINLINE int fastFloor(float f)
 //	verts[vert_index] = &rawvert;
 //}
 
-static Fragment _screen[256*192];
-static FragmentColor _screenColor[256*192];
+//the framebuffers are sized for the current upscale factor (see SoftRastSetupFramebuffers).
+static Fragment *_screen = NULL;
+static FragmentColor *_screenColor = NULL;
+static int softRastScale = 0;
 
 static FORCEINLINE int iround(float f) {
 	return (int)f; //lol
@@ -300,9 +302,9 @@ FORCEINLINE int edge_fx_fl::Step() {
 
 
 
-static FORCEINLINE void alphaBlend(FragmentColor & dst, const FragmentColor & src)
+static FORCEINLINE void alphaBlend(FragmentColor & dst, const FragmentColor & src, const bool enableAlphaBlending)
 {
-	if(gfx3d.renderState.enableAlphaBlending)
+	if(enableAlphaBlending)
 	{
 		if(src.a == 31 || dst.a == 0)
 		{
@@ -411,7 +413,7 @@ public:
 		int wrap;
 		int wshift;
 		int texFormat;
-		void setup(u32 texParam)
+		void setup(u32 texParam, BOOL enableTexturing)
 		{
 			texFormat = (texParam>>26)&7;
 			wshift = ((texParam>>20)&0x07) + 3;
@@ -420,7 +422,7 @@ public:
 			wmask = width-1;
 			hmask = height-1;
 			wrap = (texParam>>16)&0xF;
-			enabled = gfx3d.renderState.enableTexturing && (texFormat!=0);
+			enabled = enableTexturing && (texFormat!=0);
 		}
 
 		FORCEINLINE void clamp(int &val, const int size, const int sizemask){
@@ -540,7 +542,7 @@ public:
 				texColor = sample(u,v);
 				FragmentColor toonColor = engine->toonTable[shader.materialColor.r>>1];
 			
-				if(gfx3d.renderState.shading == GFX3D_State::HIGHLIGHT)
+				if(engine->renderState.shading == GFX3D_State::HIGHLIGHT)
 				{
 					dst.r = modulate_table[texColor.r][shader.materialColor.r];
 					dst.g = modulate_table[texColor.g][shader.materialColor.r];
@@ -579,7 +581,7 @@ public:
 		FragmentColor &destFragmentColor = engine->screenColor[adr];
 
 		u32 depth;
-		if(gfx3d.renderState.wbuffer)
+		if(engine->renderState.wbuffer)
 		{
 			//not sure about this
 			//this value was chosen to make the skybox, castle window decals, and water level render correctly in SM64
@@ -668,9 +670,9 @@ public:
 		if(shaderOutput.a != 0)
 		{
 			//alpha test (don't have any test cases for this...? is it in the right place...?)
-			if(gfx3d.renderState.enableAlphaTest)
+			if(engine->renderState.enableAlphaTest)
 			{
-				if(shaderOutput.a < gfx3d.renderState.alphaTestRef)
+				if(shaderOutput.a < engine->renderState.alphaTestRef)
 					goto rejected_fragment;
 			}
 
@@ -695,7 +697,7 @@ public:
 				destFragment.polyid.translucent = polyAttr.polyid;
 
 				//alpha blending and write color
-				alphaBlend(destFragmentColor, shaderOutput);
+				alphaBlend(destFragmentColor, shaderOutput, engine->renderState.enableAlphaBlending);
 
 				destFragment.fogged &= polyAttr.fogged;
 			}
@@ -767,11 +769,7 @@ public:
 
 		//CONSIDER: in case some other math is wrong (shouldve been clipped OK), we might go out of bounds here.
 		//better check the Y value.
-		if(RENDERER && (pLeft->Y<0 || pLeft->Y>191)) {
-			printf("rasterizer rendering at y=%d! oops!\n",pLeft->Y);
-			return;
-		}
-		if(!RENDERER && (pLeft->Y<0 || pLeft->Y>=engine->height)) {
+		if(pLeft->Y<0 || pLeft->Y>=engine->height) {
 			printf("rasterizer rendering at y=%d! oops!\n",pLeft->Y);
 			return;
 		}
@@ -796,14 +794,14 @@ public:
 			width -= -x;
 			x = 0;
 		}
-		if(x+width > (RENDERER?256:engine->width))
+		if(x+width > engine->width)
 		{
 			if(RENDERER && !lineHack)
 			{
 				printf("rasterizer rendering at x=%d! oops!\n",x+width-1);
 				return;
 			}
-			width = (RENDERER?256:engine->width)-x;
+			width = engine->width-x;
 		}
 
 		while(width-- > 0)
@@ -833,7 +831,7 @@ public:
 		bool first=true;
 
 		//HACK: special handling for horizontal line poly
-		if (lineHack && left->Height == 0 && right->Height == 0 && left->Y<192 && left->Y>=0)
+		if (lineHack && left->Height == 0 && right->Height == 0 && left->Y<engine->height && left->Y>=0)
 		{
 			bool draw = (!SLI || (left->Y & SLI_MASK) == SLI_VALUE);
 			if(draw) drawscanline(left,right,lineHack);
@@ -1041,14 +1039,14 @@ public:
 
 			if(first || lastTextureFormat != poly->texParam || lastTexturePalette != poly->texPalette)
 			{
-				sampler.setup(poly->texParam);
+				sampler.setup(poly->texParam, engine->renderState.enableTexturing);
 				lastTextureFormat = poly->texParam;
 				lastTexturePalette = poly->texPalette;
 			}
 
 			first = false;
 
-			lastTexKey = engine->polyTexKeys[i];
+			lastTexKey = engine->polyTexKeys[poly - engine->polylist->list];
 
 			//hmm... shader gets setup every time because it depends on sampler which may have just changed
 			setupShader(poly->polyAttr);
@@ -1083,6 +1081,76 @@ static void* execRasterizerUnit(void* arg)
 	return 0;
 }
 
+static void SoftRastConvertFramebuffer(int startLine, int endLine);
+
+//fog and the output conversion for one band of (native resolution) lines
+static void* execPostProcessBand(void* arg)
+{
+	intptr_t which = (intptr_t)arg;
+	const int startLine = (192*which)/rasterizerCores;
+	const int endLine = (192*(which+1))/rasterizerCores;
+	mainSoftRasterizer.processFog(startLine*softRastScale,endLine*softRastScale);
+	SoftRastConvertFramebuffer(startLine,endLine);
+	return 0;
+}
+
+//runs everything in a render job that doesnt touch emulator state:
+//the geometry front end, the rasterizer units, and the framebuffer post-processing.
+//this runs on rasterizer task 0, which fans the scanlines out to the other tasks.
+static void* execRenderJob(void* arg)
+{
+	SoftRasterizerEngine* engine = &mainSoftRasterizer;
+
+	engine->performFrontEnd();
+
+	for(unsigned int i = 1; i < rasterizerCores; i++)
+		rasterizerUnitTask[i].execute(&execRasterizerUnit, (void *)(intptr_t)i);
+
+	rasterizerUnit[0].mainLoop<true>(engine);
+
+	for(unsigned int i = 1; i < rasterizerCores; i++)
+		rasterizerUnitTask[i].finish();
+
+	//edge marking draws into neighbouring lines, so it is not split up
+	engine->processEdgeMarking();
+
+	for(unsigned int i = 1; i < rasterizerCores; i++)
+		rasterizerUnitTask[i].execute(&execPostProcessBand, (void *)(intptr_t)i);
+
+	execPostProcessBand((void *)(intptr_t)0);
+
+	for(unsigned int i = 1; i < rasterizerCores; i++)
+		rasterizerUnitTask[i].finish();
+
+	return 0;
+}
+
+//(re)allocates the framebuffers when the upscale factor changes. no job may be in flight.
+static void SoftRastSetupFramebuffers()
+{
+	int scale = CommonSettings.GFX3D_Renderer_Upscale;
+	if(scale < 1) scale = 1;
+	if(scale > 4) scale = 4;
+	if(scale == softRastScale) return;
+
+	delete[] _screen;
+	delete[] _screenColor;
+
+	const int todo = (256*scale)*(192*scale);
+	_screen = new Fragment[todo];
+	_screenColor = new FragmentColor[todo];
+	softRastScale = scale;
+}
+
+static void SoftRastFreeFramebuffers()
+{
+	delete[] _screen;
+	delete[] _screenColor;
+	_screen = NULL;
+	_screenColor = NULL;
+	softRastScale = 0;
+}
+
 static char SoftRastInit(void)
 {
 	char result = Default3D_Init();
@@ -1183,18 +1251,54 @@ static void SoftRastClose()
 	
 	rasterizerUnitTasksInited = false;
 	softRastHasNewData = false;
+	SoftRastFreeFramebuffers();
 	
 	Default3D_Close();
 }
 
-static void SoftRastVramReconfigureSignal()
+static void SoftRastVramReconfigureSignal(u32 slotMask)
 {
-	Default3D_VramReconfigureSignal();
+	//the job in flight only reads from its own snapshot and from already decoded textures,
+	//and invalidation only marks the texcache items; so there is no need to wait here.
+	Default3D_VramReconfigureSignal(slotMask);
 }
 
-static void SoftRastConvertFramebuffer()
+//produces the 3d layer for the given native resolution lines. when upscaling, this boxfilters the high resolution
+//lines down for the native resolution layer (which the 2d engines composite and capture), so upscaling supersamples.
+static void SoftRastConvertFramebuffer(int startLine, int endLine)
 {
-	memcpy(gfx3d_convertedScreen,_screenColor,256*192*4);
+	const int scale = softRastScale;
+	if(scale == 1)
+	{
+		memcpy(gfx3d_convertedScreen+startLine*256*4,_screenColor+startLine*256,(endLine-startLine)*256*4);
+		return;
+	}
+
+	const int hiresWidth = 256*scale;
+	const int samples = scale*scale;
+
+	FragmentColor *dst = (FragmentColor*)gfx3d_convertedScreen + startLine*256;
+	for(int y=startLine;y<endLine;y++)
+	{
+		const FragmentColor *src = _screenColor + y*scale*hiresWidth;
+		for(int x=0;x<256;x++,dst++,src+=scale)
+		{
+			u32 r=0,g=0,b=0,a=0;
+			for(int sy=0;sy<scale;sy++)
+				for(int sx=0;sx<scale;sx++)
+				{
+					const FragmentColor &sample = src[sy*hiresWidth+sx];
+					r += sample.r;
+					g += sample.g;
+					b += sample.b;
+					a += sample.a;
+				}
+			dst->r = r/samples;
+			dst->g = g/samples;
+			dst->b = b/samples;
+			dst->a = a/samples;
+		}
+	}
 }
 
 void SoftRasterizerEngine::initFramebuffer(const int width, const int height, const bool clearImage)
@@ -1204,54 +1308,51 @@ void SoftRasterizerEngine::initFramebuffer(const int width, const int height, co
 	Fragment clearFragment;
 	FragmentColor clearFragmentColor;
 	clearFragment.isTranslucentPoly = 0;
-	clearFragmentColor.r = GFX3D_5TO6(gfx3d.renderState.clearColor&0x1F);
-	clearFragmentColor.g = GFX3D_5TO6((gfx3d.renderState.clearColor>>5)&0x1F);
-	clearFragmentColor.b = GFX3D_5TO6((gfx3d.renderState.clearColor>>10)&0x1F);
-	clearFragmentColor.a = ((gfx3d.renderState.clearColor>>16)&0x1F);
-	clearFragment.polyid.opaque = (gfx3d.renderState.clearColor>>24)&0x3F;
+	clearFragmentColor.r = GFX3D_5TO6(renderState.clearColor&0x1F);
+	clearFragmentColor.g = GFX3D_5TO6((renderState.clearColor>>5)&0x1F);
+	clearFragmentColor.b = GFX3D_5TO6((renderState.clearColor>>10)&0x1F);
+	clearFragmentColor.a = ((renderState.clearColor>>16)&0x1F);
+	clearFragment.polyid.opaque = (renderState.clearColor>>24)&0x3F;
 	//special value for uninitialized translucent polyid. without this, fires in spiderman2 dont display
 	//I am not sure whether it is right, though. previously this was cleared to 0, as a guess,
 	//but in spiderman2 some fires with polyid 0 try to render on top of the background
 	clearFragment.polyid.translucent = kUnsetTranslucentPolyID; 
-	clearFragment.depth = gfx3d.renderState.clearDepth;
+	clearFragment.depth = renderState.clearDepth;
 	clearFragment.stencil = 0;
 	clearFragment.isTranslucentPoly = 0;
-	clearFragment.fogged = BIT15(gfx3d.renderState.clearColor);
+	clearFragment.fogged = BIT15(renderState.clearColor);
 	for(int i=0;i<todo;i++)
 		screen[i] = clearFragment;
 
 	if(clearImage)
 	{
-		//need to handle this somehow..
-		assert(width==256 && height==192);
-
-		u16* clearImage = (u16*)MMU.texInfo.textureSlotAddr[2];
-		u16* clearDepth = (u16*)MMU.texInfo.textureSlotAddr[3];
+		//when upscaling, the clear image is simply scaled up along with everything else
+		const int scale = width/256;
+		assert(width==256*scale && height==192*scale);
 
 		//the lion, the witch, and the wardrobe (thats book 1, suck it you new-school numberers)
 		//uses the scroll registers in the main game engine
-		u16 scroll = T1ReadWord(MMU.ARM9_REG,0x356); //CLRIMAGE_OFFSET
-		u16 xscroll = scroll&0xFF;
-		u16 yscroll = (scroll>>8)&0xFF;
+		u16 xscroll = clearImageScroll&0xFF;
+		u16 yscroll = (clearImageScroll>>8)&0xFF;
 
 		FragmentColor *dstColor = screenColor;
 		Fragment *dst = screen;
 
-		for(int iy=0;iy<192;iy++) {
-			int y = ((iy + yscroll)&255)<<8;
-			for(int ix=0;ix<256;ix++) {
-				int x = (ix + xscroll)&255;
+		for(int iy=0;iy<height;iy++) {
+			int y = ((iy/scale + yscroll)&255)<<8;
+			for(int ix=0;ix<width;ix++) {
+				int x = (ix/scale + xscroll)&255;
 				int adr = y + x;
 				
 				//this is tested by harry potter and the order of the phoenix.
 				//TODO (optimization) dont do this if we are mapped to blank memory (such as in sonic chronicles)
 				//(or use a special zero fill in the bulk clearing above)
-				u16 col = clearImage[adr];
+				u16 col = clearImageColor[adr];
 				dstColor->color = RGB15TO6665(col,31*(col>>15));
 				
 				//this is tested quite well in the sonic chronicles main map mode
 				//where depth values are used for trees etc you can walk behind
-				u16 depth = clearDepth[adr];
+				u16 depth = clearImageDepth[adr];
 				dst->fogged = BIT15(depth);
 				dst->depth = DS_DEPTH15TO24(depth);
 
@@ -1270,12 +1371,12 @@ void SoftRasterizerEngine::updateToonTable()
 	//convert the toon colors
 	for(int i=0;i<32;i++) {
 		#ifdef WORDS_BIGENDIAN
-			const u32 u32temp = RGB15TO32_NOALPHA(gfx3d.renderState.u16ToonTable[i]);
+			const u32 u32temp = RGB15TO32_NOALPHA(renderState.u16ToonTable[i]);
 			toonTable[i].r = (u32temp >> 2) & 0x3F;
 			toonTable[i].g = (u32temp >> 10) & 0x3F;
 			toonTable[i].b = (u32temp >> 18) & 0x3F;
 		#else
-			toonTable[i].color = (RGB15TO32_NOALPHA(gfx3d.renderState.u16ToonTable[i])>>2)&0x3F3F3F3F;
+			toonTable[i].color = (RGB15TO32_NOALPHA(renderState.u16ToonTable[i])>>2)&0x3F3F3F3F;
 		#endif
 		//printf("%d %d %d %d\n",toonTable[i].r,toonTable[i].g,toonTable[i].b,toonTable[i].a);
 	}
@@ -1283,18 +1384,17 @@ void SoftRasterizerEngine::updateToonTable()
 
 void SoftRasterizerEngine::updateFogTable()
 {
-	u8* fogDensity = MMU.MMU_MEM[ARMCPU_ARM9][0x40] + 0x360;
 #if 0
 	//TODO - this might be a little slow; 
 	//we might need to hash all the variables and only recompute this when something changes
-	const int increment = (0x400 >> gfx3d.renderState.fogShift);
+	const int increment = (0x400 >> renderState.fogShift);
 	for(u32 i=0;i<32768;i++) {
-		if(i<gfx3d.renderState.fogOffset) {
+		if(i<renderState.fogOffset) {
 			fogTable[i] = fogDensity[0];
 			continue;
 		}
 		for(int j=0;j<32;j++) {
-			u32 value = gfx3d.renderState.fogOffset + increment*(j+1);
+			u32 value = renderState.fogOffset + increment*(j+1);
 			if(i<=value) {
 				if(j==0) {
 					fogTable[i] = fogDensity[0];
@@ -1312,22 +1412,22 @@ void SoftRasterizerEngine::updateFogTable()
 	// this should behave exactly the same as the previous loop,
 	// except much faster. (because it's not a 2d loop and isn't so branchy either)
 	// maybe it's fast enough to not need to be cached, now.
-	const int increment = ((1 << 10) >> gfx3d.renderState.fogShift);
-	const int incrementDivShift = 10 - gfx3d.renderState.fogShift;
-	u32 fogOffset = min<u32>(max<u32>(gfx3d.renderState.fogOffset, 0), 32768);
+	const int increment = ((1 << 10) >> renderState.fogShift);
+	const int incrementDivShift = 10 - renderState.fogShift;
+	u32 fogOffset = min<u32>(max<u32>(renderState.fogOffset, 0), 32768);
 	u32 iMin = min<u32>(32768, (( 1 + 1) << incrementDivShift) + fogOffset + 1 - increment);
 	u32 iMax = min<u32>(32768, ((32 + 1) << incrementDivShift) + fogOffset + 1 - increment);
 	assert(iMin <= iMax);
-	memset(fogTable, fogDensity[0], iMin);
+	memset(fogTable, fogDensityTable[0], iMin);
 	for(u32 i = iMin; i < iMax; i++) {
 		int num = (i - fogOffset + (increment-1));
 		int j = (num >> incrementDivShift) - 1;
 		u32 value = (num & ~(increment-1)) + fogOffset;
 		u32 diff = value - i;
 		assert(j >= 1 && j < 32);
-		fogTable[i] = ((diff*(fogDensity[j-1]) + (increment-diff)*(fogDensity[j])) >> incrementDivShift);
+		fogTable[i] = ((diff*(fogDensityTable[j-1]) + (increment-diff)*(fogDensityTable[j])) >> incrementDivShift);
 	}
-	memset(fogTable+iMax, fogDensity[31], 32768-iMax);
+	memset(fogTable+iMax, fogDensityTable[31], 32768-iMax);
 #endif
 }
 
@@ -1338,6 +1438,46 @@ void SoftRasterizerEngine::updateFloatColors()
 		vertlist->list[i].color_to_float();
 }
 
+void SoftRasterizerEngine::captureRenderState(const GFX3D_State &state, POLYLIST *srcPolyList, VERTLIST *srcVertList, const INDEXLIST *srcIndexList)
+{
+	//the poly and vert lists are double buffered by gfx3d (see twiddleLists); the ones we are handed are built
+	//into again from the end of the next flush, and gfx3d_doFlush joins this job before that.
+	//everything else is copied, since it gets rewritten by the very next flush or by the game.
+	polylist = srcPolyList;
+	vertlist = srcVertList;
+	memcpy(jobIndexList.list, srcIndexList->list, srcPolyList->count*sizeof(jobIndexList.list[0]));
+	indexlist = &jobIndexList;
+
+	renderState = state;
+
+	memcpy(fogDensityTable, MMU.MMU_MEM[ARMCPU_ARM9][0x40] + 0x360, sizeof(fogDensityTable));
+	for(int i=0;i<8;i++)
+		edgeMarkTable[i] = T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x330+i*2);
+	edgeMarkAntialias = gfx3d.state.enableAntialiasing ? true : false;
+
+	if(renderState.enableClearImage)
+	{
+		memcpy(clearImageColor, MMU.texInfo.textureSlotAddr[2], sizeof(clearImageColor));
+		memcpy(clearImageDepth, MMU.texInfo.textureSlotAddr[3], sizeof(clearImageDepth));
+		clearImageScroll = T1ReadWord(MMU.ARM9_REG,0x356); //CLRIMAGE_OFFSET
+	}
+}
+
+void SoftRasterizerEngine::performFrontEnd()
+{
+	//setup fog variables (but only if fog is enabled)
+	if(renderState.enableFog)
+		updateFogTable();
+
+	initFramebuffer(width,height,renderState.enableClearImage?true:false);
+	updateToonTable();
+	updateFloatColors();
+	performClipping(CommonSettings.GFX3D_HighResolutionInterpolateColor);
+	performViewportTransforms<false>(width,height);
+	performBackfaceTests();
+	performCoordAdjustment(true);
+}
+
 SoftRasterizerEngine::SoftRasterizerEngine()
 	: _debug_drawClippedUserPoly(-1)
 {
@@ -1345,6 +1485,12 @@ SoftRasterizerEngine::SoftRasterizerEngine()
 }
 
 void SoftRasterizerEngine::framebufferProcess()
+{
+	processEdgeMarking();
+	processFog(0,height);
+}
+
+void SoftRasterizerEngine::processEdgeMarking()
 {
 	// this looks ok although it's still pretty much a hack,
 	// it needs to be redone with low-level accuracy at some point,
@@ -1353,8 +1499,9 @@ void SoftRasterizerEngine::framebufferProcess()
 	// - the edges are completely sharp/opaque on the very brief title screen intro,
 	// - the level-start intro gets a pseudo-antialiasing effect around the silhouette,
 	// - the character edges in-level are clearly transparent, and also show well through shield powerups.
-	if(gfx3d.renderState.enableEdgeMarking)
+	if(renderState.enableEdgeMarking)
 	{ 
+		//the edge mark colors were grabbed by captureRenderState() when the job was submitted.
 		//TODO - need to test and find out whether these get grabbed at flush time, or at render time
 		//we can do this by rendering a 3d frame and then freezing the system, but only changing the edge mark colors
 		FragmentColor edgeMarkColors[8];
@@ -1362,8 +1509,8 @@ void SoftRasterizerEngine::framebufferProcess()
 
 		for(int i=0;i<8;i++)
 		{
-			u16 col = T1ReadWord(MMU.MMU_MEM[ARMCPU_ARM9][0x40], 0x330+i*2);
-			edgeMarkColors[i].color = RGB15TO5555(col,gfx3d.state.enableAntialiasing ? 0x0F : 0x1F);
+			u16 col = edgeMarkTable[i];
+			edgeMarkColors[i].color = RGB15TO5555(col,edgeMarkAntialias ? 0x0F : 0x1F);
 			edgeMarkColors[i].r = GFX3D_5TO6(edgeMarkColors[i].r);
 			edgeMarkColors[i].g = GFX3D_5TO6(edgeMarkColors[i].g);
 			edgeMarkColors[i].b = GFX3D_5TO6(edgeMarkColors[i].b);
@@ -1374,9 +1521,9 @@ void SoftRasterizerEngine::framebufferProcess()
 			edgeMarkDisabled[i] = 0;
 		}
 
-		for(int i=0,y=0;y<192;y++)
+		for(int i=0,y=0;y<height;y++)
 		{
-			for(int x=0;x<256;x++,i++)
+			for(int x=0;x<width;x++,i++)
 			{
 				Fragment destFragment = screen[i];
 				u8 self = destFragment.polyid.opaque;
@@ -1390,9 +1537,9 @@ void SoftRasterizerEngine::framebufferProcess()
 
 				FragmentColor edgeColor = edgeMarkColors[self>>3];
 
-#define PIXOFFSET(dx,dy) ((dx)+(256*(dy)))
-#define ISEDGE(dx,dy) ((x+(dx)!=256) && (x+(dx)!=-1) && (y+(dy)!=192) && (y+(dy)!=-1) && self > screen[i+PIXOFFSET(dx,dy)].polyid.opaque)
-#define DRAWEDGE(dx,dy) alphaBlend(screenColor[i+PIXOFFSET(dx,dy)], edgeColor)
+#define PIXOFFSET(dx,dy) ((dx)+(width*(dy)))
+#define ISEDGE(dx,dy) ((x+(dx)!=width) && (x+(dx)!=-1) && (y+(dy)!=height) && (y+(dy)!=-1) && self > screen[i+PIXOFFSET(dx,dy)].polyid.opaque)
+#define DRAWEDGE(dx,dy) alphaBlend(screenColor[i+PIXOFFSET(dx,dy)], edgeColor, renderState.enableAlphaBlending)
 
 				bool upleft    = ISEDGE(-1,-1);
 				bool up        = ISEDGE( 0,-1);
@@ -1427,14 +1574,17 @@ void SoftRasterizerEngine::framebufferProcess()
 			}
 		}
 	}
+}
 
-	if(gfx3d.renderState.enableFog)
+void SoftRasterizerEngine::processFog(const int startLine, const int endLine)
+{
+	if(renderState.enableFog)
 	{
-		u32 r = GFX3D_5TO6((gfx3d.renderState.fogColor)&0x1F);
-		u32 g = GFX3D_5TO6((gfx3d.renderState.fogColor>>5)&0x1F);
-		u32 b = GFX3D_5TO6((gfx3d.renderState.fogColor>>10)&0x1F);
-		u32 a = (gfx3d.renderState.fogColor>>16)&0x1F;
-		for(int i=0;i<256*192;i++)
+		u32 r = GFX3D_5TO6((renderState.fogColor)&0x1F);
+		u32 g = GFX3D_5TO6((renderState.fogColor>>5)&0x1F);
+		u32 b = GFX3D_5TO6((renderState.fogColor>>10)&0x1F);
+		u32 a = (renderState.fogColor>>16)&0x1F;
+		for(int i=startLine*width;i<endLine*width;i++)
 		{
 			Fragment &destFragment = screen[i];
 			if(!destFragment.fogged) continue;
@@ -1443,7 +1593,7 @@ void SoftRasterizerEngine::framebufferProcess()
 			assert(fogIndex<32768);
 			u8 fog = fogTable[fogIndex];
 			if(fog==127) fog=128;
-			if(!gfx3d.renderState.enableFogAlphaOnly)
+			if(!renderState.enableFogAlphaOnly)
 			{
 				destFragmentColor.r = ((128-fog)*destFragmentColor.r + r*fog)>>7;
 				destFragmentColor.g = ((128-fog)*destFragmentColor.g + g*fog)>>7;
@@ -1562,13 +1712,14 @@ void SoftRasterizerEngine::setupTextures(const bool skipBackfacing)
 	TexCacheItem* lastTexKey = NULL;
 	u32 lastTextureFormat = 0, lastTexturePalette = 0;
 	bool needInitTexture = true;
-	for(int i=0;i<clippedPolyCounter;i++)
-	{
-		GFX3D_Clipper::TClippedPoly &clippedPoly = clippedPolys[i];
-		POLY *poly = clippedPoly.poly;
 
-		PolyAttr polyAttr;
-		polyAttr.setup(poly->polyAttr);
+	//this walks the unclipped poly list (in render order) rather than the clipped polys,
+	//because it runs on the emulation thread before the job is handed to the rasterizer threads.
+	//the texture decoding is what snapshots the referenced texture and palette vram for the job.
+	for(int i=0;i<polylist->count;i++)
+	{
+		const int polyIndex = indexlist->list[i];
+		POLY *poly = &polylist->list[polyIndex];
 
 		//make sure all the textures we'll need are cached
 		//(otherwise on a multithreaded system there will be multiple writers-- 
@@ -1583,7 +1734,7 @@ void SoftRasterizerEngine::setupTextures(const bool skipBackfacing)
 		}
 
 		//printf("%08X %d\n",poly->texParam,rasterizerUnit[0].textures.currentNum);
-		polyTexKeys[i] = lastTexKey;
+		polyTexKeys[polyIndex] = lastTexKey;
 	}
 }
 
@@ -1631,48 +1782,36 @@ void _HACK_Viewer_ExecUnit(SoftRasterizerEngine* engine)
 
 static void SoftRastRender()
 {
-	// Force threads to finish before rendering with new data
+	// The previous job must be joined before its engine can be reused. In practice it has always
+	// been joined already, since the 2D engine composites the 3D layer before the next vblank end.
 	if (rasterizerCores > 1)
 	{
-		for(unsigned int i = 0; i < rasterizerCores; i++)
-		{
-			rasterizerUnitTask[i].finish();
-		}
+		rasterizerUnitTask[0].finish();
 	}
 	
-	mainSoftRasterizer.polylist = gfx3d.polylist;
-	mainSoftRasterizer.vertlist = gfx3d.vertlist;
-	mainSoftRasterizer.indexlist = &gfx3d.indexlist;
+	SoftRastSetupFramebuffers();
+
+	mainSoftRasterizer.captureRenderState(gfx3d.renderState, gfx3d.polylist, gfx3d.vertlist, &gfx3d.indexlist);
 	mainSoftRasterizer.screen = _screen;
 	mainSoftRasterizer.screenColor = _screenColor;
-	mainSoftRasterizer.width = 256;
-	mainSoftRasterizer.height = 192;
+	mainSoftRasterizer.width = 256*softRastScale;
+	mainSoftRasterizer.height = 192*softRastScale;
 
-	//setup fog variables (but only if fog is enabled)
-	if(gfx3d.renderState.enableFog)
-		mainSoftRasterizer.updateFogTable();
-	
-	mainSoftRasterizer.initFramebuffer(256,192,gfx3d.renderState.enableClearImage?true:false);
-	mainSoftRasterizer.updateToonTable();
-	mainSoftRasterizer.updateFloatColors();
-	mainSoftRasterizer.performClipping(CommonSettings.GFX3D_HighResolutionInterpolateColor);
-	mainSoftRasterizer.performViewportTransforms<false>(256,192);
-	mainSoftRasterizer.performBackfaceTests();
-	mainSoftRasterizer.performCoordAdjustment(true);
+	//decoding the textures is the only part of the job which has to see vram, so it stays on this thread
 	mainSoftRasterizer.setupTextures(true);
 
 	softRastHasNewData = true;
 	
 	if (rasterizerCores > 1)
 	{
-		for(unsigned int i = 0; i < rasterizerCores; i++)
-		{
-			rasterizerUnitTask[i].execute(&execRasterizerUnit, (void *)i);
-		}
+		rasterizerUnitTask[0].execute(&execRenderJob, NULL);
 	}
 	else
 	{
+		mainSoftRasterizer.performFrontEnd();
 		rasterizerUnit[0].mainLoop<false>(&mainSoftRasterizer);
+		mainSoftRasterizer.framebufferProcess();
+		SoftRastConvertFramebuffer(0,192);
 	}
 }
 
@@ -1685,19 +1824,11 @@ static void SoftRastRenderFinish()
 	
 	if (rasterizerCores > 1)
 	{
-		for(unsigned int i = 0; i < rasterizerCores; i++)
-		{
-			rasterizerUnitTask[i].finish();
-		}
+		rasterizerUnitTask[0].finish();
 	}
 	
 	TexCache_EvictFrame();
 	
-	mainSoftRasterizer.framebufferProcess();
-	
-	//	printf("rendered %d of %d polys after backface culling\n",gfx3d.polylist->count-culled,gfx3d.polylist->count);
-	SoftRastConvertFramebuffer();
-	
 	softRastHasNewData = false;
 }
 
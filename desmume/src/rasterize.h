@@ -65,8 +65,15 @@ public:
 
 	SoftRasterizerEngine();
 	
+	//snapshots everything a render job reads from the emulator (render state, index list, fog, edge mark
+	//and clear image registers/vram) so the job can run while the next frame's geometry is being built
+	void captureRenderState(const GFX3D_State &state, POLYLIST *srcPolyList, VERTLIST *srcVertList, const INDEXLIST *srcIndexList);
+	//everything between the snapshot and the rasterizer units: clearing, clipping, transforms and culling
+	void performFrontEnd();
 	void initFramebuffer(const int width, const int height, const bool clearImage);
 	void framebufferProcess();
+	void processEdgeMarking();
+	void processFog(const int startLine, const int endLine);
 	void updateToonTable();
 	void updateFogTable();
 	void updateFloatColors();
@@ -90,6 +97,16 @@ public:
 	VERTLIST* vertlist;
 	INDEXLIST* indexlist;
 	int width, height;
+
+	//render job inputs, owned by the job (see captureRenderState)
+	GFX3D_State renderState;
+	INDEXLIST jobIndexList;
+	u8 fogDensityTable[32];
+	u16 edgeMarkTable[8];
+	bool edgeMarkAntialias;
+	u16 clearImageColor[256*256];
+	u16 clearImageDepth[256*256];
+	u16 clearImageScroll;
 };
 
 
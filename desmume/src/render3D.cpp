@@ -70,9 +70,9 @@ void Default3D_RenderFinish()
 	// Do nothing
 }
 
-void Default3D_VramReconfigureSignal()
+void Default3D_VramReconfigureSignal(u32 slotMask)
 {
-	TexCache_Invalidate();
+	TexCache_Invalidate(slotMask);
 }
 
 void NDS_3D_SetDriver (int core3DIndex)
@@ -231,8 +231,8 @@ Render3DError Render3D::RenderFinish()
 	return RENDER3DERROR_NOERR;
 }
 
-Render3DError Render3D::VramReconfigureSignal()
+Render3DError Render3D::VramReconfigureSignal(u32 slotMask)
 {
-	TexCache_Invalidate();	
+	TexCache_Invalidate(slotMask);	
 	return RENDER3DERROR_NOERR;
 }
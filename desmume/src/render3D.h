@@ -48,7 +48,8 @@ typedef struct Render3DInterface
 	void (CALL_CONVENTION*	NDS_3D_RenderFinish)			();
 
 	//called when the emulator reconfigures its vram. you may need to invalidate your texture cache.
-	void (CALL_CONVENTION*  NDS_3D_VramReconfigureSignal)	();
+	//slotMask tells which texture and texture palette slots were remapped (see TexCache_Invalidate)
+	void (CALL_CONVENTION*  NDS_3D_VramReconfigureSignal)	(u32 slotMask);
 
 } GPU3DInterface;
 
@@ -69,7 +70,7 @@ void Default3D_Reset();
 void Default3D_Close();
 void Default3D_Render();
 void Default3D_RenderFinish();
-void Default3D_VramReconfigureSignal();
+void Default3D_VramReconfigureSignal(u32 slotMask);
 
 void NDS_3D_SetDriver (int core3DIndex);
 bool NDS_3D_ChangeCore(int newCore);
@@ -105,7 +106,7 @@ public:
 	virtual Render3DError Reset();
 	virtual Render3DError Render(const GFX3D_State *renderState, const VERTLIST *vertList, const POLYLIST *polyList, const INDEXLIST *indexList, const u64 frameCount);
 	virtual Render3DError RenderFinish();
-	virtual Render3DError VramReconfigureSignal();
+	virtual Render3DError VramReconfigureSignal(u32 slotMask);
 };
 
 #endif
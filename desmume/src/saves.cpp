@@ -25,6 +25,9 @@
 #endif
 #include <stack>
 #include <set>
+#include <deque>
+#include <string>
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -46,6 +49,7 @@
 #include "slot1.h"
 
 #include "path.h"
+#include "utils/task.h"
 
 #ifdef _WINDOWS
 #include "windows/main.h"
@@ -53,6 +57,10 @@
 #include "android/jni/desmume/main.h"
 #endif
 
+#ifndef _WINDOWS
+#include <sys/time.h>
+#endif
+
 int lastSaveState = 0;		//Keeps track of last savestate used for quick save/load functions
 
 //void*v is actually a void** which will be indirected before reading
@@ -168,6 +176,17 @@ SFORMAT SF_MEM[]={
 	{ 0 }
 };
 
+//SF_MEM without main memory and vram, which checkpoints keep page by page instead.
+//it is written as the same chunk, and loading it through SF_MEM leaves those untouched
+SFORMAT SF_MEM_CHECKPOINT[]={
+	{ "ITCM", 1, sizeof(MMU.ARM9_ITCM),   MMU.ARM9_ITCM},
+	{ "DTCM", 1, sizeof(MMU.ARM9_DTCM),   MMU.ARM9_DTCM},
+	{ "9REG", 1, 0x2000,   MMU.ARM9_REG},
+	{ "VMEM", 1, sizeof(MMU.ARM9_VMEM),    MMU.ARM9_VMEM},
+	{ "OAMS", 1, sizeof(MMU.ARM9_OAM),    MMU.ARM9_OAM},
+	{ 0 }
+};
+
 SFORMAT SF_NDS[]={
 	{ "_WCY", 4, 1, &nds.wifiCycle},
 	{ "_TCY", 8, 8, nds.timerCycle},
@@ -259,10 +278,12 @@ SFORMAT SF_MMU[]={
 	{ "F0TL", 1, 1,       &ipc_fifo[0].tail},
 	{ "F0SZ", 1, 1,       &ipc_fifo[0].size},
 	{ "F0BF", 4, 16,      ipc_fifo[0].buf},
+	{ "F0TS", 8, 16,      ipc_fifo[0].stamp},
 	{ "F1TH", 1, 1,       &ipc_fifo[1].head},
 	{ "F1TL", 1, 1,       &ipc_fifo[1].tail},
 	{ "F1SZ", 1, 1,       &ipc_fifo[1].size},
 	{ "F1BF", 4, 16,      ipc_fifo[1].buf},
+	{ "F1TS", 8, 16,      ipc_fifo[1].stamp},
 
 	{ "FDHD", 4, 1,       &disp_fifo.head},
 	{ "FDTL", 4, 1,       &disp_fifo.tail},
@@ -885,97 +906,533 @@ static void savestate_WriteChunk(EMUFILE* os, int type, void (*saveproc)(EMUFILE
 */
 }
 
-static void writechunks(EMUFILE* os);
+static void writechunks(EMUFILE* os, const SFORMAT *memory = SF_MEM);
 
-bool savestate_save(EMUFILE* outstream, int compressionLevel)
+//an lz4-style byte oriented lz77. its ratio is well short of zlib's, but it is many times faster both ways.
+//each sequence is a token (literal count<<4 | match length-4), the rest of the literal count, the literals,
+//a 16bit match offset and the rest of the match length. a count of 15 in the token continues in the
+//following bytes, each adding up to 255. the last sequence is literals only.
+#define FASTLZ_HASH_BITS 14
+#define FASTLZ_MIN_MATCH 4
+#define FASTLZ_MAX_OFFSET 0xFFFF
+
+static u32 fastlz_bound(u32 len) { return len + len/255 + 16; }
+
+static FORCEINLINE u32 fastlz_read32(const u8* p)
 {
-#ifdef HAVE_JIT 
-	if (arm_cpubase)
-		arm_cpubase->Sync();
+	u32 v;
+	memcpy(&v,p,4);
+	return v;
+}
+
+static FORCEINLINE u32 fastlz_hash(u32 v) { return (v*2654435761U) >> (32-FASTLZ_HASH_BITS); }
+
+static u8* fastlz_putcount(u8* op, u32 count)
+{
+	while(count >= 255)
+	{
+		*op++ = 255;
+		count -= 255;
+	}
+	*op++ = (u8)count;
+	return op;
+}
+
+static u8* fastlz_sequence(u8* op, const u8* lit, u32 litlen, u32 offset, u32 matchlen)
+{
+	u8* token = op++;
+	u8 t;
+	if(litlen >= 15)
+	{
+		t = 15<<4;
+		op = fastlz_putcount(op,litlen-15);
+	}
+	else t = (u8)(litlen<<4);
+	memcpy(op,lit,litlen);
+	op += litlen;
+
+	if(matchlen == 0)
+	{
+		*token = t;
+		return op;
+	}
+
+	*op++ = (u8)offset;
+	*op++ = (u8)(offset>>8);
+	matchlen -= FASTLZ_MIN_MATCH;
+	if(matchlen >= 15)
+	{
+		*token = t|15;
+		return fastlz_putcount(op,matchlen-15);
+	}
+	*token = t|(u8)matchlen;
+	return op;
+}
+
+//dst must hold fastlz_bound(len) bytes
+static u32 fastlz_compress(const u8* src, u32 len, u8* dst)
+{
+	std::vector<u32> table(1<<FASTLZ_HASH_BITS, 0);
+	u8* op = dst;
+	u32 anchor = 0, ip = 0;
+
+	//the tail is left as literals so the lookahead never runs off the end
+	const u32 limit = len > 12 ? len - 12 : 0;
+	while(ip < limit)
+	{
+		const u32 seq = fastlz_read32(src+ip);
+		u32 &slot = table[fastlz_hash(seq)];
+		const u32 ref = slot;
+		slot = ip;
+		if(ref < ip && ip - ref <= FASTLZ_MAX_OFFSET && fastlz_read32(src+ref) == seq)
+		{
+			const u32 maxlen = len - 5 - ip;
+			u32 matchlen = FASTLZ_MIN_MATCH;
+			while(matchlen < maxlen && src[ref+matchlen] == src[ip+matchlen])
+				matchlen++;
+			op = fastlz_sequence(op,src+anchor,ip-anchor,ip-ref,matchlen);
+			ip += matchlen;
+			anchor = ip;
+		}
+		else
+		{
+			//skip along faster through data that isnt matching
+			ip += 1 + ((ip-anchor)>>6);
+		}
+	}
+	return (u32)(fastlz_sequence(op,src+anchor,len-anchor,0,0) - dst);
+}
+
+static bool fastlz_decompress(const u8* src, u32 srclen, u8* dst, u32 len)
+{
+	const u8* ip = src;
+	const u8* const iend = src + srclen;
+	u32 op = 0;
+	for(;;)
+	{
+		if(ip == iend) return false;
+		const u32 token = *ip++;
+
+		u32 litlen = token>>4;
+		if(litlen == 15)
+		{
+			u8 b;
+			do {
+				if(ip == iend) return false;
+				b = *ip++;
+				litlen += b;
+			} while(b == 255);
+		}
+		if(litlen > (u32)(iend-ip) || litlen > len-op) return false;
+		memcpy(dst+op,ip,litlen);
+		ip += litlen;
+		op += litlen;
+
+		if(ip == iend) return op == len;
+
+		if(iend-ip < 2) return false;
+		const u32 offset = ip[0] | (ip[1]<<8);
+		ip += 2;
+		u32 matchlen = token&15;
+		if(matchlen == 15)
+		{
+			u8 b;
+			do {
+				if(ip == iend) return false;
+				b = *ip++;
+				matchlen += b;
+			} while(b == 255);
+		}
+		matchlen += FASTLZ_MIN_MATCH;
+		if(offset == 0 || offset > op || matchlen > len-op) return false;
+
+		u8* d = dst + op;
+		const u8* m = d - offset;
+		if(offset >= matchlen)
+			memcpy(d,m,matchlen);
+		else
+			for(u32 i=0;i<matchlen;i++) d[i] = m[i]; //overlapping, repeats the last offset bytes
+		op += matchlen;
+	}
+}
+
+#ifdef DESMUME_SELFTEST
+//fills buf with one of several kinds of data: noise, runs, a short repeating pattern, and
+//noise sprinkled with copies of earlier spans at random distances (some beyond the offset limit)
+static void fastlz_selftest_fill(SelfTestRandom &rng, u8* buf, u32 len, int kind)
+{
+	switch(kind)
+	{
+	case 0:
+		for(u32 i=0;i<len;i++) buf[i] = (u8)rng();
+		break;
+	case 1:
+		for(u32 i=0;i<len;)
+		{
+			const u8 v = (u8)rng();
+			u32 run = 1 + rng()%600;
+			while(run-- && i<len) buf[i++] = v;
+		}
+		break;
+	case 2:
+	{
+		const u32 period = 1 + rng()%7;
+		for(u32 i=0;i<len;i++) buf[i] = i<period ? (u8)rng() : buf[i-period];
+		break;
+	}
+	default:
+		for(u32 i=0;i<len;i++)
+		{
+			const u32 dist = 1 + rng()%(FASTLZ_MAX_OFFSET+0x1000);
+			if(i >= dist && (rng()&3) == 0)
+			{
+				u32 copy = 4 + rng()%300;
+				for(;copy && i<len;copy--,i++) buf[i] = buf[i-dist];
+				i--;
+			}
+			else buf[i] = (u8)rng();
+		}
+		break;
+	}
+}
+
+//round trips random buffers of every kind through the codec, checks the bound holds, and checks
+//that truncated streams are rejected rather than read past
+bool savestate_selftest()
+{
+	static const u32 kMaxLen = 256*1024; //a savestate chunk
+	std::vector<u8> src(kMaxLen), packed(fastlz_bound(kMaxLen)+1), out(kMaxLen);
+
+	SelfTestRandom rng(0xF457);
+	for(int iteration=0;iteration<256;iteration++)
+	{
+		const int kind = iteration&3;
+		//half the buffers are short, so the literal-only tail handling sees every length
+		const u32 len = (iteration&8) ? rng()%(kMaxLen+1) : rng()%64;
+		fastlz_selftest_fill(rng,&src[0],len,kind);
+
+		const u32 bound = fastlz_bound(len);
+		memset(&packed[0],0xCD,packed.size());
+		const u32 size = fastlz_compress(&src[0],len,&packed[0]);
+		if(size > bound || packed[bound] != 0xCD)
+		{
+			printf("savestate_selftest: fastlz_compress overran its bound (kind %d, %u bytes)\n",kind,len);
+			return false;
+		}
+		if(!fastlz_decompress(&packed[0],size,&out[0],len) || (len && memcmp(&src[0],&out[0],len) != 0))
+		{
+			printf("savestate_selftest: fastlz round trip failed (kind %d, %u bytes)\n",kind,len);
+			return false;
+		}
+		if(size > 1 && fastlz_decompress(&packed[0],size-1-rng()%(size-1),&out[0],len))
+		{
+			printf("savestate_selftest: fastlz_decompress accepted a truncated stream (kind %d, %u bytes)\n",kind,len);
+			return false;
+		}
+	}
+	return true;
+}
 #endif
-	#ifndef HAVE_LIBZ
-	compressionLevel = Z_NO_COMPRESSION;
-	#endif
 
-	EMUFILE_MEMORY ms;
-	EMUFILE* os;
-	
-	if(compressionLevel != Z_NO_COMPRESSION)
+//savestates with a chunked body are split into chunks which are compressed independently, so several
+//cores can work on them at once. after the usual header (whose compressed length field holds the codec)
+//come the chunk size, the chunk count and each chunk's compressed size, and then the chunks.
+#define SAVESTATE_VERSION_CHUNKED 13
+#define SAVESTATE_CHUNK_SIZE      (256*1024)
+#define SAVESTATE_CHUNK_STORED    0x80000000 //set in a chunk size when the chunk didnt shrink and is kept as is
+#define SAVESTATE_MAX_WORKERS     4
+
+int savestate_codec = SAVESTATE_CODEC_ZLIB;
+
+struct SavestateChunkJob
+{
+	bool pack;
+	int codec, level;
+	u8* data; //the uncompressed state
+	u32 len, count;
+	std::vector<std::vector<u8> > chunks;
+	std::vector<u32> sizes;
+
+	void setup(u8* _data, u32 _len)
 	{
-		//generate the savestate in memory first
-		os = (EMUFILE*)&ms;
-		writechunks(os);
+		data = _data;
+		len = _len;
+		count = (len + SAVESTATE_CHUNK_SIZE - 1) / SAVESTATE_CHUNK_SIZE;
+		chunks.resize(count);
+		sizes.resize(count);
+	}
+};
+
+struct SavestateChunkShare
+{
+	SavestateChunkJob* job;
+	u32 first, step;
+	bool ok;
+};
+
+static bool savestate_packchunk(SavestateChunkJob* job, u32 i)
+{
+	const u8* src = job->data + i*SAVESTATE_CHUNK_SIZE;
+	const u32 len = std::min<u32>(SAVESTATE_CHUNK_SIZE, job->len - i*SAVESTATE_CHUNK_SIZE);
+	std::vector<u8> &out = job->chunks[i];
+	u32 packed = len;
+
+	if(job->codec == SAVESTATE_CODEC_FAST)
+	{
+		out.resize(fastlz_bound(len));
+		packed = fastlz_compress(src,len,&out[0]);
+	}
+#ifdef HAVE_LIBZ
+	else if(job->codec == SAVESTATE_CODEC_ZLIB)
+	{
+		uLongf comprlen = compressBound(len);
+		out.resize(comprlen);
+		if(compress2(&out[0],&comprlen,src,len,job->level) != Z_OK)
+			return false;
+		packed = (u32)comprlen;
+	}
+#endif
+
+	if(packed >= len)
+	{
+		out.assign(src,src+len);
+		job->sizes[i] = len | SAVESTATE_CHUNK_STORED;
 	}
 	else
 	{
-		os = outstream;
-		os->fseek(32,SEEK_SET); //skip the header
-		writechunks(os);
+		out.resize(packed);
+		job->sizes[i] = packed;
 	}
+	return true;
+}
 
-	//save the length of the file
-	u32 len = os->ftell();
+static bool savestate_unpackchunk(SavestateChunkJob* job, u32 i)
+{
+	u8* dst = job->data + i*SAVESTATE_CHUNK_SIZE;
+	const u32 len = std::min<u32>(SAVESTATE_CHUNK_SIZE, job->len - i*SAVESTATE_CHUNK_SIZE);
+	const std::vector<u8> &in = job->chunks[i];
 
-	u32 comprlen = 0xFFFFFFFF;
-	u8* cbuf;
+	if(job->sizes[i] & SAVESTATE_CHUNK_STORED)
+	{
+		if(in.size() != len) return false;
+		memcpy(dst,&in[0],len);
+		return true;
+	}
+	if(in.empty()) return false;
 
-	//compress the data
-	int error = Z_OK;
-	if(compressionLevel != Z_NO_COMPRESSION)
+	if(job->codec == SAVESTATE_CODEC_FAST)
+		return fastlz_decompress(&in[0],(u32)in.size(),dst,len);
+#ifdef HAVE_LIBZ
+	if(job->codec == SAVESTATE_CODEC_ZLIB)
 	{
-		cbuf = ms.buf();
-		uLongf comprlen2;
-		//worst case compression.
-		//zlib says "0.1% larger than sourceLen plus 12 bytes"
-		comprlen = (len>>9)+12 + len;
-		cbuf = new u8[comprlen];
-		// Workaround to make it compile under linux 64bit
-		comprlen2 = comprlen;
-		error = compress2(cbuf,&comprlen2,ms.buf(),len,compressionLevel);
-		comprlen = (u32)comprlen2;
+		uLongf uncomprlen = len;
+		return uncompress(dst,&uncomprlen,&in[0],(uLong)in.size()) == Z_OK && uncomprlen == len;
 	}
+#endif
+	return false;
+}
 
-	//dump the header
-	outstream->fseek(0,SEEK_SET);
-	outstream->fwrite(magic,16);
-	write32le(SAVESTATE_VERSION,outstream);
-	write32le(EMU_DESMUME_VERSION_NUMERIC(),outstream); //desmume version
-	write32le(len,outstream); //uncompressed length
-	write32le(comprlen,outstream); //compressed length (-1 if it is not compressed)
+static void* savestate_chunkproc(void* param)
+{
+	SavestateChunkShare* share = (SavestateChunkShare*)param;
+	SavestateChunkJob* job = share->job;
+	for(u32 i=share->first;i<job->count && share->ok;i+=share->step)
+		share->ok = job->pack ? savestate_packchunk(job,i) : savestate_unpackchunk(job,i);
+	return NULL;
+}
+
+static Task savestateWorkers[SAVESTATE_MAX_WORKERS-1];
+static bool savestateWorkersStarted = false;
 
-	if(compressionLevel != Z_NO_COMPRESSION)
+//compresses or decompresses all of a job's chunks, spread over the calling thread and the workers
+static bool savestate_runchunks(SavestateChunkJob &job)
+{
+	u32 workers = (u32)std::max(1,std::min(CommonSettings.num_cores,SAVESTATE_MAX_WORKERS));
+	workers = std::max(1u,std::min(workers,job.count));
+
+	if(workers > 1 && !savestateWorkersStarted)
 	{
-		outstream->fwrite((char*)cbuf,comprlen==(u32)-1?len:comprlen);
-		delete[] cbuf;
+		for(int i=0;i<SAVESTATE_MAX_WORKERS-1;i++)
+			savestateWorkers[i].start(false);
+		savestateWorkersStarted = true;
 	}
 
-	return error == Z_OK;
+	SavestateChunkShare shares[SAVESTATE_MAX_WORKERS];
+	for(u32 i=0;i<workers;i++)
+	{
+		shares[i].job = &job;
+		shares[i].first = i;
+		shares[i].step = workers;
+		shares[i].ok = true;
+	}
+
+	for(u32 i=1;i<workers;i++)
+		savestateWorkers[i-1].execute(savestate_chunkproc,&shares[i]);
+	savestate_chunkproc(&shares[0]);
+	for(u32 i=1;i<workers;i++)
+		savestateWorkers[i-1].finish();
+
+	bool ok = true;
+	for(u32 i=0;i<workers;i++)
+		ok &= shares[i].ok;
+	return ok;
 }
 
-bool savestate_save (const char *file_name)
+static void savestate_writeheader(EMUFILE* os, u32 version, u32 len, u32 comprlen)
 {
-	EMUFILE_MEMORY ms;
-	size_t elems_written;
-#ifdef HAVE_LIBZ
-	if(!savestate_save(&ms, Z_DEFAULT_COMPRESSION))
-#else
-	if(!savestate_save(&ms, 0))
+	os->fwrite(magic,16);
+	write32le(version,os);
+	write32le(EMU_DESMUME_VERSION_NUMERIC(),os); //desmume version
+	write32le(len,os); //uncompressed length
+	write32le(comprlen,os); //compressed length (-1 if it is not compressed), or the codec of a chunked state
+}
+
+static void savestate_writechunked(EMUFILE* os, const SavestateChunkJob &job)
+{
+	savestate_writeheader(os,SAVESTATE_VERSION_CHUNKED,job.len,job.codec);
+	write32le(SAVESTATE_CHUNK_SIZE,os);
+	write32le(job.count,os);
+	for(u32 i=0;i<job.count;i++)
+		write32le(job.sizes[i],os);
+	for(u32 i=0;i<job.count;i++)
+		os->fwrite(&job.chunks[i][0],job.chunks[i].size());
+}
+
+//serialization happens on the emulation thread into this arena, which is kept between saves.
+//compressing and writing it out is left to the writer, so at most one save is in flight.
+static std::vector<u8> savestateArena;
+static SavestateChunkJob savestateJob;
+static std::string savestateFilename;
+static Task savestateWriter;
+static bool savestateWriterStarted = false;
+static bool savestatePending = false;
+
+static int savestate_resolvecodec(int codec)
+{
+#ifndef HAVE_LIBZ
+	if(codec == SAVESTATE_CODEC_ZLIB)
+		return SAVESTATE_CODEC_FAST;
+#endif
+	return codec;
+}
+
+static u32 savestate_serialize()
+{
+#ifdef HAVE_JIT 
+	if (arm_cpubase)
+		arm_cpubase->Sync();
 #endif
+
+	savestateArena.clear();
+	EMUFILE_MEMORY ms(&savestateArena);
+	writechunks(&ms);
+	return (u32)ms.size();
+}
+
+void savestate_flush()
+{
+	if(!savestatePending) return;
+	savestateWriter.finish();
+	savestatePending = false;
+}
+
+bool savestate_save(EMUFILE* outstream, int compressionLevel)
+{
+	savestate_flush();
+
+	if(compressionLevel == Z_NO_COMPRESSION || savestate_codec == SAVESTATE_CODEC_NONE)
+	{
+#ifdef HAVE_JIT 
+		if (arm_cpubase)
+			arm_cpubase->Sync();
+#endif
+		outstream->fseek(32,SEEK_SET); //skip the header
+		writechunks(outstream);
+
+		//save the length of the file
+		u32 len = outstream->ftell();
+		outstream->fseek(0,SEEK_SET);
+		savestate_writeheader(outstream,SAVESTATE_VERSION,len,0xFFFFFFFF);
+		return true;
+	}
+
+	u32 len = savestate_serialize();
+	savestateJob.pack = true;
+	savestateJob.codec = savestate_resolvecodec(savestate_codec);
+	savestateJob.level = compressionLevel;
+	savestateJob.setup(&savestateArena[0],len);
+	if(!savestate_runchunks(savestateJob))
 		return false;
+
+	outstream->fseek(0,SEEK_SET);
+	savestate_writechunked(outstream,savestateJob);
+	return true;
+}
+
+static void* savestate_writeproc(void*)
+{
+	bool ok = savestate_runchunks(savestateJob);
+	if(ok)
+	{
+		EMUFILE_FILE f(savestateFilename.c_str(),"wb");
+		ok = !f.fail();
+		if(ok)
+		{
+			savestate_writechunked(&f,savestateJob);
+			ok = !f.fail();
+		}
+	}
+	if(!ok)
+		printf("Failed to write savestate: %s\n",savestateFilename.c_str());
+	return NULL;
+}
+
+bool savestate_save (const char *file_name)
+{
+	savestate_flush();
+
+	int codec = savestate_resolvecodec(savestate_codec);
+	if(codec == SAVESTATE_CODEC_NONE)
+	{
+		EMUFILE_FILE f(file_name,"wb");
+		if(f.fail()) return false;
+		savestate_save(&f,Z_NO_COMPRESSION);
+		return !f.fail();
+	}
+
+	//check the file can be written now, since the writer has no good way to complain
 	FILE* file = fopen(file_name,"wb");
-	if(file)
+	if(!file) return false;
+	fclose(file);
+
+	u32 len = savestate_serialize();
+	savestateJob.pack = true;
+	savestateJob.codec = codec;
+	savestateJob.level = Z_DEFAULT_COMPRESSION;
+	savestateJob.setup(&savestateArena[0],len);
+	savestateFilename = file_name;
+
+	if(!savestateWriterStarted)
 	{
-		elems_written = fwrite(ms.buf(),1,ms.size(),file);
-		fclose(file);
-		return (elems_written == ms.size());
-	} else return false;
+		savestateWriter.start(false);
+		savestateWriterStarted = true;
+	}
+	savestateWriter.execute(savestate_writeproc,NULL);
+	savestatePending = true;
+	return true;
 }
 
-static void writechunks(EMUFILE* os) {
+static void writechunks(EMUFILE* os, const SFORMAT *memory) {
+	//the 3d output (G3CX) is written before gfx3d_savestate gets a chance to join the renderer
+	gpu3D->NDS_3D_RenderFinish();
+
+	//the ipc fifos are written in the wrapped head/tail + size form, and taken straight back afterwards
+	IPC_FIFOsyncSave();
+
 	savestate_WriteChunk(os,1,SF_ARM9);
 	savestate_WriteChunk(os,2,SF_ARM7);
 	savestate_WriteChunk(os,3,cp15_savestate);
-	savestate_WriteChunk(os,4,SF_MEM);
+	savestate_WriteChunk(os,4,memory);
 	savestate_WriteChunk(os,5,SF_NDS);
 	savestate_WriteChunk(os,51,nds_savestate);
 	savestate_WriteChunk(os,60,SF_MMU);
@@ -998,6 +1455,8 @@ static void writechunks(EMUFILE* os) {
 	savestate_WriteChunk(os,180,reserveChunks);
 	// ============================
 	savestate_WriteChunk(os,0xFFFFFFFF,(SFORMAT*)0);
+
+	IPC_FIFOsyncLoad();
 }
 
 static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
@@ -1014,6 +1473,9 @@ static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
 	};
 	memset(&header, 0, sizeof(header));
 
+	//dont let a render job in flight write the 3d output after we have loaded it
+	gpu3D->NDS_3D_RenderFinish();
+
 	while(totalsize > 0)
 	{
 		u32 size = 0;
@@ -1078,11 +1540,21 @@ static bool ReadStateChunks(EMUFILE* is, s32 totalsize)
 	return ret;
 }
 
-static void loadstate()
+static void loadstate(bool wholesale = true)
 {
+	//vram and main memory were overwritten wholesale
+	if(wholesale)
+	{
+		MMU_VRAMnoteWriteAll();
+		MMU_MAINnoteWriteAll();
+	}
+
     // This should regenerate the vram banks
     for (int i = 0; i < 0xA; i++)
        _MMU_write08<ARMCPU_ARM9>(0x04000240+i, _MMU_read08<ARMCPU_ARM9>(0x04000240+i));
+    MMU_VRAMmapFlush();
+
+	IPC_FIFOsyncLoad();
 
     // This should regenerate the graphics power control register
     _MMU_write16<ARMCPU_ARM9>(0x04000304, _MMU_read16<ARMCPU_ARM9>(0x04000304));
@@ -1110,6 +1582,9 @@ static void loadstate()
 
 bool savestate_load(EMUFILE* is)
 {
+	//the state being loaded may well be the one still being written
+	savestate_flush();
+
 	SAV_silent_fail_flag = false;
 	char header[16];
 	is->fread(header,16);
@@ -1122,11 +1597,34 @@ bool savestate_load(EMUFILE* is)
 	if(!read32le(&len,is)) return false;
 	if(!read32le(&comprlen,is)) return false;
 
-	if(ssversion != SAVESTATE_VERSION) return false;
-
 	std::vector<u8> buf(len);
 
-	if(comprlen != 0xFFFFFFFF) {
+	if(ssversion == SAVESTATE_VERSION_CHUNKED) {
+		//the codec is in place of the compressed length
+		u32 chunkSize;
+		SavestateChunkJob job;
+		job.pack = false;
+		job.codec = comprlen;
+		if(len == 0) return false;
+		job.setup(&buf[0],len);
+		if(!read32le(&chunkSize,is) || chunkSize != SAVESTATE_CHUNK_SIZE) return false;
+		u32 count;
+		if(!read32le(&count,is) || count != job.count) return false;
+		for(u32 i=0;i<count;i++)
+			if(!read32le(&job.sizes[i],is)) return false;
+		for(u32 i=0;i<count;i++)
+		{
+			u32 size = job.sizes[i] & ~SAVESTATE_CHUNK_STORED;
+			if(size > SAVESTATE_CHUNK_SIZE) return false;
+			job.chunks[i].resize(size);
+			if(size != 0) is->fread(&job.chunks[i][0],size);
+			if(is->fail()) return false;
+		}
+		if(!savestate_runchunks(job))
+			return false;
+	} else if(ssversion != SAVESTATE_VERSION) {
+		return false;
+	} else if(comprlen != 0xFFFFFFFF) {
 #ifndef HAVE_LIBZ
 		//without libz, we can't decompress this savestate
 		return false;
@@ -1197,37 +1695,502 @@ bool savestate_load(const char *file_name)
 	return savestate_load(&f);
 }
 
-static std::stack<EMUFILE_MEMORY*> rewindFreeList;
-static std::vector<EMUFILE_MEMORY*> rewindbuffer;
+SavestateCheckpoint::SavestateCheckpoint()
+	: valid(false)
+	, copiedPages(0)
+{
+}
+
+void SavestateCheckpoint::save()
+{
+#ifdef HAVE_JIT 
+	if (arm_cpubase)
+		arm_cpubase->Sync();
+#endif
+
+	state.clear();
+	EMUFILE_MEMORY ms(&state);
+	writechunks(&ms, SF_MEM_CHECKPOINT);
+	state.resize(ms.size());
+
+	const u32 mainSize = _MMU_MAIN_MEM_MASK + 1;
+	const u32 mainPages = mainSize >> MAIN_MEM_GENERATION_SHIFT;
+	const u32 vramPages = sizeof(MMU.ARM9_LCD) >> 14;
+
+	if(!valid || mainMem.size() != mainSize)
+	{
+		mainMem.assign(MMU.MAIN_MEM, MMU.MAIN_MEM + mainSize);
+		mainGeneration.assign(main_mem_page_generation, main_mem_page_generation + mainPages);
+		vram.assign(MMU.ARM9_LCD, MMU.ARM9_LCD + sizeof(MMU.ARM9_LCD));
+		vramGeneration.assign(vram_page_generation, vram_page_generation + vramPages);
+		copiedPages = mainPages + vramPages;
+		valid = true;
+		return;
+	}
+
+	//bring the copy up to date with whatever was written since it was last synced
+	copiedPages = 0;
+	for(u32 page=0;page<mainPages;page++)
+	{
+		if(mainGeneration[page] == main_mem_page_generation[page])
+			continue;
+		const u32 ofs = page << MAIN_MEM_GENERATION_SHIFT;
+		memcpy(&mainMem[ofs], MMU.MAIN_MEM + ofs, 1<<MAIN_MEM_GENERATION_SHIFT);
+		mainGeneration[page] = main_mem_page_generation[page];
+		copiedPages++;
+	}
+	for(u32 page=0;page<vramPages;page++)
+	{
+		if(vramGeneration[page] == vram_page_generation[page])
+			continue;
+		const u32 ofs = page << 14;
+		memcpy(&vram[ofs], MMU.ARM9_LCD + ofs, 1<<14);
+		vramGeneration[page] = vram_page_generation[page];
+		copiedPages++;
+	}
+}
+
+bool SavestateCheckpoint::load()
+{
+	if(!valid || mainMem.size() != _MMU_MAIN_MEM_MASK + 1)
+		return false;
+
+	const u32 mainPages = (u32)mainGeneration.size();
+	const u32 vramPages = (u32)vramGeneration.size();
+
+	//put back only the pages written since the copy was last synced.
+	//they still count as written, so caches and other checkpoints notice them
+	copiedPages = 0;
+	bool vramRestored = false;
+	for(u32 page=0;page<mainPages;page++)
+	{
+		if(mainGeneration[page] == main_mem_page_generation[page])
+			continue;
+		const u32 ofs = page << MAIN_MEM_GENERATION_SHIFT;
+		memcpy(MMU.MAIN_MEM + ofs, &mainMem[ofs], 1<<MAIN_MEM_GENERATION_SHIFT);
+#ifdef HAVE_JIT
+		if (arm_cpubase)
+		{
+			arm_cpubase->Clear[ARMCPU_ARM9](0x02000000 + ofs, 1<<MAIN_MEM_GENERATION_SHIFT);
+			arm_cpubase->Clear[ARMCPU_ARM7](0x02000000 + ofs, 1<<MAIN_MEM_GENERATION_SHIFT);
+		}
+#endif
+		MMU_MAINnoteWrite(ofs);
+		mainGeneration[page] = main_mem_page_generation[page];
+		copiedPages++;
+	}
+	for(u32 page=0;page<vramPages;page++)
+	{
+		if(vramGeneration[page] == vram_page_generation[page])
+			continue;
+		const u32 ofs = page << 14;
+		memcpy(MMU.ARM9_LCD + ofs, &vram[ofs], 1<<14);
+		MMU_VRAMnoteWrite(ofs);
+#ifdef HAVE_JIT
+		if (arm_cpubase)
+			arm_cpubase->Clear[ARMCPU_ARM9](0x06800000 + ofs, 1<<14);
+#endif
+		vramGeneration[page] = vram_page_generation[page];
+		copiedPages++;
+		vramRestored = true;
+	}
+
+	EMUFILE_MEMORY ms(&state);
+	if(!ReadStateChunks(&ms,(s32)state.size()))
+		return false;
+
+#ifdef HAVE_JIT
+	//the chunks put itcm and the wram of both cpus back wholesale, so no code compiled from
+	//them can be kept. the arm7 runs code from vram too, through its own mapping of it
+	if (arm_cpubase)
+	{
+		arm_cpubase->Clear[ARMCPU_ARM9](0x00000000, 0x8000); //itcm
+		arm_cpubase->Clear[ARMCPU_ARM9](0x03000000, 0x8000); //shared wram
+		arm_cpubase->Clear[ARMCPU_ARM7](0x03000000, 0x8000); //shared wram
+		arm_cpubase->Clear[ARMCPU_ARM7](0x03800000, 0x10000); //arm7 wram
+		if (vramRestored)
+			arm_cpubase->Clear[ARMCPU_ARM7](0x06000000, 0x40000);
+	}
+#endif
+
+	loadstate(false);
+
+	return true;
+}
+
+//contexts run one after another on the emulation thread, never side by side (see saves.h)
+SavestateContexts::SavestateContexts()
+	: active(-1)
+{
+}
+
+SavestateContexts::~SavestateContexts()
+{
+	for(size_t i=0;i<contexts.size();i++)
+		delete contexts[i];
+}
+
+int SavestateContexts::fork()
+{
+	SavestateCheckpoint* context = new SavestateCheckpoint();
+	context->save();
 
-int rewindstates = 16;
+	for(size_t i=0;i<contexts.size();i++)
+		if(!contexts[i])
+		{
+			contexts[i] = context;
+			return (int)i;
+		}
+	contexts.push_back(context);
+	return (int)contexts.size()-1;
+}
+
+bool SavestateContexts::switchTo(int id)
+{
+	if(id < 0 || id >= (int)contexts.size() || !contexts[id])
+		return false;
+	if(id == active)
+		return true;
+
+	if(active != -1)
+		contexts[active]->save();
+	active = -1;
+	if(!contexts[id]->load())
+		return false;
+	active = id;
+	return true;
+}
+
+void SavestateContexts::discard(int id)
+{
+	if(id < 0 || id >= (int)contexts.size())
+		return;
+	delete contexts[id];
+	contexts[id] = NULL;
+	if(id == active)
+		active = -1;
+}
+
+//rewind keeps a window of snapshots taken every rewindinterval frames. each snapshot is either a
+//keyframe (the whole serialized state) or a delta against the most recent keyframe: a bitmap of
+//the pages that differ, followed by those pages XORed with the keyframe and zero-run encoded.
+//building the delta and deflating it happens on a worker thread, so the emulator only pays for
+//serializing the state into a reused buffer.
+
+int rewindstates = 900;
 int rewindinterval = 4;
+int rewindkeyframeinterval = 60;
 
-void rewindsave () {
+#define REWIND_PAGE_SHIFT 12
+#define REWIND_PAGE_SIZE (1<<REWIND_PAGE_SHIFT)
 
-	if(currFrameCounter % rewindinterval)
+struct RewindSnapshot
+{
+	RewindSnapshot()
+		: keyframe(false)
+		, deflated(false)
+		, refs(1)
+		, size(0)
+		, packedSize(0)
+		, packMicroseconds(0)
+		, base(NULL)
+	{}
+
+	bool keyframe;
+	bool deflated;
+	int refs; //the rewind window, deltas taken against this keyframe, and rewindKeyframe each hold one
+	u32 size; //size of the serialized state
+	u32 packedSize; //size of the payload before deflating
+	u32 packMicroseconds;
+	std::vector<u8> data;
+	RewindSnapshot *base;
+};
+
+static std::deque<RewindSnapshot*> rewindbuffer;
+static RewindSnapshot *rewindKeyframe = NULL;
+static RewindSnapshot *rewindPending = NULL;
+static int rewindSinceKeyframe = 0;
+static u64 rewindBytes = 0;
+static std::vector<u8> rewindState; //the state being snapshotted or restored
+static std::vector<u8> rewindKeyframeState; //rewindKeyframe, uncompressed
+static std::vector<u8> rewindPacked;
+static std::vector<u8> rewindBaseState;
+static Task rewindTask;
+static bool rewindTaskStarted = false;
+static RewindStatistics rewindStats;
+
+static u64 rewind_microseconds()
+{
+#ifdef _WINDOWS
+	LARGE_INTEGER freq, now;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (u64)((double)now.QuadPart * 1000000.0 / (double)freq.QuadPart);
+#else
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (u64)now.tv_sec * 1000000 + now.tv_usec;
+#endif
+}
+
+//returns false if the data had to be stored as is
+static bool rewind_deflate(const u8 *src, u32 len, std::vector<u8> &out)
+{
+#ifdef HAVE_LIBZ
+	uLongf comprlen = compressBound(len);
+	out.resize(comprlen);
+	if(compress2(&out[0], &comprlen, src, len, Z_BEST_SPEED) == Z_OK)
+	{
+		out.resize(comprlen);
+		return true;
+	}
+#endif
+	out.assign(src, src+len);
+	return false;
+}
+
+//returns false if src doesnt inflate to exactly len bytes
+static bool rewind_inflate(const std::vector<u8> &src, bool deflated, u32 len, std::vector<u8> &out)
+{
+	out.resize(len);
+	if(len == 0)
+		return true;
+	if(deflated)
+	{
+#ifdef HAVE_LIBZ
+		uLongf uncomprlen = len;
+		return uncompress(&out[0], &uncomprlen, &src[0], (uLong)src.size()) == Z_OK && uncomprlen == len;
+#else
+		return false;
+#endif
+	}
+	if(src.size() != len)
+		return false;
+	memcpy(&out[0], &src[0], len);
+	return true;
+}
+
+static FORCEINLINE void rewind_put16(std::vector<u8> &out, u32 val)
+{
+	out.push_back((u8)val);
+	out.push_back((u8)(val>>8));
+}
+
+//the xor of a page is stored as runs of [u16 zeros][u16 literals][literals] covering the page
+static void rewind_delta(const std::vector<u8> &state, const std::vector<u8> &key, std::vector<u8> &out)
+{
+	const u32 size = (u32)state.size();
+	const u32 keysize = (u32)key.size();
+	const u32 pages = (size + REWIND_PAGE_SIZE - 1) >> REWIND_PAGE_SHIFT;
+
+	out.assign((pages+7)>>3, 0);
+
+	u8 x[REWIND_PAGE_SIZE];
+	for(u32 page=0;page<pages;page++)
+	{
+		const u32 ofs = page << REWIND_PAGE_SHIFT;
+		const u32 len = std::min<u32>(REWIND_PAGE_SIZE, size - ofs);
+		const u32 keylen = (keysize > ofs) ? std::min(len, keysize - ofs) : 0;
+		const u8 *cur = &state[ofs];
+
+		if(keylen == len && !memcmp(cur, &key[ofs], len))
+			continue;
+
+		out[page>>3] |= 1<<(page&7);
+
+		for(u32 i=0;i<keylen;i++) x[i] = cur[i] ^ key[ofs+i];
+		for(u32 i=keylen;i<len;i++) x[i] = cur[i];
+
+		u32 i = 0;
+		while(i < len)
+		{
+			const u32 zeroStart = i;
+			while(i < len && x[i] == 0) i++;
+			const u32 litStart = i;
+			//a literal run ends at four zeros in a row, which are cheaper as a new run
+			while(i < len && !(x[i] == 0 && i+3 < len && x[i+1] == 0 && x[i+2] == 0 && x[i+3] == 0)) i++;
+			rewind_put16(out, litStart - zeroStart);
+			rewind_put16(out, i - litStart);
+			out.insert(out.end(), x+litStart, x+i);
+		}
+	}
+}
+
+//state must hold the keyframe, truncated or zero extended to the snapshot size.
+//returns false if the delta doesnt fit the state
+static bool rewind_undelta(const std::vector<u8> &packed, std::vector<u8> &state)
+{
+	const u32 size = (u32)state.size();
+	const u32 pages = (size + REWIND_PAGE_SIZE - 1) >> REWIND_PAGE_SHIFT;
+	if(packed.size() < ((pages+7)>>3))
+		return false;
+	if(pages == 0)
+		return true;
+	const u8 *bitmap = &packed[0];
+	const u8 *in = bitmap + ((pages+7)>>3);
+	const u8 *end = bitmap + packed.size();
+
+	for(u32 page=0;page<pages;page++)
+	{
+		if(!(bitmap[page>>3] & (1<<(page&7))))
+			continue;
+
+		const u32 ofs = page << REWIND_PAGE_SHIFT;
+		const u32 len = std::min<u32>(REWIND_PAGE_SIZE, size - ofs);
+		u8 *cur = &state[ofs];
+
+		u32 i = 0;
+		while(i < len)
+		{
+			if(end - in < 4)
+				return false;
+			const u32 zeros = in[0] | (in[1]<<8);
+			const u32 literals = in[2] | (in[3]<<8);
+			in += 4;
+			i += zeros;
+			if(i + literals > len || (u32)(end - in) < literals)
+				return false;
+			for(u32 j=0;j<literals;j++)
+				cur[i++] ^= *in++;
+		}
+	}
+	return true;
+}
+
+static void* rewind_pack(void *param)
+{
+	RewindSnapshot *snap = (RewindSnapshot*)param;
+	const u64 start = rewind_microseconds();
+
+	if(snap->keyframe)
+	{
+		snap->packedSize = snap->size;
+		snap->deflated = rewind_deflate(&rewindKeyframeState[0], snap->size, snap->data);
+	}
+	else
+	{
+		rewind_delta(rewindState, rewindKeyframeState, rewindPacked);
+		snap->packedSize = (u32)rewindPacked.size();
+		snap->deflated = rewind_deflate(&rewindPacked[0], snap->packedSize, snap->data);
+	}
+
+	snap->packMicroseconds = (u32)(rewind_microseconds() - start);
+	return snap;
+}
+
+static void rewind_release(RewindSnapshot *snap)
+{
+	if(--snap->refs != 0)
+		return;
+	if(snap->base)
+		rewind_release(snap->base);
+	rewindBytes -= snap->data.size();
+	delete snap;
+}
+
+//waits for the worker and moves its snapshot into the window
+static void rewind_finish()
+{
+	if(!rewindPending)
 		return;
 
-	//printf("rewindsave"); printf("%d%s", currFrameCounter, "\n");
+	rewindTask.finish();
+	RewindSnapshot *snap = rewindPending;
+	rewindPending = NULL;
 
-	
-	EMUFILE_MEMORY *ms;
-	if(!rewindFreeList.empty()) {
-		ms = rewindFreeList.top();
-		rewindFreeList.pop();
-	} else {
-		ms = new EMUFILE_MEMORY(1024*1024*12);
+	rewindbuffer.push_back(snap);
+	rewindBytes += snap->data.size();
+	rewindStats.lastSnapshotBytes = (u32)snap->data.size();
+	rewindStats.lastStateBytes = snap->size;
+	rewindStats.lastPackMicroseconds = snap->packMicroseconds;
+
+	while((int)rewindbuffer.size() > std::max(rewindstates,1))
+	{
+		RewindSnapshot *old = rewindbuffer.front();
+		rewindbuffer.pop_front();
+		rewind_release(old);
+	}
+}
+
+static void rewind_setkeyframe(RewindSnapshot *snap)
+{
+	if(snap) snap->refs++;
+	if(rewindKeyframe) rewind_release(rewindKeyframe);
+	rewindKeyframe = snap;
+}
+
+//rebuilds the serialized state of a snapshot into out
+//returns false if the snapshot (or its keyframe) turned out to be damaged
+static bool rewind_restore(RewindSnapshot *snap, std::vector<u8> &out)
+{
+	RewindSnapshot *key = snap->keyframe ? snap : snap->base;
+	const std::vector<u8> *keyState = &rewindKeyframeState;
+	if(key != rewindKeyframe)
+	{
+		if(!rewind_inflate(key->data, key->deflated, key->size, rewindBaseState))
+			return false;
+		keyState = &rewindBaseState;
+	}
+
+	out.assign(keyState->begin(), keyState->begin() + std::min<u32>((u32)keyState->size(), snap->size));
+	out.resize(snap->size, 0);
+
+	if(!snap->keyframe)
+	{
+		if(!rewind_inflate(snap->data, snap->deflated, snap->packedSize, rewindPacked))
+			return false;
+		if(!rewind_undelta(rewindPacked, out))
+			return false;
 	}
+	return true;
+}
+
+void rewindsave () {
 
-	if(!savestate_save(ms, Z_NO_COMPRESSION))
+	if(rewindstates <= 0 || currFrameCounter % rewindinterval)
 		return;
 
-	rewindbuffer.push_back(ms);
-	
-	if((int)rewindbuffer.size() > rewindstates) {
-		delete *rewindbuffer.begin();
-		rewindbuffer.erase(rewindbuffer.begin());
+	//printf("rewindsave"); printf("%d%s", currFrameCounter, "\n");
+
+	rewind_finish();
+
+	const u64 start = rewind_microseconds();
+
+#ifdef HAVE_JIT 
+	if (arm_cpubase)
+		arm_cpubase->Sync();
+#endif
+
+	rewindState.clear();
+	EMUFILE_MEMORY ms(&rewindState);
+	writechunks(&ms);
+	rewindState.resize(ms.size());
+
+	RewindSnapshot *snap = new RewindSnapshot();
+	snap->size = (u32)rewindState.size();
+	snap->keyframe = rewindKeyframe == NULL || rewindSinceKeyframe >= rewindkeyframeinterval;
+	if(snap->keyframe)
+	{
+		rewindKeyframeState.swap(rewindState);
+		rewind_setkeyframe(snap);
+		rewindSinceKeyframe = 0;
+	}
+	else
+	{
+		snap->base = rewindKeyframe;
+		rewindKeyframe->refs++;
+		rewindSinceKeyframe++;
 	}
+
+	if(!rewindTaskStarted)
+	{
+		rewindTask.start(false);
+		rewindTaskStarted = true;
+	}
+	rewindPending = snap;
+	rewindTask.execute(rewind_pack, snap);
+
+	rewindStats.lastSaveMicroseconds = (u32)(rewind_microseconds() - start);
 }
 
 void dorewind()
@@ -1237,6 +2200,8 @@ void dorewind()
 
 	//printf("rewind\n");
 
+	rewind_finish();
+
 	int size = rewindbuffer.size();
 
 	if(size < 1) {
@@ -1246,16 +2211,39 @@ void dorewind()
 
 	printf("%d", size);
 
-	EMUFILE_MEMORY* loadms = rewindbuffer[size-1];
-	loadms->fseek(32, SEEK_SET);
+	RewindSnapshot *snap = rewindbuffer.back();
+	if(!rewind_restore(snap, rewindState))
+	{
+		//a snapshot that doesnt unpack is dropped rather than loaded
+		printf("rewind snapshot damaged, dropped\n");
+		rewindbuffer.pop_back();
+		rewind_release(snap);
+		return;
+	}
 
-	ReadStateChunks(loadms,loadms->size()-32);
+	EMUFILE_MEMORY ms(&rewindState);
+	ReadStateChunks(&ms,(s32)rewindState.size());
 	loadstate();
 
 	if(rewindbuffer.size()>1)
 	{
-		rewindFreeList.push(loadms);
 		rewindbuffer.pop_back();
+		rewind_release(snap);
 	}
 
+	//the next snapshot starts a new keyframe from wherever we ended up
+	rewindSinceKeyframe = rewindkeyframeinterval;
+}
+
+const RewindStatistics& rewind_getstatistics()
+{
+	rewind_finish();
+
+	rewindStats.snapshots = (u32)rewindbuffer.size();
+	rewindStats.keyframes = 0;
+	for(size_t i=0;i<rewindbuffer.size();i++)
+		if(rewindbuffer[i]->keyframe)
+			rewindStats.keyframes++;
+	rewindStats.bytes = rewindBytes;
+	return rewindStats;
 }
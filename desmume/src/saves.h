@@ -21,6 +21,7 @@
 #define _SRAM_H
 
 #include "types.h"
+#include <vector>
 
 #define NB_STATES 10
 
@@ -66,7 +67,96 @@ void loadstate_slot(int num);
 bool savestate_load(class EMUFILE* is);
 bool savestate_save(class EMUFILE* outstream, int compressionLevel);
 
+//compression used for savestates. states saved to a file are compressed and written on worker threads
+//after the emulator has serialized them; savestate_flush() waits for a save still in flight
+enum SavestateCodec
+{
+	SAVESTATE_CODEC_NONE = 0,
+	SAVESTATE_CODEC_ZLIB = 1,
+	SAVESTATE_CODEC_FAST = 2, //an lz4-style codec, much faster than zlib but bigger
+};
+extern int savestate_codec;
+void savestate_flush();
+
+#ifdef DESMUME_SELFTEST
+//round trips random data through the fast savestate codec
+bool savestate_selftest();
+#endif
+
+//an in-memory savestate that is cheap to take over and over. the first save copies everything;
+//after that main memory and vram are kept as a copy which is only brought up to date for the
+//pages written since it was last synced, and a load only copies back the pages written since.
+//the rest of the emulator state is small and is serialized as usual.
+class SavestateCheckpoint
+{
+public:
+	SavestateCheckpoint();
+
+	void save();
+	bool load();
+
+	bool empty() const { return !valid; }
+
+	//main memory and vram pages copied by the last save or load
+	u32 lastCopiedPages() const { return copiedPages; }
+
+private:
+	bool valid;
+	u32 copiedPages;
+	std::vector<u8> state;
+	std::vector<u8> mainMem, vram;
+	std::vector<u32> mainGeneration, vramGeneration;
+};
+
+//independent copies of the whole emulator, for tools which explore several branches from one point.
+//contexts are not concurrent: the emulator's state lives in globals (MMU, NDS_ARM9/7, gfx3d, SPU_core,
+//the GPUs, the sequencer), so exactly one context is live, and only the emulation thread may fork or switch.
+//switching saves the running context and restores another, which only copies the pages either of them
+//dirtied in between. rollouts wanting several cores have to run one emulator process per core.
+class SavestateContexts
+{
+public:
+	SavestateContexts();
+	~SavestateContexts();
+
+	//clones the emulator as it is now into a new context and returns its id. the running context is unchanged
+	int fork();
+
+	//makes a context the running one. if no context was running, the emulator's current state is dropped
+	bool switchTo(int id);
+
+	void discard(int id);
+
+	//the running context, or -1 if the emulator's state doesnt belong to one
+	int running() const { return active; }
+
+private:
+	std::vector<SavestateCheckpoint*> contexts;
+	int active;
+};
+
 void dorewind();
 void rewindsave();
 
+//snapshots kept, frames between snapshots, and snapshots between keyframes
+extern int rewindstates, rewindinterval, rewindkeyframeinterval;
+
+struct RewindStatistics
+{
+	RewindStatistics()
+		: snapshots(0), keyframes(0), bytes(0)
+		, lastSnapshotBytes(0), lastStateBytes(0)
+		, lastSaveMicroseconds(0), lastPackMicroseconds(0)
+	{}
+
+	u32 snapshots, keyframes;
+	u64 bytes; //everything held, including keyframes kept alive for deltas
+	u32 lastSnapshotBytes; //compressed size of the newest snapshot
+	u32 lastStateBytes; //its uncompressed size
+	u32 lastSaveMicroseconds; //time the emulator spent serializing it
+	u32 lastPackMicroseconds; //time the worker spent delta encoding and compressing it
+};
+
+const RewindStatistics& rewind_getstatistics();
+
 #endif
@@ -17,10 +17,10 @@
 	along with the this software.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stdlib.h>
 #include <string.h>
 #include <algorithm>
 #include <assert.h>
-#include <map>
 
 #include "texcache.h"
 
@@ -30,6 +30,16 @@
 #include "gfx3d.h"
 #include "NDSSystem.h"
 
+#ifdef ENABLE_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef ENABLE_SSSE3
+#include <tmmintrin.h>
+#endif
+#ifdef ENABLE_AVX2
+#include <immintrin.h>
+#endif
+
 using std::min;
 using std::max;
 
@@ -38,6 +48,42 @@ using std::max;
 
 #define CONVERT(color,alpha) ((TEXFORMAT == TexFormat_32bpp)?(RGB15TO32(color,alpha)):RGB15TO6665(color,alpha))
 
+static const u64 kTexCacheHashMul = 0xC6A4A7935BD1E995ULL;
+
+static FORCEINLINE u64 TexCache_HashMix(u64 h, u64 k)
+{
+	k *= kTexCacheHashMul;
+	k ^= k >> 47;
+	k *= kTexCacheHashMul;
+	h ^= k;
+	h *= kTexCacheHashMul;
+	return h;
+}
+
+//a fast 64bit hash (murmur64a style) used to identify texture data in the cache
+static u64 TexCache_HashBytes(const u8* data, u32 len, u64 h)
+{
+	h ^= len * kTexCacheHashMul;
+	while(len >= 8)
+	{
+		u64 k;
+		memcpy(&k,data,8);
+		h = TexCache_HashMix(h,k);
+		data += 8;
+		len -= 8;
+	}
+	if(len)
+	{
+		u64 k = 0;
+		memcpy(&k,data,len);
+		h = TexCache_HashMix(h,k);
+	}
+	h ^= h >> 47;
+	h *= kTexCacheHashMul;
+	h ^= h >> 47;
+	return h;
+}
+
 //This class represents a number of regions of memory which should be viewed as contiguous
 class MemSpan
 {
@@ -45,7 +91,7 @@ public:
 	static const int MAXSIZE = 17; //max size for textures: 1024*1024*2 bytes / 128*1024 banks + 1 for wraparound
 
 	MemSpan() 
-		: numItems(0), size(0)
+		: numItems(0), size(0), slots(0)
 	{}
 
 	int numItems;
@@ -59,22 +105,32 @@ public:
 
 	int size;
 
-	//this MemSpan shall be considered the first argument to a standard memcmp
-	//the length shall be as specified in this MemSpan, unless you specify otherwise
-	int memcmp(void* buf2, int size=-1)
+	//the texture (or texture palette) slots the items lie in, one bit each
+	u32 slots;
+
+	//hashes the contents of the memspan into the running hash
+	u64 hash(u64 h) const
+	{
+		for(int i=0;i<numItems;i++)
+			h = TexCache_HashBytes(items[i].ptr,items[i].len,h);
+		return h;
+	}
+
+	//combines the host location of each item with the write generations of the vram pages it covers.
+	//this changes whenever the memory gets remapped or may have been written to.
+	u64 generationSignature(u64 h) const
 	{
-		if(size==-1) size = this->size;
-		size = min(this->size,size);
 		for(int i=0;i<numItems;i++)
 		{
-			Item &item = items[i];
-			int todo = min((int)item.len,size);
-			size -= todo;
-			int temp = ::memcmp(item.ptr,((u8*)buf2)+item.ofs,todo);
-			if(temp) return temp;
-			if(size == 0) break;
+			const Item &item = items[i];
+			h = TexCache_HashMix(h,(u64)(size_t)item.ptr);
+			if(item.len == 0) continue;
+			const u32 firstPage = (u32)(item.ptr - MMU.ARM9_LCD)>>14;
+			const u32 lastPage = (u32)(item.ptr + item.len - 1 - MMU.ARM9_LCD)>>14;
+			for(u32 page=firstPage;page<=lastPage;page++)
+				h = TexCache_HashMix(h,vram_page_generation[page]);
 		}
-		return 0;
+		return h;
 	}
 
 	//TODO - get rid of duplication between these two methods.
@@ -139,6 +195,7 @@ static MemSpan MemSpan_TexMem(u32 ofs, u32 len)
 		MemSpan::Item &curr = ret.items[ret.numItems++];
 		curr.start = ofs&0x1FFFF;
 		u32 slot = (ofs>>17)&3; //slots will wrap around
+		ret.slots |= 1<<slot;
 		curr.len = min(len,0x20000-curr.start);
 		curr.ofs = currofs;
 		len -= curr.len;
@@ -169,6 +226,7 @@ static MemSpan MemSpan_TexPalette(u32 ofs, u32 len, bool silent)
 			PROGINFO("Texture palette overruns texture memory. Wrapping at palette slot 0.\n");
 			slot -= 5;
 		}
+		ret.slots |= 1<<slot;
 		curr.len = min(len,0x4000-curr.start);
 		curr.ofs = currofs;
 		len -= curr.len;
@@ -200,17 +258,708 @@ static void DebugDumpTexture(TexCacheItem* item)
 }
 #endif
 
+//------------------------------------------------------------
+//texel decoding kernels.
+//the palettized formats are decoded through a table of finished texels built once per texture from its palette,
+//so the per-texel work is only a table lookup. the SSSE3/AVX2 paths produce exactly the same output as the plain ones.
+
+//decodes texels which are whole bytes (I8, A3I5, A5I3) through a 256 entry table
+static u32* TexCache_DecodeBytes(const u8 *src, u32 len, const u32 *lut, u32 *dst)
+{
+	u32 i = 0;
+#ifdef ENABLE_AVX2
+	for(;i+8<=len;i+=8)
+	{
+		const __m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src+i)));
+		_mm256_storeu_si256((__m256i*)(dst+i), _mm256_i32gather_epi32((const int*)lut, idx, 4));
+	}
+#endif
+	for(;i<len;i++)
+		dst[i] = lut[src[i]];
+	return dst+len;
+}
+
+#ifdef ENABLE_SSSE3
+//splits a table of 16 texels into its byte planes, so that pshufb can look up 16 texels at once
+static FORCEINLINE void TexCache_LoadPlanes(const u32 *lut, __m128i planes[4])
+{
+	CACHE_ALIGN u8 bytes[4][16];
+	for(int i=0;i<16;i++)
+		for(int b=0;b<4;b++)
+			bytes[b][i] = (u8)(lut[i]>>(b*8));
+	for(int b=0;b<4;b++)
+		planes[b] = _mm_load_si128((const __m128i*)bytes[b]);
+}
+
+//looks up 16 texel indices (0-15) and stores the 16 resulting texels
+static FORCEINLINE void TexCache_StoreLookup16(const __m128i planes[4], const __m128i idx, u32 *dst)
+{
+	const __m128i b0 = _mm_shuffle_epi8(planes[0],idx);
+	const __m128i b1 = _mm_shuffle_epi8(planes[1],idx);
+	const __m128i b2 = _mm_shuffle_epi8(planes[2],idx);
+	const __m128i b3 = _mm_shuffle_epi8(planes[3],idx);
+	const __m128i lo01 = _mm_unpacklo_epi8(b0,b1);
+	const __m128i hi01 = _mm_unpackhi_epi8(b0,b1);
+	const __m128i lo23 = _mm_unpacklo_epi8(b2,b3);
+	const __m128i hi23 = _mm_unpackhi_epi8(b2,b3);
+	_mm_storeu_si128((__m128i*)dst+0, _mm_unpacklo_epi16(lo01,lo23));
+	_mm_storeu_si128((__m128i*)dst+1, _mm_unpackhi_epi16(lo01,lo23));
+	_mm_storeu_si128((__m128i*)dst+2, _mm_unpacklo_epi16(hi01,hi23));
+	_mm_storeu_si128((__m128i*)dst+3, _mm_unpackhi_epi16(hi01,hi23));
+}
+#endif
+
+//decodes 2bit texels through a 16 entry table (only the first 4 are used)
+static u32* TexCache_DecodeI2(const u8 *src, u32 len, const u32 *lut, u32 *dst)
+{
+	u32 i = 0;
+#ifdef ENABLE_SSSE3
+	__m128i planes[4];
+	TexCache_LoadPlanes(lut,planes);
+	const __m128i mask = _mm_set1_epi8(0x03);
+	for(;i+16<=len;i+=16,dst+=64)
+	{
+		const __m128i bytes = _mm_loadu_si128((const __m128i*)(src+i));
+		const __m128i i0 = _mm_and_si128(bytes,mask);
+		const __m128i i1 = _mm_and_si128(_mm_srli_epi16(bytes,2),mask);
+		const __m128i i2 = _mm_and_si128(_mm_srli_epi16(bytes,4),mask);
+		const __m128i i3 = _mm_and_si128(_mm_srli_epi16(bytes,6),mask);
+		const __m128i lo01 = _mm_unpacklo_epi8(i0,i1);
+		const __m128i hi01 = _mm_unpackhi_epi8(i0,i1);
+		const __m128i lo23 = _mm_unpacklo_epi8(i2,i3);
+		const __m128i hi23 = _mm_unpackhi_epi8(i2,i3);
+		TexCache_StoreLookup16(planes,_mm_unpacklo_epi16(lo01,lo23),dst);
+		TexCache_StoreLookup16(planes,_mm_unpackhi_epi16(lo01,lo23),dst+16);
+		TexCache_StoreLookup16(planes,_mm_unpacklo_epi16(hi01,hi23),dst+32);
+		TexCache_StoreLookup16(planes,_mm_unpackhi_epi16(hi01,hi23),dst+48);
+	}
+#endif
+	for(;i<len;i++)
+	{
+		const u8 bits = src[i];
+		*dst++ = lut[bits&3];
+		*dst++ = lut[(bits>>2)&3];
+		*dst++ = lut[(bits>>4)&3];
+		*dst++ = lut[bits>>6];
+	}
+	return dst;
+}
+
+//decodes 4bit texels through a 16 entry table
+static u32* TexCache_DecodeI4(const u8 *src, u32 len, const u32 *lut, u32 *dst)
+{
+	u32 i = 0;
+#ifdef ENABLE_SSSE3
+	__m128i planes[4];
+	TexCache_LoadPlanes(lut,planes);
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	for(;i+16<=len;i+=16,dst+=32)
+	{
+		const __m128i bytes = _mm_loadu_si128((const __m128i*)(src+i));
+		const __m128i lo = _mm_and_si128(bytes,mask);
+		const __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes,4),mask);
+		TexCache_StoreLookup16(planes,_mm_unpacklo_epi8(lo,hi),dst);
+		TexCache_StoreLookup16(planes,_mm_unpackhi_epi8(lo,hi),dst+16);
+	}
+#endif
+	for(;i<len;i++)
+	{
+		const u8 bits = src[i];
+		*dst++ = lut[bits&0xF];
+		*dst++ = lut[bits>>4];
+	}
+	return dst;
+}
+
+//decodes direct color texels. the color expansion is done with arithmetic that matches the conversion tables.
+template<TexCache_TexFormat TEXFORMAT>
+static u32* TexCache_Decode16bpp(const u16 *src, u32 count, u32 *dst)
+{
+	const u32 opaqueColor = TEXFORMAT==TexFormat_32bpp?255:31;
+	u32 i = 0;
+
+#ifdef ENABLE_AVX2
+	{
+		const __m256i mask5 = _mm256_set1_epi16(0x1F);
+		const __m256i one = _mm256_set1_epi16(1);
+		const __m256i alphaMask = _mm256_set1_epi16(opaqueColor<<8);
+		for(;i+16<=count;i+=16)
+		{
+			const __m256i c = _mm256_loadu_si256((const __m256i*)(src+i));
+			__m256i r = _mm256_and_si256(c,mask5);
+			__m256i g = _mm256_and_si256(_mm256_srli_epi16(c,5),mask5);
+			__m256i b = _mm256_and_si256(_mm256_srli_epi16(c,10),mask5);
+			if(TEXFORMAT == TexFormat_32bpp)
+			{
+				r = _mm256_or_si256(_mm256_slli_epi16(r,3),_mm256_srli_epi16(r,2));
+				g = _mm256_or_si256(_mm256_slli_epi16(g,3),_mm256_srli_epi16(g,2));
+				b = _mm256_or_si256(_mm256_slli_epi16(b,3),_mm256_srli_epi16(b,2));
+			}
+			else
+			{
+				r = _mm256_add_epi16(_mm256_slli_epi16(r,1),one);
+				g = _mm256_add_epi16(_mm256_slli_epi16(g,1),one);
+				b = _mm256_add_epi16(_mm256_slli_epi16(b,1),one);
+			}
+			const __m256i a = _mm256_and_si256(_mm256_srai_epi16(c,15),alphaMask);
+			const __m256i rg = _mm256_or_si256(r,_mm256_slli_epi16(g,8));
+			const __m256i ba = _mm256_or_si256(b,a);
+			//the unpacks work within each 128bit lane, so put the lanes back in texel order
+			const __m256i lo = _mm256_unpacklo_epi16(rg,ba);
+			const __m256i hi = _mm256_unpackhi_epi16(rg,ba);
+			_mm256_storeu_si256((__m256i*)(dst+i), _mm256_permute2x128_si256(lo,hi,0x20));
+			_mm256_storeu_si256((__m256i*)(dst+i+8), _mm256_permute2x128_si256(lo,hi,0x31));
+		}
+	}
+#endif
+
+#ifdef ENABLE_SSE2
+	{
+		const __m128i mask5 = _mm_set1_epi16(0x1F);
+		const __m128i one = _mm_set1_epi16(1);
+		const __m128i alphaMask = _mm_set1_epi16(opaqueColor<<8);
+		for(;i+8<=count;i+=8)
+		{
+			const __m128i c = _mm_loadu_si128((const __m128i*)(src+i));
+			__m128i r = _mm_and_si128(c,mask5);
+			__m128i g = _mm_and_si128(_mm_srli_epi16(c,5),mask5);
+			__m128i b = _mm_and_si128(_mm_srli_epi16(c,10),mask5);
+			if(TEXFORMAT == TexFormat_32bpp)
+			{
+				r = _mm_or_si128(_mm_slli_epi16(r,3),_mm_srli_epi16(r,2));
+				g = _mm_or_si128(_mm_slli_epi16(g,3),_mm_srli_epi16(g,2));
+				b = _mm_or_si128(_mm_slli_epi16(b,3),_mm_srli_epi16(b,2));
+			}
+			else
+			{
+				r = _mm_add_epi16(_mm_slli_epi16(r,1),one);
+				g = _mm_add_epi16(_mm_slli_epi16(g,1),one);
+				b = _mm_add_epi16(_mm_slli_epi16(b,1),one);
+			}
+			const __m128i a = _mm_and_si128(_mm_srai_epi16(c,15),alphaMask);
+			const __m128i rg = _mm_or_si128(r,_mm_slli_epi16(g,8));
+			const __m128i ba = _mm_or_si128(b,a);
+			_mm_storeu_si128((__m128i*)(dst+i), _mm_unpacklo_epi16(rg,ba));
+			_mm_storeu_si128((__m128i*)(dst+i+4), _mm_unpackhi_epi16(rg,ba));
+		}
+	}
+#endif
+
+	for(;i<count;i++)
+	{
+		const u16 c = src[i];
+		dst[i] = CONVERT(c&0x7FFF,(c&0x8000)?opaqueColor:0);
+	}
+	return dst+count;
+}
+
+#ifdef ENABLE_SSSE3
+//pshufb controls which expand one row of a 4x4 block (four 2bit indices) into four texels picked from the block's 4 colors
+static CACHE_ALIGN u8 texcache_4x4RowShuffle[256][16];
+static bool texcache_4x4RowShuffleReady = false;
+
+static void TexCache_Init4x4RowShuffle()
+{
+	for(int row=0;row<256;row++)
+		for(int texel=0;texel<4;texel++)
+			for(int b=0;b<4;b++)
+				texcache_4x4RowShuffle[row][texel*4+b] = (u8)((((row>>(texel*2))&3)<<2) + b);
+	texcache_4x4RowShuffleReady = true;
+}
+#endif
+
+//converts a texture from vram into the requested decoded format
+template<TexCache_TexFormat TEXFORMAT>
+static void TexCache_DecodeTexture(u32 format, u32 textureMode, u32 sizeX, u32 sizeY, const MemSpan &ms, const u16 *pal, u32 paletteAddress, u32 *dwdst)
+{
+	const u32 opaqueColor = TEXFORMAT==TexFormat_32bpp?255:31;
+	u32 palZeroTransparent = (1-((format>>29)&1))*opaqueColor;
+
+	//palettized formats decode through this table of finished texels
+	CACHE_ALIGN u32 lut[256];
+
+	switch (textureMode)
+	{
+	case TEXMODE_A3I5:
+		{
+			for(u32 i=0;i<256;i++)
+			{
+				u16 c = pal[i&31];
+				u8 alpha = i>>5;
+				if(TEXFORMAT == TexFormat_15bpp)
+					lut[i] = RGB15TO6665(c,material_3bit_to_5bit[alpha]);
+				else
+					lut[i] = RGB15TO32(c,material_3bit_to_8bit[alpha]);
+			}
+			for(int j=0;j<ms.numItems;j++)
+				dwdst = TexCache_DecodeBytes(ms.items[j].ptr,ms.items[j].len,lut,dwdst);
+			break;
+		}
+
+	case TEXMODE_I2:
+		{
+			for(u32 i=0;i<4;i++)
+				lut[i] = CONVERT(pal[i],(i == 0) ? palZeroTransparent : opaqueColor);
+			memset(lut+4,0,12*sizeof(u32));
+			for(int j=0;j<ms.numItems;j++)
+				dwdst = TexCache_DecodeI2(ms.items[j].ptr,ms.items[j].len,lut,dwdst);
+			break;
+		}
+	case TEXMODE_I4:
+		{
+			for(u32 i=0;i<16;i++)
+				lut[i] = CONVERT(pal[i],(i == 0) ? palZeroTransparent : opaqueColor);
+			for(int j=0;j<ms.numItems;j++)
+				dwdst = TexCache_DecodeI4(ms.items[j].ptr,ms.items[j].len,lut,dwdst);
+			break;
+		}
+	case TEXMODE_I8:
+		{
+			for(u32 i=0;i<256;i++)
+				lut[i] = CONVERT(pal[i],(i == 0) ? palZeroTransparent : opaqueColor);
+			for(int j=0;j<ms.numItems;j++)
+				dwdst = TexCache_DecodeBytes(ms.items[j].ptr,ms.items[j].len,lut,dwdst);
+		}
+		break;
+	case TEXMODE_4X4:
+		{
+			//RGB16TO32 is used here because the other conversion macros result in broken interpolation logic
+
+			if(ms.numItems != 1) {
+				PROGINFO("Your 4x4 texture has overrun its texture slot.\n");
+			}
+			//this check isnt necessary since the addressing is tied to the texture data which will also run out:
+			//if(msIndex.numItems != 1) PROGINFO("Your 4x4 texture index has overrun its slot.\n");
+
+#define PAL4X4(offset) ( *(u16*)( MMU.texInfo.texPalSlot[((paletteAddress + (offset)*2)>>14)&0x7] + ((paletteAddress + (offset)*2)&0x3FFF) ) )
+
+			u16* slot1;
+			u32* map = (u32*)ms.items[0].ptr;
+			u32 limit = ms.items[0].len<<2;
+			u32 d = 0;
+			if ( (format & 0xc000) == 0x8000)
+				// texel are in slot 2
+				slot1=(u16*)&MMU.texInfo.textureSlotAddr[1][((format & 0x3FFF)<<2)+0x010000];
+			else 
+				slot1=(u16*)&MMU.texInfo.textureSlotAddr[1][(format & 0x3FFF)<<2];
+
+#ifdef ENABLE_SSSE3
+			if(!texcache_4x4RowShuffleReady) TexCache_Init4x4RowShuffle();
+#endif
+
+			u16 yTmpSize = (sizeY>>2);
+			u16 xTmpSize = (sizeX>>2);
+
+			//this is flagged whenever a 4x4 overruns its slot.
+			//i am guessing we just generate black in that case
+			bool dead = false;
+
+			for (int y = 0; y < yTmpSize; y ++)
+			{
+				u32 tmpPos[4]={(y<<2)*sizeX,((y<<2)+1)*sizeX,
+					((y<<2)+2)*sizeX,((y<<2)+3)*sizeX};
+				for (int x = 0; x < xTmpSize; x ++, d++)
+				{
+					if(d >= limit)
+						dead = true;
+
+					if(dead) {
+						for (int sy = 0; sy < 4; sy++)
+						{
+							u32 currentPos = (x<<2) + tmpPos[sy];
+							dwdst[currentPos] = dwdst[currentPos+1] = dwdst[currentPos+2] = dwdst[currentPos+3] = 0;
+						}
+						continue;
+					}
+
+					u32 currBlock	= map[d];
+					u16 pal1		= slot1[d];
+					u16 pal1offset	= (pal1 & 0x3FFF)<<1;
+					u8  mode		= pal1>>14;
+					u32 tmp_col[4];
+					
+					tmp_col[0]=RGB16TO32(PAL4X4(pal1offset),255);
+					tmp_col[1]=RGB16TO32(PAL4X4(pal1offset+1),255);
+
+					switch (mode) 
+					{
+					case 0:
+						tmp_col[2]=RGB16TO32(PAL4X4(pal1offset+2),255);
+						tmp_col[3]=RGB16TO32(0x7FFF,0);
+						break;
+					case 1:
+						tmp_col[2]=(((tmp_col[0]&0xFF)+(tmp_col[1]&0xff))>>1)|
+							(((tmp_col[0]&(0xFF<<8))+(tmp_col[1]&(0xFF<<8)))>>1)|
+							(((tmp_col[0]&(0xFF<<16))+(tmp_col[1]&(0xFF<<16)))>>1)|
+							(0xff<<24);
+						tmp_col[3]=RGB16TO32(0x7FFF,0);
+						break;
+					case 2:
+						tmp_col[2]=RGB16TO32(PAL4X4(pal1offset+2),255);
+						tmp_col[3]=RGB16TO32(PAL4X4(pal1offset+3),255);
+						break;
+					case 3: 
+						{
+							u32 red1, red2;
+							u32 green1, green2;
+							u32 blue1, blue2;
+							u16 tmp1, tmp2;
+
+							red1=tmp_col[0]&0xff;
+							green1=(tmp_col[0]>>8)&0xff;
+							blue1=(tmp_col[0]>>16)&0xff;
+							red2=tmp_col[1]&0xff;
+							green2=(tmp_col[1]>>8)&0xff;
+							blue2=(tmp_col[1]>>16)&0xff;
+
+							tmp1=((red1*5+red2*3)>>6)|
+								(((green1*5+green2*3)>>6)<<5)|
+								(((blue1*5+blue2*3)>>6)<<10);
+							tmp2=((red2*5+red1*3)>>6)|
+								(((green2*5+green1*3)>>6)<<5)|
+								(((blue2*5+blue1*3)>>6)<<10);
+
+							tmp_col[2]=RGB16TO32(tmp1,255);
+							tmp_col[3]=RGB16TO32(tmp2,255);
+							break;
+						}
+					}
+
+					if(TEXFORMAT==TexFormat_15bpp)
+					{
+						for(int i=0;i<4;i++)
+						{
+							tmp_col[i] >>= 2;
+							tmp_col[i] &= 0x3F3F3F3F;
+							u32 a = tmp_col[i]>>24;
+							tmp_col[i] &= 0x00FFFFFF;
+							tmp_col[i] |= (a>>1)<<24;
+						}
+					}
+
+					//TODO - this could be more precise for 32bpp mode (run it through the color separation table)
+
+					//set all 16 texels
+#ifdef ENABLE_SSSE3
+					const __m128i cols = _mm_loadu_si128((const __m128i*)tmp_col);
+#endif
+					for (int sy = 0; sy < 4; sy++)
+					{
+						// Texture offset
+						u32 currentPos = (x<<2) + tmpPos[sy];
+						u8 currRow = (u8)((currBlock>>(sy<<3))&0xFF);
+
+#ifdef ENABLE_SSSE3
+						_mm_storeu_si128((__m128i*)(dwdst+currentPos), _mm_shuffle_epi8(cols,_mm_load_si128((const __m128i*)texcache_4x4RowShuffle[currRow])));
+#else
+						dwdst[currentPos] = tmp_col[currRow&3];
+						dwdst[currentPos+1] = tmp_col[(currRow>>2)&3];
+						dwdst[currentPos+2] = tmp_col[(currRow>>4)&3];
+						dwdst[currentPos+3] = tmp_col[(currRow>>6)&3];
+#endif
+					}
+
+
+				}
+			}
+
+
+			break;
+		}
+	case TEXMODE_A5I3:
+		{
+			for(u32 i=0;i<256;i++)
+			{
+				u16 c = pal[i&0x07];
+				u8 alpha = (i>>3);
+				if(TEXFORMAT == TexFormat_15bpp)
+					lut[i] = RGB15TO6665(c,alpha);
+				else
+					lut[i] = RGB15TO32(c,material_5bit_to_8bit[alpha]);
+			}
+			for(int j=0;j<ms.numItems;j++)
+				dwdst = TexCache_DecodeBytes(ms.items[j].ptr,ms.items[j].len,lut,dwdst);
+			break;
+		}
+	case TEXMODE_16BPP:
+		{
+			for(int j=0;j<ms.numItems;j++)
+				dwdst = TexCache_Decode16bpp<TEXFORMAT>((const u16*)ms.items[j].ptr,ms.items[j].len>>1,dwdst);
+			break;
+		}
+	} //switch(texture format)
+}
+
+#ifdef DESMUME_SELFTEST
+//the texel decoders as they were before the table driven kernels, one texel at a time
+template<TexCache_TexFormat TEXFORMAT>
+static void TexCache_DecodeTextureReference(u32 format, u32 textureMode, const MemSpan &ms, const u16 *pal, u32 *dwdst)
+{
+	const u32 opaqueColor = TEXFORMAT==TexFormat_32bpp?255:31;
+	u32 palZeroTransparent = (1-((format>>29)&1))*opaqueColor;
+
+	for(int j=0;j<ms.numItems;j++)
+	{
+		const u8 *adr = ms.items[j].ptr;
+		for(u32 x = 0; x < ms.items[j].len; x++, adr++)
+		{
+			switch (textureMode)
+			{
+			case TEXMODE_A3I5:
+				if(TEXFORMAT == TexFormat_15bpp)
+					*dwdst++ = RGB15TO6665(pal[*adr&31],material_3bit_to_5bit[*adr>>5]);
+				else
+					*dwdst++ = RGB15TO32(pal[*adr&31],material_3bit_to_8bit[*adr>>5]);
+				break;
+			case TEXMODE_I2:
+				for(int s=0;s<8;s+=2)
+				{
+					u8 bits = ((*adr)>>s)&0x3;
+					*dwdst++ = CONVERT(pal[bits],(bits == 0) ? palZeroTransparent : opaqueColor);
+				}
+				break;
+			case TEXMODE_I4:
+				for(int s=0;s<8;s+=4)
+				{
+					u8 bits = ((*adr)>>s)&0xF;
+					*dwdst++ = CONVERT(pal[bits],(bits == 0) ? palZeroTransparent : opaqueColor);
+				}
+				break;
+			case TEXMODE_I8:
+				*dwdst++ = CONVERT(pal[*adr],(*adr == 0) ? palZeroTransparent : opaqueColor);
+				break;
+			case TEXMODE_A5I3:
+				if(TEXFORMAT == TexFormat_15bpp)
+					*dwdst++ = RGB15TO6665(pal[*adr&0x07],*adr>>3);
+				else
+					*dwdst++ = RGB15TO32(pal[*adr&0x07],material_5bit_to_8bit[*adr>>3]);
+				break;
+			case TEXMODE_16BPP:
+				if(x&1)
+				{
+					u16 c = LE_TO_LOCAL_16(*(const u16*)(adr-1));
+					*dwdst++ = CONVERT(c&0x7FFF,(c&0x8000)?opaqueColor:0);
+				}
+				break;
+			}
+		}
+	}
+}
+
+template<TexCache_TexFormat TEXFORMAT>
+static bool TexCache_SelfTestFormat(SelfTestRandom &rng, u32 textureMode, u32 format)
+{
+	static u8 vram[4][2048];
+	static u32 expected[4*2048*4], decoded[4*2048*4+16];
+	u16 pal[256];
+
+	for(int i=0;i<256;i++)
+		pal[i] = (u16)rng();
+	for(int i=0;i<4;i++)
+		for(int j=0;j<2048;j++)
+			vram[i][j] = (u8)rng();
+
+	//random item lengths (kept even for 16bpp) leave the kernels with tails of every size
+	MemSpan ms;
+	ms.numItems = 1 + rng()%4;
+	for(int i=0;i<ms.numItems;i++)
+	{
+		ms.items[i].ptr = vram[i] + (rng()&1)*2;
+		ms.items[i].len = (rng()%2000) & ~1;
+	}
+
+	memset(decoded,0,sizeof(decoded));
+	TexCache_DecodeTextureReference<TEXFORMAT>(format,textureMode,ms,pal,expected);
+	TexCache_DecodeTexture<TEXFORMAT>(format,textureMode,0,0,ms,pal,0,decoded);
+
+	u32 texels = 0;
+	for(int i=0;i<ms.numItems;i++)
+		texels += (textureMode==TEXMODE_I2) ? ms.items[i].len*4 : (textureMode==TEXMODE_I4) ? ms.items[i].len*2 : (textureMode==TEXMODE_16BPP) ? ms.items[i].len/2 : ms.items[i].len;
+
+	if(memcmp(expected,decoded,texels*4) != 0)
+		return false;
+	//nothing may be written past the end of the texture
+	for(u32 i=texels;i<texels+16;i++)
+		if(decoded[i] != 0) return false;
+	return true;
+}
+
+//checks the expansion of 4x4 block rows against indexing the block colors directly
+static bool TexCache_SelfTest4x4(SelfTestRandom &rng)
+{
+#ifdef ENABLE_SSSE3
+	if(!texcache_4x4RowShuffleReady) TexCache_Init4x4RowShuffle();
+	for(int row=0;row<256;row++)
+	{
+		u32 tmp_col[4], expected[4], decoded[4];
+		for(int i=0;i<4;i++)
+			tmp_col[i] = (rng()<<16) ^ rng();
+		for(int i=0;i<4;i++)
+			expected[i] = tmp_col[(row>>(i*2))&3];
+		const __m128i cols = _mm_loadu_si128((const __m128i*)tmp_col);
+		_mm_storeu_si128((__m128i*)decoded, _mm_shuffle_epi8(cols,_mm_load_si128((const __m128i*)texcache_4x4RowShuffle[row])));
+		if(memcmp(expected,decoded,sizeof(expected)) != 0)
+			return false;
+	}
+#endif
+	return true;
+}
+
+//runs random texture data through the texel decoders and the old per-texel code and compares the results
+bool TexCache_SelfTest()
+{
+	static const u32 modes[] = { TEXMODE_A3I5, TEXMODE_I2, TEXMODE_I4, TEXMODE_I8, TEXMODE_A5I3, TEXMODE_16BPP };
+	SelfTestRandom rng(0x7E7C);
+	for(int iteration=0;iteration<64;iteration++)
+	{
+		for(u32 m=0;m<ARRAY_SIZE(modes);m++)
+		{
+			const u32 format = (iteration&1)<<29; //color 0 transparent or not
+			if(!TexCache_SelfTestFormat<TexFormat_32bpp>(rng,modes[m],format) || !TexCache_SelfTestFormat<TexFormat_15bpp>(rng,modes[m],format))
+			{
+				printf("TexCache_SelfTest: texture mode %d decodes differently\n",modes[m]);
+				return false;
+			}
+		}
+	}
+	if(!TexCache_SelfTest4x4(rng))
+	{
+		printf("TexCache_SelfTest: 4x4 block rows expand differently\n");
+		return false;
+	}
+	return true;
+}
+#endif
+
+//hands out decode buffers for the texcache.
+//buffers come in power-of-two size classes (decoded textures are always a power of two in size);
+//the small classes are carved out of larger slabs, and freed buffers of every class are kept
+//on free lists so that texture churn doesnt turn into allocator churn.
+class TexCacheArena
+{
+public:
+	TexCacheArena()
+		: slabs(NULL)
+		, retainedBytes(0)
+	{
+		memset(freeLists,0,sizeof(freeLists));
+	}
+
+	~TexCacheArena()
+	{
+		release();
+	}
+
+	u8* alloc(u32 size)
+	{
+		const int sizeClass = classOf(size);
+		FreeBlock* block = freeLists[sizeClass];
+		if(block)
+		{
+			freeLists[sizeClass] = block->next;
+			if(sizeClass > kMaxSlabClass) retainedBytes -= (1<<sizeClass);
+			return (u8*)block;
+		}
+
+		if(sizeClass > kMaxSlabClass)
+			return (u8*)malloc(1<<sizeClass);
+
+		//carve a whole slab into blocks of this class
+		Slab* slab = (Slab*)malloc(sizeof(Slab) + kSlabSize);
+		slab->next = slabs;
+		slabs = slab;
+		u8* mem = (u8*)(slab+1);
+		const u32 blockSize = 1<<sizeClass;
+		for(u32 ofs=blockSize;ofs<kSlabSize;ofs+=blockSize)
+		{
+			FreeBlock* freeBlock = (FreeBlock*)(mem+ofs);
+			freeBlock->next = freeLists[sizeClass];
+			freeLists[sizeClass] = freeBlock;
+		}
+		return mem;
+	}
+
+	void free(u8* ptr, u32 size)
+	{
+		if(!ptr) return;
+		const int sizeClass = classOf(size);
+		if(sizeClass > kMaxSlabClass)
+		{
+			//dont sit on too much memory from huge textures
+			if(retainedBytes + (1<<sizeClass) > kMaxRetainedBytes)
+			{
+				::free(ptr);
+				return;
+			}
+			retainedBytes += (1<<sizeClass);
+		}
+		FreeBlock* block = (FreeBlock*)ptr;
+		block->next = freeLists[sizeClass];
+		freeLists[sizeClass] = block;
+	}
+
+	//gives all memory back. only valid once every buffer has been freed.
+	void release()
+	{
+		for(int i=kMaxSlabClass+1;i<kNumClasses;i++)
+		{
+			while(freeLists[i])
+			{
+				FreeBlock* block = freeLists[i];
+				freeLists[i] = block->next;
+				::free(block);
+			}
+		}
+		memset(freeLists,0,sizeof(freeLists));
+		retainedBytes = 0;
+		while(slabs)
+		{
+			Slab* slab = slabs;
+			slabs = slab->next;
+			::free(slab);
+		}
+	}
+
+private:
+	//decoded textures range from 8x8 to 1024x1024 texels of 4 bytes
+	static const int kMinClass = 8;
+	static const int kNumClasses = 23;
+	static const int kMaxSlabClass = 14;
+	static const u32 kSlabSize = 256*1024;
+	static const u32 kMaxRetainedBytes = 8*1024*1024;
+
+	struct FreeBlock { FreeBlock* next; };
+	struct Slab { Slab* next; u8 pad[16-sizeof(Slab*)]; };
+
+	FreeBlock* freeLists[kNumClasses];
+	Slab* slabs;
+	u32 retainedBytes;
+
+	static int classOf(u32 size)
+	{
+		int sizeClass = kMinClass;
+		while((1u<<sizeClass) < size) sizeClass++;
+		assert(sizeClass < kNumClasses);
+		return sizeClass;
+	}
+};
+
 class TexCache
 {
 public:
 	TexCache()
 		: cache_size(0)
+		, lruHead(NULL)
+		, lruTail(NULL)
+		, numItems(0)
+		, paletteSignature(0)
+		, paletteHash(0)
 	{
-		memset(paletteDump,0,sizeof(paletteDump));
+		memset(buckets,0,sizeof(buckets));
+		memset(&frameStats,0,sizeof(frameStats));
+		memset(&lastFrameStats,0,sizeof(lastFrameStats));
 	}
 
-	TTexCacheItemMultimap index;
-
 	//this ought to be enough for anyone
 	//static const u32 kMaxCacheSize = 64*1024*1024; 
 	//changed by zeromus on 15-dec. I couldnt find any games that were getting anywhere NEAR 64
@@ -220,18 +969,73 @@ public:
 	//this is not really precise, it is off by a constant factor
 	u32 cache_size;
 
+	//items are found through a hash table keyed on the teximage and texpal params (and the decoded format)
+	static const int kBucketBits = 12;
+	TexCacheItem* buckets[1<<kBucketBits];
+
+	//and are kept in least-recently-used order for eviction; the head is the most recently used
+	TexCacheItem *lruHead, *lruTail;
+	u32 numItems;
+
+	TexCacheArena arena;
+
+	TexCacheStatistics frameStats, lastFrameStats;
+
+	//used for verifying the 4x4 textures, which dont carry along their own palette
+	u64 paletteSignature, paletteHash;
+
+	static FORCEINLINE u32 bucketOf(u32 format, u32 texpal, TexCache_TexFormat cacheFormat)
+	{
+		return ((format*0x9E3779B1u) ^ (texpal*0x85EBCA77u) ^ ((u32)cacheFormat*0xC2B2AE3Du)) >> (32-kBucketBits);
+	}
+
+	void lru_unlink(TexCacheItem* item)
+	{
+		if(item->lruPrev) item->lruPrev->lruNext = item->lruNext;
+		else lruHead = item->lruNext;
+		if(item->lruNext) item->lruNext->lruPrev = item->lruPrev;
+		else lruTail = item->lruPrev;
+		item->lruPrev = item->lruNext = NULL;
+	}
+
+	void lru_push_front(TexCacheItem* item)
+	{
+		item->lruPrev = NULL;
+		item->lruNext = lruHead;
+		if(lruHead) lruHead->lruPrev = item;
+		else lruTail = item;
+		lruHead = item;
+	}
+
 	void list_remove(TexCacheItem* item)
 	{
-		index.erase(item->iterator);
+		TexCacheItem** link = &buckets[bucketOf(item->texformat,item->texpal,item->cacheFormat)];
+		while(*link != item) link = &(*link)->hashNext;
+		*link = item->hashNext;
+		item->hashNext = NULL;
+		lru_unlink(item);
+		numItems--;
 		cache_size -= item->decode_len;
 	}
 
 	void list_push_front(TexCacheItem* item)
 	{
-		item->iterator = index.insert(std::make_pair(item->texformat,item));
+		TexCacheItem** bucket = &buckets[bucketOf(item->texformat,item->texpal,item->cacheFormat)];
+		item->hashNext = *bucket;
+		*bucket = item;
+		lru_push_front(item);
+		numItems++;
 		cache_size += item->decode_len;
 	}
 
+	void destroy(TexCacheItem* item)
+	{
+		list_remove(item);
+		arena.free(item->decoded,item->decode_len);
+		item->decoded = NULL;
+		delete item;
+	}
+
 	template<TexCache_TexFormat TEXFORMAT>
 	TexCacheItem* scan(u32 format, u32 texpal)
 	{
@@ -241,16 +1045,25 @@ public:
 		//for each texformat, multiplier from numtexels to numbytes (fixed point 30.2)
 		static const int texSizes[] = {0, 4, 1, 2, 4, 1, 4, 8};
 
-		//used to hold a copy of the palette specified for this texture
-		u16 pal[256];
+		//look for a cached item with these params first.
+		TexCacheItem* curr = buckets[bucketOf(format,texpal,TEXFORMAT)];
+		while(curr && (curr->texformat != format || curr->texpal != texpal || curr->cacheFormat != TEXFORMAT))
+			curr = curr->hashNext;
+
+		//the item matches params, and nothing has been remapped since we last looked at its data. accept it.
+		if(curr && !curr->suspectedInvalid && !curr->assumedInvalid)
+		{
+			frameStats.hits++;
+			lru_unlink(curr);
+			lru_push_front(curr);
+			return curr;
+		}
 
 		u32 textureMode = (unsigned short)((format>>26)&0x07);
 		u32 sizeX=(8 << ((format>>20)&0x07));
 		u32 sizeY=(8 << ((format>>23)&0x07));
 		u32 imageSize = sizeX*sizeY;
 
-		u8 *adr;
-
 		u32 paletteAddress;
 
 		switch (textureMode)
@@ -290,76 +1103,42 @@ public:
 			msIndex = MemSpan_TexMem(indexOffset+indexBase,indexSize);
 		}
 
+		//everything that identifies the source data, short of its contents
+		const u64 seed = TexCache_HashMix(((u64)format<<32)|texpal,TEXFORMAT);
+		const u64 generationSignature = mspal.generationSignature(msIndex.generationSignature(ms.generationSignature(seed)));
 
-		//dump the palette to a temp buffer, so that we don't have to worry about memory mapping.
-		//this isnt such a problem with texture memory, because we read sequentially from it.
-		//however, we read randomly from palette memory, so the mapping is more costly.
-		#ifdef WORDS_BIGENDIAN
-			mspal.dump16(pal);
-		#else
-			mspal.dump(pal);
-		#endif
-
-			//TODO - as a special optimization, keep the last item returned and check it first
-
-		for(std::pair<TTexCacheItemMultimap::iterator,TTexCacheItemMultimap::iterator>
-			iters = index.equal_range(format);
-			iters.first != iters.second;
-			++iters.first)
+		if(curr)
 		{
-			TexCacheItem* curr = iters.first->second;
-			
-			//conditions where we reject matches:
-			//when the teximage or texpal params dont match 
-			//(this is our key for identifying textures in the cache)
-			//NEW: due to using format as a key we dont need to check this anymore
-			//if(curr->texformat != format) continue;
-			if(curr->texpal != texpal) continue;
-
-			//we're being asked for a different format than what we had cached.
-			//TODO - this could be done at the entire cache level instead of checking repeatedly
-			if(curr->cacheFormat != TEXFORMAT) goto REJECT;
-
 			//if the texture is assumed invalid, reject it
-			if(curr->assumedInvalid) goto REJECT; 
+			if(curr->assumedInvalid) goto REJECT;
 
-			//the texture matches params, but isnt suspected invalid. accept it.
-			if(!curr->suspectedInvalid) return curr;
-
-			//we suspect the texture may be invalid. we need to do a byte-for-byte comparison to re-establish that it is valid:
-
-			//when the palettes dont match:
+			//we suspect the texture may be invalid. if none of the vram it came from has been remapped or
+			//written since it was decoded, it is still good; otherwise we have to hash the data to find out.
 			//note that we are considering 4x4 textures to have a palette size of 0.
 			//they really have a potentially HUGE palette, too big for us to handle like a normal palette,
-			//so they go through a different system
-			if(mspal.size != 0 && memcmp(curr->dump.palette,pal,mspal.size)) goto REJECT;
-
-			//when the texture data doesn't match
-			if(ms.memcmp(&curr->dump.texture[0],curr->dump.textureSize)) goto REJECT;
-
-			//if the texture is 4x4 then the index data must match
-			if(textureMode == TEXMODE_4X4)
+			//so they go through a different system (see invalidate())
+			if(curr->generationSignature != generationSignature)
 			{
-				if(msIndex.memcmp(curr->dump.texture + curr->dump.textureSize,curr->dump.indexSize)) goto REJECT; 
+				frameStats.rehashes++;
+				if(curr->contentHash != mspal.hash(msIndex.hash(ms.hash(seed))))
+					goto REJECT;
+				curr->generationSignature = generationSignature;
 			}
 
-			//we found a match. just return it
-			//REMINDER to make it primary/newest when we have smarter code
-			//list_remove(curr);
-			//list_push_front(curr);
+			//we found a match. make it the newest and return it
 			curr->suspectedInvalid = false;
+			frameStats.hits++;
+			lru_unlink(curr);
+			lru_push_front(curr);
 			return curr;
 
 		REJECT:
 			//we found a cached item for the current address, but the data is stale.
 			//for a variety of complicated reasons, we need to throw it out right this instant.
-			list_remove(curr);
-			delete curr;
-			break;
+			destroy(curr);
 		}
 
-		//item was not found. recruit an existing one (the oldest), or create a new one
-		//evict(); //reduce the size of the cache if necessary
+		//item was not found. create a new one
 		//TODO - as a peculiarity of the texcache, eviction must happen after the entire 3d frame runs
 		//to support separate cache and read passes
 		TexCacheItem* newitem = new TexCacheItem();
@@ -373,284 +1152,31 @@ public:
 		newitem->invSizeY=1.0f/((float)(sizeY));
 		newitem->decode_len = sizeX*sizeY*4;
 		newitem->mode = textureMode;
-		newitem->decoded = new u8[newitem->decode_len];
-		list_push_front(newitem);
-		//printf("allocating: up to %d with %d items\n",cache_size,index.size());
-
-		u32 *dwdst = (u32*)newitem->decoded;
-		
-		//dump palette data for cache keying
-		if(palSize)
-		{
-			memcpy(newitem->dump.palette, pal, palSize*2);
-		}
-
-		//dump texture and 4x4 index data for cache keying
-		const int texsize = newitem->dump.textureSize = ms.size;
-		const int indexsize = newitem->dump.indexSize = msIndex.size;
-		newitem->dump.texture = new u8[texsize+indexsize];
-		ms.dump(&newitem->dump.texture[0],newitem->dump.maxTextureSize); //dump texture
+		newitem->decoded = arena.alloc(newitem->decode_len);
+		newitem->contentHash = mspal.hash(msIndex.hash(ms.hash(seed)));
+		newitem->generationSignature = generationSignature;
+		newitem->slotMask = ms.slots | msIndex.slots | (mspal.slots << TEXCACHE_PALETTE_SLOT_SHIFT);
+		//4x4 textures are checked against the whole palette (see invalidate())
 		if(textureMode == TEXMODE_4X4)
-			msIndex.dump(newitem->dump.texture+newitem->dump.textureSize,newitem->dump.indexSize); //dump 4x4
-
-
-		//============================================================================ 
-		//Texture conversion
-		//============================================================================ 
-
-		const u32 opaqueColor = TEXFORMAT==TexFormat_32bpp?255:31;
-		u32 palZeroTransparent = (1-((format>>29)&1))*opaqueColor;
-
-		switch (newitem->mode)
-		{
-		case TEXMODE_A3I5:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
-					{
-						u16 c = pal[*adr&31];
-						u8 alpha = *adr>>5;
-						if(TEXFORMAT == TexFormat_15bpp)
-							*dwdst++ = RGB15TO6665(c,material_3bit_to_5bit[alpha]);
-						else
-							*dwdst++ = RGB15TO32(c,material_3bit_to_8bit[alpha]);
-						adr++;
-					}
-				}
-				break;
-			}
-
-		case TEXMODE_I2:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
-					{
-						u8 bits;
-						u16 c;
-
-						bits = (*adr)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>2)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>4)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>6)&0x3;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						adr++;
-					}
-				}
-				break;
-			}
-		case TEXMODE_I4:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; x++)
-					{
-						u8 bits;
-						u16 c;
-
-						bits = (*adr)&0xF;
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-
-						bits = ((*adr)>>4);
-						c = pal[bits];
-						*dwdst++ = CONVERT(c,(bits == 0) ? palZeroTransparent : opaqueColor);
-						adr++;
-					}
-				}
-				break;
-			}
-		case TEXMODE_I8:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; ++x)
-					{
-						u16 c = pal[*adr];
-						*dwdst++ = CONVERT(c,(*adr == 0) ? palZeroTransparent : opaqueColor);
-						adr++;
-					}
-				}
-			}
-			break;
-		case TEXMODE_4X4:
-			{
-				//RGB16TO32 is used here because the other conversion macros result in broken interpolation logic
-
-				if(ms.numItems != 1) {
-					PROGINFO("Your 4x4 texture has overrun its texture slot.\n");
-				}
-				//this check isnt necessary since the addressing is tied to the texture data which will also run out:
-				//if(msIndex.numItems != 1) PROGINFO("Your 4x4 texture index has overrun its slot.\n");
-
-	#define PAL4X4(offset) ( *(u16*)( MMU.texInfo.texPalSlot[((paletteAddress + (offset)*2)>>14)&0x7] + ((paletteAddress + (offset)*2)&0x3FFF) ) )
-
-				u16* slot1;
-				u32* map = (u32*)ms.items[0].ptr;
-				u32 limit = ms.items[0].len<<2;
-				u32 d = 0;
-				if ( (format & 0xc000) == 0x8000)
-					// texel are in slot 2
-					slot1=(u16*)&MMU.texInfo.textureSlotAddr[1][((format & 0x3FFF)<<2)+0x010000];
-				else 
-					slot1=(u16*)&MMU.texInfo.textureSlotAddr[1][(format & 0x3FFF)<<2];
-
-				u16 yTmpSize = (sizeY>>2);
-				u16 xTmpSize = (sizeX>>2);
-
-				//this is flagged whenever a 4x4 overruns its slot.
-				//i am guessing we just generate black in that case
-				bool dead = false;
-
-				for (int y = 0; y < yTmpSize; y ++)
-				{
-					u32 tmpPos[4]={(y<<2)*sizeX,((y<<2)+1)*sizeX,
-						((y<<2)+2)*sizeX,((y<<2)+3)*sizeX};
-					for (int x = 0; x < xTmpSize; x ++, d++)
-					{
-						if(d >= limit)
-							dead = true;
-
-						if(dead) {
-							for (int sy = 0; sy < 4; sy++)
-							{
-								u32 currentPos = (x<<2) + tmpPos[sy];
-								dwdst[currentPos] = dwdst[currentPos+1] = dwdst[currentPos+2] = dwdst[currentPos+3] = 0;
-							}
-							continue;
-						}
-
-						u32 currBlock	= map[d];
-						u16 pal1		= slot1[d];
-						u16 pal1offset	= (pal1 & 0x3FFF)<<1;
-						u8  mode		= pal1>>14;
-						u32 tmp_col[4];
-						
-						tmp_col[0]=RGB16TO32(PAL4X4(pal1offset),255);
-						tmp_col[1]=RGB16TO32(PAL4X4(pal1offset+1),255);
-
-						switch (mode) 
-						{
-						case 0:
-							tmp_col[2]=RGB16TO32(PAL4X4(pal1offset+2),255);
-							tmp_col[3]=RGB16TO32(0x7FFF,0);
-							break;
-						case 1:
-							tmp_col[2]=(((tmp_col[0]&0xFF)+(tmp_col[1]&0xff))>>1)|
-								(((tmp_col[0]&(0xFF<<8))+(tmp_col[1]&(0xFF<<8)))>>1)|
-								(((tmp_col[0]&(0xFF<<16))+(tmp_col[1]&(0xFF<<16)))>>1)|
-								(0xff<<24);
-							tmp_col[3]=RGB16TO32(0x7FFF,0);
-							break;
-						case 2:
-							tmp_col[2]=RGB16TO32(PAL4X4(pal1offset+2),255);
-							tmp_col[3]=RGB16TO32(PAL4X4(pal1offset+3),255);
-							break;
-						case 3: 
-							{
-								u32 red1, red2;
-								u32 green1, green2;
-								u32 blue1, blue2;
-								u16 tmp1, tmp2;
-
-								red1=tmp_col[0]&0xff;
-								green1=(tmp_col[0]>>8)&0xff;
-								blue1=(tmp_col[0]>>16)&0xff;
-								red2=tmp_col[1]&0xff;
-								green2=(tmp_col[1]>>8)&0xff;
-								blue2=(tmp_col[1]>>16)&0xff;
-
-								tmp1=((red1*5+red2*3)>>6)|
-									(((green1*5+green2*3)>>6)<<5)|
-									(((blue1*5+blue2*3)>>6)<<10);
-								tmp2=((red2*5+red1*3)>>6)|
-									(((green2*5+green1*3)>>6)<<5)|
-									(((blue2*5+blue1*3)>>6)<<10);
-
-								tmp_col[2]=RGB16TO32(tmp1,255);
-								tmp_col[3]=RGB16TO32(tmp2,255);
-								break;
-							}
-						}
-
-						if(TEXFORMAT==TexFormat_15bpp)
-						{
-							for(int i=0;i<4;i++)
-							{
-								tmp_col[i] >>= 2;
-								tmp_col[i] &= 0x3F3F3F3F;
-								u32 a = tmp_col[i]>>24;
-								tmp_col[i] &= 0x00FFFFFF;
-								tmp_col[i] |= (a>>1)<<24;
-							}
-						}
-
-						//TODO - this could be more precise for 32bpp mode (run it through the color separation table)
-
-						//set all 16 texels
-						for (int sy = 0; sy < 4; sy++)
-						{
-							// Texture offset
-							u32 currentPos = (x<<2) + tmpPos[sy];
-							u8 currRow = (u8)((currBlock>>(sy<<3))&0xFF);
-
-							dwdst[currentPos] = tmp_col[currRow&3];
-							dwdst[currentPos+1] = tmp_col[(currRow>>2)&3];
-							dwdst[currentPos+2] = tmp_col[(currRow>>4)&3];
-							dwdst[currentPos+3] = tmp_col[(currRow>>6)&3];
-						}
-
+			newitem->slotMask |= TEXCACHE_PALETTE_SLOTS;
+		list_push_front(newitem);
+		//printf("allocating: up to %d with %d items\n",cache_size,numItems);
 
-					}
-				}
+		frameStats.misses++;
+		frameStats.decodedBytes += newitem->decode_len;
 
+		//dump the palette to a temp buffer, so that we don't have to worry about memory mapping.
+		//this isnt such a problem with texture memory, because we read sequentially from it.
+		//however, we read randomly from palette memory, so the mapping is more costly.
+		//used to hold a copy of the palette specified for this texture
+		u16 pal[256];
+		#ifdef WORDS_BIGENDIAN
+			mspal.dump16(pal);
+		#else
+			mspal.dump(pal);
+		#endif
 
-				break;
-			}
-		case TEXMODE_A5I3:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					adr = ms.items[j].ptr;
-					for(u32 x = 0; x < ms.items[j].len; ++x)
-					{
-						u16 c = pal[*adr&0x07];
-						u8 alpha = (*adr>>3);
-						if(TEXFORMAT == TexFormat_15bpp)
-							*dwdst++ = RGB15TO6665(c,alpha);
-						else
-							*dwdst++ = RGB15TO32(c,material_5bit_to_8bit[alpha]);
-						adr++;
-					}
-				}
-				break;
-			}
-		case TEXMODE_16BPP:
-			{
-				for(int j=0;j<ms.numItems;j++) {
-					u16* map = (u16*)ms.items[j].ptr;
-					int len = ms.items[j].len>>1;
-					for(int x = 0; x < len; ++x)
-					{
-						u16 c = map[x];
-						int alpha = ((c&0x8000)?opaqueColor:0);
-						*dwdst++ = CONVERT(c&0x7FFF,alpha);
-					}
-				}
-				break;
-			}
-		} //switch(texture format)
+		TexCache_DecodeTexture<TEXFORMAT>(format,textureMode,sizeX,sizeY,ms,pal,paletteAddress,(u32*)newitem->decoded);
 
 #ifdef DO_DEBUG_DUMP_TEXTURE
 	DebugDumpTexture(newitem);
@@ -660,30 +1186,37 @@ public:
 	} //scan()
 
 	static const int PALETTE_DUMP_SIZE = (64+16+16)*1024;
-	u8 paletteDump[PALETTE_DUMP_SIZE];
 
-	void invalidate()
+	void invalidate(u32 slotMask)
 	{
-		//check whether the palette memory changed
-		//TODO - we should handle this instead by setting dirty flags in the vram memory mapping and noting whether palette memory was dirty.
-		//but this will work for now
-		MemSpan mspal = MemSpan_TexPalette(0,PALETTE_DUMP_SIZE,true);
-		bool paletteDirty = mspal.memcmp(paletteDump);
-		if(paletteDirty)
+		//check whether the palette memory changed.
+		//the page generations tell us cheaply whether it could have; only then do we have to hash it
+		bool paletteDirty = false;
+		if(slotMask & TEXCACHE_PALETTE_SLOTS)
 		{
-			mspal.dump(paletteDump);
+			MemSpan mspal = MemSpan_TexPalette(0,PALETTE_DUMP_SIZE,true);
+			const u64 signature = mspal.generationSignature(0);
+			if(signature != paletteSignature)
+			{
+				paletteSignature = signature;
+				const u64 hash = mspal.hash(0);
+				paletteDirty = (hash != paletteHash);
+				paletteHash = hash;
+			}
 		}
 
-		for(TTexCacheItemMultimap::iterator it(index.begin()); it != index.end(); ++it)
+		//textures in none of the remapped slots still come from the same memory
+		for(TexCacheItem* item = lruHead; item; item = item->lruNext)
 		{
-			it->second->suspectedInvalid = true;
+			if(!(item->slotMask & slotMask)) continue;
+			item->suspectedInvalid = true;
 			
 			//when the palette changes, we assume all 4x4 textures are dirty.
 			//this is because each 4x4 item doesnt carry along with it a copy of the entire palette, for verification
-			//instead, we just use the one paletteDump for verifying of all 4x4 textures; and if paletteDirty is set, verification has failed
-			if(it->second->getTextureMode() == TEXMODE_4X4 && paletteDirty)
+			//instead, we just use the one palette hash for verifying of all 4x4 textures; and if paletteDirty is set, verification has failed
+			if(item->getTextureMode() == TEXMODE_4X4 && paletteDirty)
 			{
-				it->second->assumedInvalid = true;
+				item->assumedInvalid = true;
 			}
 		}
 	}
@@ -691,7 +1224,7 @@ public:
 	void evict(u32 target = kMaxCacheSize)
 	{
 		//debug print
-		//printf("%d %d/%d\n",index.size(),cache_size/1024,target/1024);
+		//printf("%d %d/%d\n",numItems,cache_size/1024,target/1024);
 
 		//dont do anything unless we're over the target
 		if(cache_size<target) return;
@@ -699,29 +1232,35 @@ public:
 		//aim at cutting the cache to half of the max size
 		target/=2;
 
-		//evicts items in an arbitrary order until it is less than the max cache size
-		//TODO - do this based on age and not arbitrarily
+		//evicts the least recently used items until it is less than the max cache size
 		while(cache_size > target)
 		{
-			if(index.size()==0) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
+			if(!lruTail) break; //just in case.. doesnt seem possible, cache_size wouldve been 0
 
-			TexCacheItem* item = index.begin()->second;
-			list_remove(item);
 			//printf("evicting! totalsize:%d\n",cache_size);
-			delete item;
+			destroy(lruTail);
+			frameStats.evictions++;
 		}
 	}
+
+	void endFrame()
+	{
+		frameStats.cacheSize = cache_size;
+		lastFrameStats = frameStats;
+		memset(&frameStats,0,sizeof(frameStats));
+	}
 } texCache;
 
 void TexCache_Reset()
 {
 	texCache.evict(0);
+	texCache.arena.release();
 }
 
-void TexCache_Invalidate()
+void TexCache_Invalidate(u32 slotMask)
 {
 	//note that this gets called whether texdata or texpalette gets reconfigured.
-	texCache.invalidate();
+	texCache.invalidate(slotMask);
 }
 
 TexCacheItem* TexCache_SetTexture(TexCache_TexFormat TEXFORMAT, u32 format, u32 texpal)
@@ -738,4 +1277,10 @@ TexCacheItem* TexCache_SetTexture(TexCache_TexFormat TEXFORMAT, u32 format, u32
 void TexCache_EvictFrame()
 {
 	texCache.evict();
+	texCache.endFrame();
+}
+
+const TexCacheStatistics& TexCache_GetFrameStatistics()
+{
+	return texCache.lastFrameStats;
 }
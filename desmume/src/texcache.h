@@ -21,7 +21,6 @@
 #define _TEXCACHE_H_
 
 #include "common.h"
-#include <map>
 
 enum TexCache_TexFormat
 {
@@ -30,10 +29,6 @@ enum TexCache_TexFormat
 	TexFormat_15bpp //used by rasterizer
 };
 
-class TexCacheItem;
-
-typedef std::multimap<u32,TexCacheItem*> TTexCacheItemMultimap;
-
 class TexCacheItem
 {
 public:
@@ -44,17 +39,21 @@ public:
 		, assumedInvalid(false)
 		, deleteCallback(NULL)
 		, cacheFormat(TexFormat_None)
+		, contentHash(0)
+		, generationSignature(0)
+		, slotMask(0)
+		, hashNext(NULL)
+		, lruPrev(NULL)
+		, lruNext(NULL)
 	{}
 	~TexCacheItem() {
-		delete[] decoded;
 		if(deleteCallback) deleteCallback(this);
 	}
 	u32 decode_len;
 	u32 mode;
-	u8* decoded; //decoded texture data
+	u8* decoded; //decoded texture data (owned by the texcache's decode arena)
 	bool suspectedInvalid;
 	bool assumedInvalid;
-	TTexCacheItemMultimap::iterator iterator;
 
 	int getTextureMode() const { return (int)((texformat>>26)&0x07); }
 
@@ -67,21 +66,50 @@ public:
 
 	TexCache_TexFormat cacheFormat;
 
-	struct Dump {
-		~Dump() {
-			delete[] texture;
-		}
-		int textureSize, indexSize;
-		static const int maxTextureSize=128*1024;
-		u8* texture;
-		u8 palette[256*2];
-	} dump;
+	//hash of the texture, 4x4 index and palette data this item was decoded from
+	u64 contentHash;
+	//combines the vram mapping and the vram page write generations of that same data.
+	//while this is unchanged, the data cant have changed and doesnt need to be rehashed.
+	u64 generationSignature;
+	//the texture and texture palette slots the source data lies in (see TEXCACHE_TEXTURE_SLOT)
+	u32 slotMask;
+
+	//texcache bookkeeping: the hash bucket chain and the LRU list
+	TexCacheItem *hashNext;
+	TexCacheItem *lruPrev, *lruNext;
+};
+
+//counters for one emulated frame's worth of texcache activity
+struct TexCacheStatistics
+{
+	u32 hits;
+	u32 misses;
+	u32 rehashes; //suspected items which had to have their vram hashed again
+	u32 decodedBytes;
+	u32 evictions;
+	u32 cacheSize; //bytes of decoded texture data held at the end of the frame
 };
 
-void TexCache_Invalidate();
+//texture memory is seen through 4 texture slots and 6 texture palette slots, each backed by whichever
+//vram bank is mapped there. a slot mask has one bit per slot, texture slots first
+#define TEXCACHE_TEXTURE_SLOT(n) (1<<(n))
+#define TEXCACHE_PALETTE_SLOT_SHIFT 4
+#define TEXCACHE_PALETTE_SLOT(n) (1<<(TEXCACHE_PALETTE_SLOT_SHIFT+(n)))
+#define TEXCACHE_PALETTE_SLOTS (0x3F<<TEXCACHE_PALETTE_SLOT_SHIFT)
+
+//marks the textures whose source data lies in any of the given slots for checking before their next use
+void TexCache_Invalidate(u32 slotMask);
 void TexCache_Reset();
 void TexCache_EvictFrame();
 
 TexCacheItem* TexCache_SetTexture(TexCache_TexFormat TEXFORMAT, u32 format, u32 texpal);
 
+//returns the counters for the last completed frame (the counters roll over in TexCache_EvictFrame)
+const TexCacheStatistics& TexCache_GetFrameStatistics();
+
+#ifdef DESMUME_SELFTEST
+//compares the texel decoders against the plain per-texel conversions over random data
+bool TexCache_SelfTest();
+#endif
+
 #endif
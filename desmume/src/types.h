@@ -58,6 +58,12 @@
 #ifdef __SSE2__
 #define ENABLE_SSE2
 #endif
+#ifdef __SSSE3__
+#define ENABLE_SSSE3
+#endif
+#ifdef __AVX2__
+#define ENABLE_AVX2
+#endif
 #endif
 
 #ifdef NOSSE
@@ -68,6 +74,14 @@
 #undef ENABLE_SSE2
 #endif
 
+#ifdef NOSSSE3
+#undef ENABLE_SSSE3
+#endif
+
+#ifdef NOAVX2
+#undef ENABLE_AVX2
+#endif
+
 #ifdef _MSC_VER 
 #define strcasecmp(x,y) _stricmp(x,y)
 #define strncasecmp(x, y, l) strnicmp(x, y, l)
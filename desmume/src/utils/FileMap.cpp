@@ -18,6 +18,7 @@
 #include "types.h"
 #include "FileMap.h"
 #include <stdio.h>
+#include <string.h>
 
 #ifdef _WINDOWS
 #include <windows.h>
@@ -37,6 +38,7 @@ public:
 	~Impl();
 
 	bool Open(int size, bool del_on_close);
+	bool Map(int fileSize, int size);
 	void Close();
 
 	void* GetPtr();
@@ -112,6 +114,14 @@ bool FileMap::Impl::Open(int size, bool del_on_close)
 	return true;
 }
 
+bool FileMap::Impl::Map(int fileSize, int size)
+{
+	//a copy-on-write section cant be bigger than its file, and a view cant be followed by the padding
+	//at a fixed address without the placeholder apis (MapViewOfFile3) that older windows doesnt have.
+	//the caller reads the file in instead
+	return false;
+}
+
 void FileMap::Impl::Close()
 {
 	if (m_Ptr)
@@ -144,6 +154,7 @@ public:
 	~Impl();
 
 	bool Open(int size, bool del_on_close);
+	bool Map(int fileSize, int size);
 	void Close();
 
 	void* GetPtr();
@@ -205,6 +216,40 @@ bool FileMap::Impl::Open(int size, bool del_on_close)
 	return true;
 }
 
+bool FileMap::Impl::Map(int fileSize, int size)
+{
+	Close();
+
+	m_hFile = open(m_szFile, O_RDONLY);
+	if (m_hFile == -1)
+		return false;
+
+	//reserve the whole span, then lay the file over the start of it
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED)
+	{
+		close(m_hFile);
+		m_hFile = -1;
+		return false;
+	}
+	if (mmap(ptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, m_hFile, 0) == MAP_FAILED)
+	{
+		munmap(ptr, size);
+		close(m_hFile);
+		m_hFile = -1;
+		return false;
+	}
+
+	//the kernel zero fills the rest of the file's last page and the anonymous pages after it,
+	//but the padding has to read as 0xFF like fillGap() leaves it (open bus on the cart)
+	memset((u8*)ptr + fileSize, 0xFF, size - fileSize);
+
+	m_Ptr = ptr;
+	m_Size = size;
+	m_DelOnClose = false;
+	return true;
+}
+
 void FileMap::Impl::Close()
 {
 	if (m_Ptr)
@@ -248,6 +293,11 @@ bool FileMap::Open(int size, bool del_on_close)
 	return impl->Open(size, del_on_close);
 }
 
+bool FileMap::Map(int fileSize, int size)
+{
+	return impl->Map(fileSize, size);
+}
+
 void FileMap::Close()
 {
 	impl->Close();
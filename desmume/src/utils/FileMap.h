@@ -25,6 +25,11 @@ public:
 	~FileMap();
 
 	bool Open(int size, bool del_on_close);
+
+	//maps the existing file copy-on-write instead of creating it. reads share the page cache, and writes
+	//only copy the pages they touch. the map is padded with 0xFF from the end of the file out to size
+	bool Map(int fileSize, int size);
+
 	void Close();
 
 	void* GetPtr();